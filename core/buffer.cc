@@ -1,5 +1,7 @@
 #include "context.h"
 
+using namespace std;
+
 cl_mem_flags Buffer::to_cl_flags(AccessType t) {
   switch (t) {
     case READ_ONLY: return CL_MEM_READ_ONLY;
@@ -11,7 +13,19 @@ cl_mem_flags Buffer::to_cl_flags(AccessType t) {
   }
 }
 
-Buffer::Buffer() : cl_buffer_(NULL), host_ptr_(NULL), size_(0) {
+cl_map_flags Buffer::to_cl_map_flags(AccessType t) {
+  switch (t) {
+    case READ_ONLY: return CL_MAP_READ;
+    case WRITE_ONLY: return CL_MAP_WRITE;
+    case READ_WRITE: return CL_MAP_READ | CL_MAP_WRITE;
+    default:
+      assert(false);
+      return CL_MAP_READ | CL_MAP_WRITE;
+  }
+}
+
+Buffer::Buffer()
+  : cl_buffer_(NULL), host_ptr_(NULL), size_(0), zero_copy_(false), pool_(NULL) {
 }
 
 Buffer::~Buffer() {
@@ -19,40 +33,171 @@ Buffer::~Buffer() {
 }
 
 void* Buffer::Read(CommandQueue* queue) {
-  cl_event event;
-  cl_int err = clEnqueueReadBuffer(queue->queue(), cl_buffer_, CL_TRUE, 0,
-      size_, host_ptr_, 0, NULL,
-      queue->enable_profiling_ ? &event : NULL);
-  if (err < 0) {
-    fprintf(stderr, "Could not read buffer: %s\n", Error(err));
+  return Read(queue, EventList());
+}
+
+bool Buffer::CopyFrom(CommandQueue* queue, const void* src_buffer, size_t buffer_len) {
+  return CopyFrom(queue, src_buffer, buffer_len, EventList());
+}
+
+bool Buffer::CopyTo(CommandQueue* queue, void* dst_buffer, size_t buffer_len) {
+  return CopyTo(queue, dst_buffer, buffer_len, EventList());
+}
+
+void* Buffer::Read(CommandQueue* queue, const EventList& wait_for, Event* event) {
+  if (zero_copy_) {
+    // The host memory is the buffer, mapping it is enough to make the device
+    // results visible.
+    if (host_ptr_ == NULL) {
+      fprintf(stderr, "Could not read buffer: no host memory, use Map()\n");
+      return NULL;
+    }
+    if (!Event::WaitAll(wait_for)) return NULL;
+    void* ptr = Map(queue, READ_ONLY);
+    if (ptr == NULL || !Unmap(queue, ptr)) return NULL;
+    // Nothing was transferred, the marker stands in for the read.
+    if (event != NULL) {
+      *event = queue->EnqueueMarker();
+      if (!event->valid()) return NULL;
+    }
+    return host_ptr_;
+  }
+
+  if (!EnqueueRead(queue, true, 0, host_ptr_, size_, wait_for, event, "BufferRead")) {
     return NULL;
   }
-  queue->EnqueueEvent(event, "BufferRead");
   return host_ptr_;
 }
 
-bool Buffer::CopyFrom(CommandQueue* queue, const void* src_buffer, size_t buffer_len) {
-  cl_event event;
-  cl_int err = clEnqueueWriteBuffer(queue->queue(), cl_buffer_, false,
-      0, buffer_len, src_buffer, 0, NULL,
-      queue->enable_profiling_ ? &event : NULL);
+bool Buffer::CopyFrom(CommandQueue* queue, const void* src_buffer, size_t buffer_len,
+    const EventList& wait_for, Event* event) {
+  return EnqueueWrite(queue, false, 0, src_buffer, buffer_len, wait_for, event,
+      "BufferCopyFromHost");
+}
+
+bool Buffer::CopyTo(CommandQueue* queue, void* dst_buffer, size_t buffer_len,
+    const EventList& wait_for, Event* event) {
+  return EnqueueRead(queue, true, 0, dst_buffer, buffer_len, wait_for, event,
+      "BufferCopyToHost");
+}
+
+Event Buffer::ReadAsync(CommandQueue* queue, void* dst_buffer, size_t buffer_len,
+    const EventList& wait_for) {
+  Event event;
+  EnqueueRead(queue, false, 0, dst_buffer, buffer_len, wait_for, &event,
+      "BufferReadAsync");
+  return event;
+}
+
+Event Buffer::WriteAsync(CommandQueue* queue, const void* src_buffer,
+    size_t buffer_len, const EventList& wait_for) {
+  Event event;
+  EnqueueWrite(queue, false, 0, src_buffer, buffer_len, wait_for, &event,
+      "BufferWriteAsync");
+  return event;
+}
+
+bool Buffer::CopyRegionTo(CommandQueue* queue, size_t offset, void* dst_buffer,
+    size_t len, const EventList& wait_for, Event* event) {
+  return EnqueueRead(queue, true, offset, dst_buffer, len, wait_for, event,
+      "BufferCopyToHost");
+}
+
+bool Buffer::CopyRegionFrom(CommandQueue* queue, size_t offset,
+    const void* src_buffer, size_t len, const EventList& wait_for, Event* event) {
+  return EnqueueWrite(queue, false, offset, src_buffer, len, wait_for, event,
+      "BufferCopyFromHost");
+}
+
+bool Buffer::EnqueueRead(CommandQueue* queue, bool blocking, size_t offset,
+    void* dst_buffer, size_t buffer_len, const EventList& wait_for, Event* event,
+    const char* name) {
+  static CommandMetrics* metrics = Metrics::Get("BufferRead");
+  CommandMetrics* sampled = Metrics::Sample(metrics, buffer_len);
+  vector<cl_event> storage;
+  const cl_event* wait_list = Event::ToClEvents(wait_for, &storage);
+  cl_event e = NULL;
+  cl_int err = clEnqueueReadBuffer(queue->queue(), cl_buffer_,
+      blocking ? CL_TRUE : CL_FALSE, offset, buffer_len, dst_buffer,
+      storage.size(), wait_list, queue->EventArg(event, sampled, &e));
+  if (err < 0) {
+    fprintf(stderr, "Could not read buffer: %s\n", Error(err));
+    return false;
+  }
+  queue->SetEvent(e, name, event, sampled, buffer_len);
+  return true;
+}
+
+bool Buffer::EnqueueWrite(CommandQueue* queue, bool blocking, size_t offset,
+    const void* src_buffer, size_t buffer_len, const EventList& wait_for,
+    Event* event, const char* name) {
+  static CommandMetrics* metrics = Metrics::Get("BufferWrite");
+  CommandMetrics* sampled = Metrics::Sample(metrics, buffer_len);
+  vector<cl_event> storage;
+  const cl_event* wait_list = Event::ToClEvents(wait_for, &storage);
+  cl_event e = NULL;
+  cl_int err = clEnqueueWriteBuffer(queue->queue(), cl_buffer_,
+      blocking ? CL_TRUE : CL_FALSE, offset, buffer_len, src_buffer,
+      storage.size(), wait_list, queue->EventArg(event, sampled, &e));
   if (err < 0) {
     fprintf(stderr, "Could not write buffer: %s\n", Error(err));
     return false;
   }
-  queue->EnqueueEvent(event, "BufferCopyFromHost");
+  queue->SetEvent(e, name, event, sampled, buffer_len);
   return true;
 }
 
-bool Buffer::CopyTo(CommandQueue* queue, void* dst_buffer, size_t buffer_len) {
-  cl_event event;
-  cl_int err = clEnqueueReadBuffer(queue->queue(), cl_buffer_, CL_TRUE, 0,
-      buffer_len, dst_buffer, 0, NULL,
-      queue->enable_profiling_ ? &event : NULL);
+bool Buffer::Migrate(CommandQueue* queue, bool content_undefined,
+    const EventList& wait_for, Event* event) {
+  static CommandMetrics* metrics = Metrics::Get("BufferMigrate");
+  const size_t bytes = content_undefined ? 0 : size_;
+  CommandMetrics* sampled = Metrics::Sample(metrics, bytes);
+  vector<cl_event> storage;
+  const cl_event* wait_list = Event::ToClEvents(wait_for, &storage);
+  cl_event e = NULL;
+  cl_int err = clEnqueueMigrateMemObjects(queue->queue(), 1, &cl_buffer_,
+      content_undefined ? CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED : 0,
+      storage.size(), wait_list, queue->EventArg(event, sampled, &e));
   if (err < 0) {
-    fprintf(stderr, "Could not read buffer: %s\n", Error(err));
+    fprintf(stderr, "Could not migrate buffer: %s\n", Error(err));
+    return false;
+  }
+  queue->SetEvent(e, "BufferMigrate", event, sampled, bytes);
+  return true;
+}
+
+void* Buffer::Map(CommandQueue* queue, AccessType access, size_t offset, size_t len) {
+  if (offset > size_) {
+    fprintf(stderr, "Could not map buffer: offset %lu is past its %lu bytes\n",
+        (unsigned long)offset, (unsigned long)size_);
+    return NULL;
+  }
+  if (len == 0) len = size_ - offset;
+  static CommandMetrics* metrics = Metrics::Get("BufferMap");
+  CommandMetrics* sampled = Metrics::Sample(metrics, len);
+  cl_event event = NULL;
+  cl_int err;
+  void* ptr = clEnqueueMapBuffer(queue->queue(), cl_buffer_, CL_TRUE,
+      to_cl_map_flags(access), offset, len, 0, NULL,
+      queue->EventArg(NULL, sampled, &event), &err);
+  if (err < 0) {
+    fprintf(stderr, "Could not map buffer: %s\n", Error(err));
+    return NULL;
+  }
+  queue->SetEvent(event, "BufferMap", NULL, sampled, len);
+  return ptr;
+}
+
+bool Buffer::Unmap(CommandQueue* queue, void* mapped_ptr) {
+  static CommandMetrics* metrics = Metrics::Get("BufferUnmap");
+  CommandMetrics* sampled = Metrics::Sample(metrics);
+  cl_event event = NULL;
+  cl_int err = clEnqueueUnmapMemObject(queue->queue(), cl_buffer_, mapped_ptr,
+      0, NULL, queue->EventArg(NULL, sampled, &event));
+  if (err < 0) {
+    fprintf(stderr, "Could not unmap buffer: %s\n", Error(err));
     return false;
   }
-  queue->EnqueueEvent(event, "BufferCopyToHost");
+  queue->SetEvent(event, "BufferUnmap", NULL, sampled);
   return true;
 }
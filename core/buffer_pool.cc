@@ -0,0 +1,235 @@
+#include "buffer_pool.h"
+#include "util.h"
+
+using namespace std;
+
+// Default slab size. Size classes up to a quarter of this come from slabs.
+const size_t DEFAULT_SLAB_SIZE = 16L * 1024L * 1024L;
+const size_t MIN_SIZE_CLASS = 256;
+
+double BufferPool::Stats::hit_rate() const {
+  if (hits + misses == 0) return 0;
+  return hits / (double)(hits + misses);
+}
+
+string BufferPool::Stats::ToString() const {
+  stringstream ss;
+  ss << "BufferPool" << endl
+     << "  InUse: " << PrintBytes(bytes_in_use) << endl
+     << "  Pooled: " << PrintBytes(bytes_pooled) << endl
+     << "  Allocated: " << PrintBytes(bytes_allocated) << endl
+     << "  HitRate: " << hit_rate() << " (" << hits << " hits, "
+     << misses << " misses)" << endl;
+  return ss.str();
+}
+
+BufferPool::BufferPool(Context* ctx, cl_context cl_ctx, size_t slab_size)
+  : ctx_(ctx), cl_ctx_(cl_ctx), slab_size_(slab_size == 0 ? DEFAULT_SLAB_SIZE : slab_size) {
+  // Sub buffer origins must be aligned to the device's base address alignment.
+  min_class_size_ = std::max<size_t>(MIN_SIZE_CLASS, ctx->device()->ptr_alignment);
+}
+
+BufferPool::~BufferPool() {
+  // Sub buffers must be released before their slabs.
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    DeleteBuffer(buffers_[i]);
+  }
+  for (size_t i = 0; i < slabs_.size(); ++i) {
+    clReleaseMemObject(slabs_[i]->mem);
+    delete slabs_[i];
+  }
+}
+
+size_t BufferPool::SizeClass(size_t size) const {
+  size_t class_size = min_class_size_;
+  while (class_size < size) class_size <<= 1;
+  return class_size;
+}
+
+Buffer* BufferPool::Allocate(const Buffer::AccessType& access, size_t size) {
+  const size_t class_size = SizeClass(size);
+  lock_guard<mutex> l(lock_);
+  if (!released_.empty()) ReclaimReleased();
+
+  Buffer* buffer = NULL;
+  vector<Buffer*>& free_list = free_[class_size];
+  if (!free_list.empty()) {
+    buffer = free_list.back();
+    free_list.pop_back();
+    stats_.bytes_pooled -= class_size;
+    ++stats_.hits;
+  } else {
+    buffer = CreateBuffer(class_size);
+    if (buffer == NULL) return NULL;
+    ++stats_.misses;
+  }
+
+  buffer->size_ = size;
+  buffer->access_ = access;
+  in_use_[buffer] = class_size;
+  map<Buffer*, Slab*>::iterator slab = slab_of_.find(buffer);
+  if (slab != slab_of_.end()) ++slab->second->live;
+  stats_.bytes_in_use += class_size;
+  return buffer;
+}
+
+void BufferPool::Release(Buffer* buffer, const EventList& wait_for) {
+  if (buffer == NULL) return;
+  lock_guard<mutex> l(lock_);
+  map<Buffer*, size_t>::iterator it = in_use_.find(buffer);
+  if (it == in_use_.end()) {
+    fprintf(stderr, "Buffer was not allocated from this pool.\n");
+    return;
+  }
+  const size_t class_size = it->second;
+  in_use_.erase(it);
+  if (wait_for.empty()) {
+    AddToFreeList(buffer, class_size);
+    return;
+  }
+  Released released;
+  released.buffer = buffer;
+  released.class_size = class_size;
+  released.wait_for = wait_for;
+  released_.push_back(released);
+}
+
+void BufferPool::AddToFreeList(Buffer* buffer, size_t class_size) {
+  map<Buffer*, Slab*>::iterator slab = slab_of_.find(buffer);
+  if (slab != slab_of_.end()) --slab->second->live;
+  free_[class_size].push_back(buffer);
+  stats_.bytes_in_use -= class_size;
+  stats_.bytes_pooled += class_size;
+}
+
+void BufferPool::ReclaimReleased() {
+  for (size_t i = 0; i < released_.size();) {
+    const Released& released = released_[i];
+    bool done = true;
+    for (size_t j = 0; j < released.wait_for.size() && done; ++j) {
+      done = released.wait_for[j].IsComplete();
+    }
+    if (!done) {
+      ++i;
+      continue;
+    }
+    AddToFreeList(released.buffer, released.class_size);
+    released_.erase(released_.begin() + i);
+  }
+}
+
+void BufferPool::Trim() {
+  lock_guard<mutex> l(lock_);
+  ReclaimReleased();
+  for (map<size_t, vector<Buffer*> >::iterator it = free_.begin();
+      it != free_.end(); ++it) {
+    // Slab classes are freed with their slab below.
+    if (it->first <= slab_size_ / 4) continue;
+    for (size_t i = 0; i < it->second.size(); ++i) {
+      Buffer* buffer = it->second[i];
+      buffers_.erase(std::find(buffers_.begin(), buffers_.end(), buffer));
+      stats_.bytes_pooled -= it->first;
+      stats_.bytes_allocated -= it->first;
+      DeleteBuffer(buffer);
+    }
+    it->second.clear();
+  }
+
+  for (size_t i = 0; i < slabs_.size();) {
+    Slab* slab = slabs_[i];
+    if (slab->live > 0) {
+      ++i;
+      continue;
+    }
+    // All of its buffers are in the free list, and must be released first.
+    vector<Buffer*>& free_list = free_[slab->class_size];
+    for (size_t j = 0; j < slab->buffers.size(); ++j) {
+      Buffer* buffer = slab->buffers[j];
+      free_list.erase(std::find(free_list.begin(), free_list.end(), buffer));
+      buffers_.erase(std::find(buffers_.begin(), buffers_.end(), buffer));
+      slab_of_.erase(buffer);
+      stats_.bytes_pooled -= slab->class_size;
+      DeleteBuffer(buffer);
+    }
+    clReleaseMemObject(slab->mem);
+    stats_.bytes_allocated -= slab->size;
+    delete slab;
+    slabs_.erase(slabs_.begin() + i);
+  }
+}
+
+void BufferPool::DeleteBuffer(Buffer* buffer) {
+  // Kernels may still cache the cl_mem as an argument, and a buffer created
+  // later can get the same handle.
+  ctx_->ForgetBuffer(buffer);
+  delete buffer;
+}
+
+BufferPool::Stats BufferPool::stats() const {
+  lock_guard<mutex> l(lock_);
+  return stats_;
+}
+
+BufferPool::Slab* BufferPool::GetSlab(size_t class_size) {
+  for (size_t i = 0; i < slabs_.size(); ++i) {
+    Slab* slab = slabs_[i];
+    if (slab->class_size == class_size &&
+        (slab->buffers.size() + 1) * class_size <= slab->size) {
+      return slab;
+    }
+  }
+
+  // No space is left at the end of the slab that a buffer can't use.
+  const size_t size = slab_size_ / class_size * class_size;
+  cl_int err;
+  cl_mem mem = clCreateBuffer(cl_ctx_, CL_MEM_READ_WRITE, size, NULL, &err);
+  if (err < 0) {
+    fprintf(stderr, "Could not create buffer slab: %s\n", Error(err));
+    return NULL;
+  }
+  Slab* slab = new Slab();
+  slab->mem = mem;
+  slab->size = size;
+  slab->class_size = class_size;
+  slab->live = 0;
+  slabs_.push_back(slab);
+  stats_.bytes_allocated += size;
+  return slab;
+}
+
+Buffer* BufferPool::CreateBuffer(size_t class_size) {
+  cl_int err;
+  cl_mem mem;
+  Slab* slab = NULL;
+  if (class_size > slab_size_ / 4) {
+    mem = clCreateBuffer(cl_ctx_, CL_MEM_READ_WRITE, class_size, NULL, &err);
+    if (err < 0) {
+      fprintf(stderr, "Could not create buffer: %s\n", Error(err));
+      return NULL;
+    }
+    stats_.bytes_allocated += class_size;
+  } else {
+    slab = GetSlab(class_size);
+    if (slab == NULL) return NULL;
+    // Class sizes are multiples of min_class_size_ so the origin stays aligned.
+    cl_buffer_region region;
+    region.origin = slab->buffers.size() * class_size;
+    region.size = class_size;
+    mem = clCreateSubBuffer(slab->mem, 0, CL_BUFFER_CREATE_TYPE_REGION,
+        &region, &err);
+    if (err < 0) {
+      fprintf(stderr, "Could not create sub buffer: %s\n", Error(err));
+      return NULL;
+    }
+  }
+
+  Buffer* buffer = new Buffer();
+  buffer->cl_buffer_ = mem;
+  buffer->pool_ = this;
+  buffers_.push_back(buffer);
+  if (slab != NULL) {
+    slab->buffers.push_back(buffer);
+    slab_of_[buffer] = slab;
+  }
+  return buffer;
+}
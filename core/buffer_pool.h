@@ -0,0 +1,122 @@
+#ifndef NONG_BUFFER_POOL_H
+#define NONG_BUFFER_POOL_H
+
+#include "context.h"
+
+// Recycles device buffers so that code that allocates per request does not
+// pay for clCreateBuffer on every call or grow device memory without bound.
+// Requests are rounded up to a power of 2 size class. Classes up to
+// slab_size / 4 are carved with clCreateSubBuffer out of slabs that hold
+// buffers of one class only, larger ones get a buffer of their own. Released
+// buffers go back to a free list for their class and are handed out again by
+// the next request of that class.
+//
+// The pool is thread safe. Buffers from the pool must be returned with
+// Release() and must not be used afterwards. A buffer is handed out again as
+// soon as it is released, so commands still using it (on another queue than
+// the next user's) must be passed to Release() to wait for.
+class BufferPool {
+ public:
+  struct Stats {
+    // Bytes (rounded up to the size class) of the buffers handed out, or
+    // released but waiting for their commands.
+    size_t bytes_in_use;
+    // Bytes of released buffers that are ready to be reused.
+    size_t bytes_pooled;
+    // Device memory owned by the pool (slabs and dedicated buffers).
+    size_t bytes_allocated;
+    long hits;
+    long misses;
+
+    Stats() : bytes_in_use(0), bytes_pooled(0), bytes_allocated(0),
+      hits(0), misses(0) {}
+
+    // Fraction of allocations served from the free lists.
+    double hit_rate() const;
+    std::string ToString() const;
+  };
+
+  ~BufferPool();
+
+  // Returns a buffer of at least size bytes. Returns NULL on failure.
+  Buffer* Allocate(const Buffer::AccessType& access, size_t size);
+
+  // Returns buffer, which must have come from Allocate(), to the pool. It is
+  // reused once all events in wait_for are complete.
+  void Release(Buffer* buffer, const EventList& wait_for = EventList());
+
+  // Frees the pooled buffers that are not part of a slab and the slabs none
+  // of whose buffers are in use.
+  void Trim();
+
+  Stats stats() const;
+
+ private:
+  friend class Context;
+
+  BufferPool(Context* ctx, cl_context cl_ctx, size_t slab_size);
+  BufferPool(const BufferPool&);
+  BufferPool& operator=(const BufferPool&);
+
+  // Returns the size class for a request of size bytes.
+  size_t SizeClass(size_t size) const;
+
+  // Creates a new buffer of class_size bytes. Must hold lock_.
+  Buffer* CreateBuffer(size_t class_size);
+
+  // Frees buffer, which is no longer in use or in a free list.
+  void DeleteBuffer(Buffer* buffer);
+
+  // Puts buffer of class_size on its free list. Must hold lock_.
+  void AddToFreeList(Buffer* buffer, size_t class_size);
+
+  // Moves released buffers whose commands are done to the free lists. Must
+  // hold lock_.
+  void ReclaimReleased();
+
+  Context* ctx_; // unowned
+  cl_context cl_ctx_;
+  const size_t slab_size_;
+  // Smallest size class, also the alignment of sub buffers in a slab.
+  size_t min_class_size_;
+
+  mutable std::mutex lock_;
+
+  // A slab that buffers of one size class are carved from. Its size is the
+  // largest multiple of the class size up to slab_size_.
+  struct Slab {
+    cl_mem mem;
+    size_t size;
+    size_t class_size;
+    // Buffers carved so far, from offset 0 on.
+    std::vector<Buffer*> buffers;
+    // Number of buffers that are handed out.
+    size_t live;
+  };
+
+  // Returns a slab of class_size with room for another buffer, creating it if
+  // needed. Must hold lock_.
+  Slab* GetSlab(size_t class_size);
+
+  std::vector<Slab*> slabs_;
+  // Slab of every buffer carved from one.
+  std::map<Buffer*, Slab*> slab_of_;
+
+  // Free buffers by size class.
+  std::map<size_t, std::vector<Buffer*> > free_;
+  // Size class of every buffer handed out.
+  std::map<Buffer*, size_t> in_use_;
+  // Released buffers waiting for their commands, still counted as in use.
+  struct Released {
+    Buffer* buffer;
+    size_t class_size;
+    EventList wait_for;
+  };
+  std::vector<Released> released_;
+  // Every buffer the pool created.
+  std::vector<Buffer*> buffers_;
+
+  Stats stats_;
+};
+
+#endif
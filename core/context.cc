@@ -1,4 +1,7 @@
 #include "context.h"
+#include "buffer_pool.h"
+#include "profiler.h"
+#include "work_group_tuner.h"
 #include "core/util.h"
 
 using namespace std;
@@ -10,6 +13,7 @@ Context* Context::Create(const DeviceInfo* device, bool enable_profiling) {
     delete ctx;
     return NULL;
   }
+  ctx->buffer_pool_ = new BufferPool(ctx, ctx->ctx_, 0);
   if (!ctx->CreateCommandQueue()) {
     delete ctx;
     return NULL;
@@ -18,24 +22,156 @@ Context* Context::Create(const DeviceInfo* device, bool enable_profiling) {
 }
 
 Context::Context(const DeviceInfo* device, bool enable_profiling)
-  : device_(device), enable_profiling_(enable_profiling), ctx_(NULL), err_(0) {
+  : device_(device), enable_profiling_(enable_profiling), ctx_(NULL), err_(0),
+    program_cache_(NULL), tuner_(NULL), buffer_pool_(NULL),
+    alive_(new std::atomic<bool>(true)) {
 }
 
+struct Context::PendingBuild {
+  Context* ctx;
+  string key;
+  string cache_key;
+  string path;
+  promise<Program*> result;
+  shared_future<Program*> future;
+  // Callers waiting for the program, each a use of it. Access must hold
+  // programs_lock_.
+  int users;
+};
+
 Context::~Context() {
+  *alive_ = false;
+  // Async builds reference the context.
+  vector<shared_future<Program*> > pending;
+  {
+    lock_guard<mutex> l(programs_lock_);
+    for (map<string, shared_ptr<PendingBuild> >::iterator it =
+        pending_programs_.begin(); it != pending_programs_.end(); ++it) {
+      pending.push_back(it->second->future);
+    }
+  }
+  for (size_t i = 0; i < pending.size(); ++i) pending[i].wait();
+
   for (map<string, Program*>::iterator it = programs_.begin();
       it != programs_.end(); ++it) {
     delete it->second;
   }
-  for (size_t i = 0; i < kernels_.size(); ++i) {
-    delete kernels_[i];
+  for (set<Program*>::iterator it = src_programs_.begin();
+      it != src_programs_.end(); ++it) {
+    delete *it;
+  }
+  // The pool forgets its buffers in the kernels, so it goes first.
+  delete buffer_pool_;
+  for (set<Kernel*>::iterator it = kernels_.begin(); it != kernels_.end(); ++it) {
+    delete *it;
   }
   for (size_t i = 0; i < command_queues_.size(); ++i) {
     delete command_queues_[i];
   }
-  for (size_t i = 0; i < buffers_.size(); ++i) {
-    delete buffers_[i];
+  for (set<Buffer*>::iterator it = buffers_.begin(); it != buffers_.end(); ++it) {
+    delete *it;
   }
   if (ctx_ != NULL) clReleaseContext(ctx_);
+  delete program_cache_;
+}
+
+void Context::Release(Buffer* buffer) {
+  if (buffer == NULL) return;
+  if (buffer->pool_ != NULL) {
+    buffer->pool_->Release(buffer);
+    return;
+  }
+  if (buffers_.erase(buffer) == 0) {
+    fprintf(stderr, "Buffer was not created by this context.\n");
+    return;
+  }
+  ForgetBuffer(buffer);
+  delete buffer;
+}
+
+void Context::ForgetBuffer(const Buffer* buffer) {
+  lock_guard<mutex> l(kernels_lock_);
+  for (set<Kernel*>::iterator it = kernels_.begin(); it != kernels_.end(); ++it) {
+    (*it)->ForgetBuffer(buffer);
+  }
+}
+
+void Context::Release(Kernel* kernel) {
+  if (kernel == NULL) return;
+  {
+    lock_guard<mutex> l(kernels_lock_);
+    if (kernels_.erase(kernel) == 0) {
+      fprintf(stderr, "Kernel was not created by this context.\n");
+      return;
+    }
+  }
+  Program* program = kernel->program_;
+  delete kernel;
+  Release(program);
+}
+
+void Context::Release(Program* program) {
+  if (program == NULL) return;
+  {
+    lock_guard<mutex> l(programs_lock_);
+    if (src_programs_.erase(program) == 0) {
+      map<string, Program*>::iterator it = programs_.begin();
+      while (it != programs_.end() && it->second != program) ++it;
+      if (it == programs_.end()) {
+        fprintf(stderr, "Program was not created by this context.\n");
+        return;
+      }
+      // Programs from files are shared by everyone loading the same file.
+      if (--program->users_ > 0) return;
+      programs_.erase(it);
+    }
+  }
+  // Kernels created from the program keep it alive in the runtime.
+  delete program;
+}
+
+void Context::Release(CommandQueue* queue) {
+  if (queue == NULL) return;
+  vector<CommandQueue*>::iterator it =
+      std::find(command_queues_.begin(), command_queues_.end(), queue);
+  if (it == command_queues_.end()) {
+    fprintf(stderr, "Queue was not created by this context.\n");
+    return;
+  }
+  if (it == command_queues_.begin()) {
+    fprintf(stderr, "The default queue can't be released.\n");
+    return;
+  }
+  command_queues_.erase(it);
+  // Releasing the queue does not wait for its commands, but they still run.
+  delete queue;
+}
+
+string Context::LeakReport() const {
+  stringstream ss;
+  size_t buffer_bytes = 0;
+  for (set<Buffer*>::const_iterator it = buffers_.begin(); it != buffers_.end(); ++it) {
+    buffer_bytes += (*it)->size();
+  }
+  {
+    lock_guard<mutex> l(programs_lock_);
+    ss << "Programs: " << programs_.size() + src_programs_.size() << endl;
+  }
+  {
+    lock_guard<mutex> l(kernels_lock_);
+    ss << "Kernels: " << kernels_.size() << endl;
+    for (set<Kernel*>::const_iterator it = kernels_.begin(); it != kernels_.end(); ++it) {
+      ss << "  " << (*it)->fn_name() << endl;
+    }
+  }
+  ss << "CommandQueues: " << command_queues_.size() - 1 << " (excluding default)" << endl;
+  ss << "Buffers: " << buffers_.size() << " (" << PrintBytes(buffer_bytes) << ")" << endl;
+  return ss.str();
+}
+
+void Context::EnableProgramCache(const string& dir) {
+  delete program_cache_;
+  program_cache_ = new ProgramCache(dir);
 }
 
 string Program::BuildOptions::ToString() const {
@@ -47,35 +183,85 @@ string Program::BuildOptions::ToString() const {
   return ss.str();
 }
 
+string Program::BuildOptions::Preamble() const {
+  stringstream ss;
+  for (map<string, string>::const_iterator it = defines.begin();
+      it != defines.end(); ++it) {
+    ss << "#define " << it->first << " " << it->second << endl;
+  }
+  return ss.str();
+}
+
 Kernel* Context::CreateKernel(const char* path, const char* fn_name,
     const Program::BuildOptions& options) {
   Program* program = CreateProgramFromFile(path, options);
   if (program == NULL) return NULL;
-  return CreateKernel(program, fn_name);
+  Kernel* kernel = CreateKernel(program, fn_name);
+  if (kernel == NULL) {
+    Release(program);
+    return NULL;
+  }
+  // Kernels of the same file share the program until they are all released.
+  kernel->program_ = program;
+  return kernel;
 }
 
-Program* Context::CreateProgramFromFile(const char* path,
-    const Program::BuildOptions& options) {
-  if (programs_.find(path) != programs_.end()) return programs_[path];
+static string ProgramKey(const char* path, const Program::BuildOptions& options) {
+  return string(path) + "\n" + options.ToString() + "\n" + options.Preamble();
+}
 
+static bool ReadFile(const char* path, string* contents) {
   FILE* file = fopen(path, "r");
   if (file == NULL) {
     fprintf(stderr, "Could not find program: %s\n", path);
-    return NULL;
+    return false;
   }
   fseek(file, 0, SEEK_END);
   size_t size = ftell(file);
   rewind(file);
 
-  vector<char> buffer;
-  buffer.resize(size + 1);
-  size_t num_bytes = fread(&buffer[0], sizeof(char), size, file);
+  contents->resize(size);
+  size_t num_bytes = fread(&(*contents)[0], sizeof(char), size, file);
   assert(num_bytes == size);
   fclose(file);
+  return true;
+}
 
-  Program* program = CreateProgramFromSrc(&buffer[0], size, options, path);
+Program* Context::CreateProgramFromFile(const char* path,
+    const Program::BuildOptions& options) {
+  const string& key = ProgramKey(path, options);
+  std::shared_future<Program*> pending;
+  {
+    lock_guard<mutex> l(programs_lock_);
+    map<string, Program*>::iterator it = programs_.find(key);
+    if (it != programs_.end()) {
+      ++it->second->users_;
+      return it->second;
+    }
+    map<string, shared_ptr<PendingBuild> >::iterator pending_it =
+        pending_programs_.find(key);
+    if (pending_it != pending_programs_.end()) {
+      ++pending_it->second->users;
+      pending = pending_it->second->future;
+    }
+  }
+  if (pending.valid()) return pending.get();
+
+  string source;
+  if (!ReadFile(path, &source)) return NULL;
+  Program* program = BuildProgram(source.c_str(), source.size(), options, path);
   if (program == NULL) return program;
-  programs_[path] = program;
+
+  lock_guard<mutex> l(programs_lock_);
+  map<string, Program*>::iterator it = programs_.find(key);
+  if (it != programs_.end()) {
+    // Lost the race with an async build of the same program.
+    delete program;
+    ++it->second->users_;
+    return it->second;
+  }
+  program->users_ = 1;
+  programs_[key] = program;
   return program;
 };
 
@@ -85,7 +271,7 @@ string Context::GetBuildError(cl_program program) {
       program, device_->device(), CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
   if (err < 0) {
     fprintf(stderr, "Could not get build log size: %s\n", Error(err));
-    return NULL;
+    return "";
   }
   vector<char> log;
   log.resize(log_size + 1);
@@ -93,37 +279,259 @@ string Context::GetBuildError(cl_program program) {
       program, device_->device(), CL_PROGRAM_BUILD_LOG, log_size, &log[0], NULL);
   if (err < 0) {
     fprintf(stderr, "Could not get build log: %s\n", Error(err));
-    return NULL;
+    return "";
   }
   return &log[0];
 }
 
+void Context::PrintBuildError(cl_program program, cl_int err, const char* filename) {
+  const string& errors = GetBuildError(program);
+  fprintf(stderr, "Could not build program: %s\n", Error(err));
+  if (filename != NULL) fprintf(stderr, "Erros in file %s\n", filename);
+  fprintf(stderr, "**************************************************************************\n");
+  fprintf(stderr, "%s\n", errors.c_str());
+  fprintf(stderr, "**************************************************************************\n");
+}
+
 Program* Context::CreateProgramFromSrc(const char* source, size_t size,
     const Program::BuildOptions& options, const char* filename) {
+  Program* program = BuildProgram(source, size, options, filename);
+  if (program == NULL) return NULL;
+  lock_guard<mutex> l(programs_lock_);
+  src_programs_.insert(program);
+  return program;
+}
+
+string Context::BuildFlags(const Program::BuildOptions& options) const {
+  string flags = options.ToString();
+  if (device_->version >= DeviceInfo::Version::OPEN_CL_1_2) {
+    flags += " -cl-kernel-arg-info";
+  }
+  return flags;
+}
+
+Program* Context::BuildProgram(const char* source, size_t size,
+    const Program::BuildOptions& options, const char* filename) {
+  string full_source;
+  if (!options.defines.empty()) {
+    full_source = options.Preamble() + string(source, size);
+    source = full_source.c_str();
+    size = full_source.size();
+  }
+
+  string build_str = BuildFlags(options);
+  string cache_key;
+  if (program_cache_ != NULL) {
+    cache_key = ProgramCache::Key(device_, source, size, build_str);
+    cl_program program = LoadCachedProgram(cache_key, build_str);
+    if (program != NULL) {
+      program_cache_->RecordHit();
+      return new Program(program);
+    }
+    program_cache_->RecordMiss();
+  }
+
   cl_program program = clCreateProgramWithSource(ctx_, 1, &source, &size, &err_);
   if (err_ < 0) {
     fprintf(stderr, "Could not create program: %s.\n", Error(err_));
     return NULL;
   }
-  string build_str = options.ToString();
   err_ = clBuildProgram(program, 0, NULL, build_str.c_str(), NULL, NULL);
   if (err_ < 0) {
-    const string& errors = GetBuildError(program);
-    fprintf(stderr, "Could not build program: %s\n", Error(err_));
-    if (filename != NULL) fprintf(stderr, "Erros in file %s\n", filename);
-    fprintf(stderr, "**************************************************************************\n");
-    fprintf(stderr, "%s\n", errors.c_str());
-    fprintf(stderr, "**************************************************************************\n");
+    PrintBuildError(program, err_, filename);
+    clReleaseProgram(program);
     return NULL;
   }
+  if (program_cache_ != NULL) StoreCachedProgram(cache_key, program);
   return new Program(program);
 }
 
+shared_future<Program*> Context::CreateProgramAsync(const char* path,
+    const Program::BuildOptions& options) {
+  const string& key = ProgramKey(path, options);
+  shared_ptr<PendingBuild> build(new PendingBuild());
+  build->ctx = this;
+  build->key = key;
+  build->path = path;
+  build->future = build->result.get_future().share();
+  build->users = 1;
+  {
+    // Look up and register in one go, so concurrent callers for the same key
+    // share one build.
+    lock_guard<mutex> l(programs_lock_);
+    map<string, Program*>::iterator it = programs_.find(key);
+    if (it != programs_.end()) {
+      ++it->second->users_;
+      build->result.set_value(it->second);
+      return build->future;
+    }
+    map<string, shared_ptr<PendingBuild> >::iterator pending_it =
+        pending_programs_.find(key);
+    if (pending_it != pending_programs_.end()) {
+      ++pending_it->second->users;
+      return pending_it->second->future;
+    }
+    pending_programs_[key] = build;
+  }
+
+  string source;
+  if (!ReadFile(path, &source)) {
+    FinishBuild(build.get(), NULL);
+    return build->future;
+  }
+  source = options.Preamble() + source;
+  const char* src = source.c_str();
+  size_t size = source.size();
+  string build_str = BuildFlags(options);
+
+  if (program_cache_ != NULL) {
+    // Loading binaries is fast, it's not worth doing asynchronously.
+    build->cache_key = ProgramCache::Key(device_, src, size, build_str);
+    cl_program program = LoadCachedProgram(build->cache_key, build_str);
+    if (program != NULL) {
+      program_cache_->RecordHit();
+      FinishBuild(build.get(), program);
+      return build->future;
+    }
+    program_cache_->RecordMiss();
+  }
+
+  cl_int err;
+  cl_program program = clCreateProgramWithSource(ctx_, 1, &src, &size, &err);
+  if (err < 0) {
+    fprintf(stderr, "Could not create program: %s.\n", Error(err));
+    FinishBuild(build.get(), NULL);
+    return build->future;
+  }
+
+  // The callback owns a reference. A build rejected up front never starts,
+  // so the callback doesn't run and the reference is dropped here.
+  shared_ptr<PendingBuild>* callback_ref = new shared_ptr<PendingBuild>(build);
+  err = clBuildProgram(program, 0, NULL, build_str.c_str(), OnBuildComplete,
+      callback_ref);
+  if (err < 0) {
+    delete callback_ref;
+    PrintBuildError(program, err, path);
+    clReleaseProgram(program);
+    FinishBuild(build.get(), NULL);
+  }
+  return build->future;
+}
+
+void CL_CALLBACK Context::OnBuildComplete(cl_program program, void* data) {
+  shared_ptr<PendingBuild>* build = reinterpret_cast<shared_ptr<PendingBuild>*>(data);
+  Context* ctx = (*build)->ctx;
+  cl_build_status status;
+  cl_int err = clGetProgramBuildInfo(program, ctx->device_->device(),
+      CL_PROGRAM_BUILD_STATUS, sizeof(status), &status, NULL);
+  if (err < 0 || status != CL_BUILD_SUCCESS) {
+    ctx->PrintBuildError(program, err < 0 ? err : CL_BUILD_PROGRAM_FAILURE,
+        (*build)->path.c_str());
+    clReleaseProgram(program);
+    ctx->FinishBuild(build->get(), NULL);
+  } else {
+    if (ctx->program_cache_ != NULL) {
+      ctx->StoreCachedProgram((*build)->cache_key, program);
+    }
+    ctx->FinishBuild(build->get(), program);
+  }
+  delete build;
+}
+
+void Context::FinishBuild(PendingBuild* build, cl_program program) {
+  Program* result = NULL;
+  {
+    lock_guard<mutex> l(programs_lock_);
+    if (program != NULL) {
+      map<string, Program*>::iterator it = programs_.find(build->key);
+      if (it != programs_.end()) {
+        // A synchronous build of the same program finished first.
+        clReleaseProgram(program);
+        result = it->second;
+      } else {
+        result = new Program(program);
+        programs_[build->key] = result;
+      }
+      result->users_ += build->users;
+    }
+    map<string, shared_ptr<PendingBuild> >::iterator it =
+        pending_programs_.find(build->key);
+    if (it != pending_programs_.end() && it->second.get() == build) {
+      pending_programs_.erase(it);
+    }
+  }
+  build->result.set_value(result);
+}
+
+cl_program Context::LoadCachedProgram(const string& key, const string& build_str) {
+  vector<unsigned char> binary;
+  if (!program_cache_->Load(key, &binary)) return NULL;
+
+  const unsigned char* data = &binary[0];
+  size_t size = binary.size();
+  cl_int status;
+  cl_int err;
+  cl_program program = clCreateProgramWithBinary(
+      ctx_, 1, &device_->device(), &size, &data, &status, &err);
+  if (err < 0 || status < 0) {
+    fprintf(stderr, "Could not load cached program %s: %s\n", key.c_str(),
+        Error(err < 0 ? err : status));
+    if (program != NULL) clReleaseProgram(program);
+    return NULL;
+  }
+  // Binaries still need to be built, but this skips the compiler.
+  err = clBuildProgram(program, 0, NULL, build_str.c_str(), NULL, NULL);
+  if (err < 0) {
+    fprintf(stderr, "Could not build cached program %s: %s\n", key.c_str(), Error(err));
+    clReleaseProgram(program);
+    return NULL;
+  }
+  return program;
+}
+
+void Context::StoreCachedProgram(const string& key, cl_program program) {
+  // The context only has one device so there is exactly one binary.
+  size_t size;
+  cl_int err = clGetProgramInfo(
+      program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL);
+  if (err < 0) {
+    fprintf(stderr, "Could not get program binary: %s\n", Error(err));
+    return;
+  }
+  if (size == 0) {
+    fprintf(stderr, "Could not get program binary: the driver returned none\n");
+    return;
+  }
+  vector<unsigned char> binary(size);
+  unsigned char* data = &binary[0];
+  err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(data), &data, NULL);
+  if (err < 0) {
+    fprintf(stderr, "Could not get program binary: %s\n", Error(err));
+    return;
+  }
+  program_cache_->Store(key, binary);
+}
+
 Kernel* Context::CreateKernel(Program* program, const char* fn_name) {
+  return CreateKernel(program->program(), fn_name);
+}
+
+Kernel* Context::CloneKernel(const Kernel* kernel) {
+  cl_program program;
+  cl_int err = clGetKernelInfo(kernel->kernel_, CL_KERNEL_PROGRAM,
+      sizeof(program), &program, NULL);
+  if (err < 0) {
+    fprintf(stderr, "Could not get kernel info: %s\n", Error(err));
+    return NULL;
+  }
+  return CreateKernel(program, kernel->fn_name_);
+}
+
+Kernel* Context::CreateKernel(cl_program program, const string& fn_name) {
   cl_int err;
-  cl_kernel kern = clCreateKernel(program->program(), fn_name, &err);
+  cl_kernel kern = clCreateKernel(program, fn_name.c_str(), &err);
   if (err < 0) {
-    fprintf(stderr, "Could not create kernel: %s\n", fn_name);
+    fprintf(stderr, "Could not create kernel: %s\n", fn_name.c_str());
     return NULL;
   }
   size_t size;
@@ -135,17 +543,48 @@ Kernel* Context::CreateKernel(Program* program, const char* fn_name) {
     return NULL;
   }
 
+  size_t multiple;
+  err = clGetKernelWorkGroupInfo(kern, device_->device(),
+      CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(multiple), &multiple, 0);
+  if (err < 0) multiple = 1;
+  cl_ulong local_mem;
+  err = clGetKernelWorkGroupInfo(kern, device_->device(), CL_KERNEL_LOCAL_MEM_SIZE,
+      sizeof(local_mem), &local_mem, 0);
+  if (err < 0) local_mem = 0;
+
   Kernel* kernel = new Kernel();
   kernel->fn_name_ = fn_name;
+  kernel->metrics_ = Metrics::Get(fn_name);
   kernel->kernel_ = kern;
   kernel->max_work_group_size_ = size;
-  kernels_.push_back(kernel);
+  kernel->preferred_work_group_multiple_ = multiple;
+  kernel->local_mem_size_ = local_mem;
+  kernel->tuner_ = tuner_;
+  if (!kernel->LoadArgInfo()) {
+    delete kernel;
+    return NULL;
+  }
+  lock_guard<mutex> l(kernels_lock_);
+  kernels_.insert(kernel);
   return kernel;
 }
 
+void Context::SetWorkGroupTuner(const WorkGroupTuner* tuner) {
+  tuner_ = tuner;
+  lock_guard<mutex> l(kernels_lock_);
+  for (set<Kernel*>::iterator it = kernels_.begin(); it != kernels_.end(); ++it) {
+    (*it)->tuner_ = tuner;
+    (*it)->tuned_.clear();
+  }
+}
+
 CommandQueue* Context::CreateCommandQueue() {
+  return CreateCommandQueue(enable_profiling_);
+}
+
+CommandQueue* Context::CreateCommandQueue(bool enable_profiling) {
   cl_command_queue_properties properties = 0;
-  if (enable_profiling_) properties |= CL_QUEUE_PROFILING_ENABLE;
+  if (enable_profiling) properties |= CL_QUEUE_PROFILING_ENABLE;
 
   cl_command_queue queue = clCreateCommandQueue(
       ctx_, device_->device(), properties, &err_);
@@ -153,7 +592,7 @@ CommandQueue* Context::CreateCommandQueue() {
     fprintf(stderr, "Could not create command queue: %s.", Error(err_));
     return NULL;
   }
-  CommandQueue* q = new CommandQueue(queue, enable_profiling_);
+  CommandQueue* q = new CommandQueue(queue, device_, enable_profiling);
   command_queues_.push_back(q);
   return q;
 }
@@ -173,37 +612,248 @@ Buffer* Context::CreateBufferFromMem(const Buffer::AccessType& access,
   buf->host_ptr_ = buffer;
   buf->size_ = size;
   buf->access_ = access;
-  buffers_.push_back(buf);
+  buffers_.insert(buf);
   return buf;
 }
 
-void CommandQueue::EnqueueEvent(cl_event e, const string& name) {
-  if (!enable_profiling_) return;
-  profiling_events_.push_back(ProfileEvent(name == "" ? "Event" : name, e));
+Buffer* Context::CreateBuffer(const Buffer::AccessType& access, size_t size) {
+  cl_int err;
+  cl_mem cl_buffer = clCreateBuffer(ctx_, Buffer::to_cl_flags(access), size, NULL, &err);
+  if (err < 0) {
+    fprintf(stderr, "Could not create buffer: %s\n", Error(err));
+    return NULL;
+  }
+
+  Buffer* buf = new Buffer();
+  buf->cl_buffer_ = cl_buffer;
+  buf->size_ = size;
+  buf->access_ = access;
+  buffers_.insert(buf);
+  return buf;
 }
 
-string CommandQueue::GetEventsProfile() const {
-  if (profiling_events_.empty()) return "";
-  stringstream ss;
+Buffer* Context::CreateLocalBuffer(const Buffer::AccessType& access, size_t size) {
+  Buffer* buf = CreateBuffer(access, size);
+  if (buf == NULL) return NULL;
+  if (!buf->Migrate(default_queue(), true) || !default_queue()->Flush()) {
+    Release(buf);
+    return NULL;
+  }
+  return buf;
+}
+
+// Intel zero copy requires the size to be a multiple of the cache line.
+static const size_t ZERO_COPY_SIZE_MULTIPLE = 64;
+
+void* Context::AllocateHostMem(size_t size) const {
+  size = (size + ZERO_COPY_SIZE_MULTIPLE - 1) & ~(ZERO_COPY_SIZE_MULTIPLE - 1);
+  void* ptr = AllocAligned(size, device_->ptr_alignment);
+  if (ptr == NULL) {
+    fprintf(stderr, "Could not allocate %s of host memory.\n", PrintBytes(size).c_str());
+  }
+  return ptr;
+}
+
+Buffer* Context::CreateZeroCopyBuffer(const Buffer::AccessType& access,
+    void* buffer, size_t size) {
+  cl_mem_flags flags = Buffer::to_cl_flags(access);
+  if (buffer == NULL) {
+    flags |= CL_MEM_ALLOC_HOST_PTR;
+  } else {
+    flags |= CL_MEM_USE_HOST_PTR;
+    if ((size_t)buffer % device_->ptr_alignment != 0) {
+      fprintf(stderr, "Zero copy buffer is not aligned to %u bytes, "
+          "the device might copy it.\n", device_->ptr_alignment);
+    }
+  }
   cl_int err;
-  cl_ulong queue_start = 0;
-  for (size_t i = 0; i < profiling_events_.size(); ++i) {
+  cl_mem cl_buffer = clCreateBuffer(ctx_, flags, size, buffer, &err);
+  if (err < 0) {
+    fprintf(stderr, "Could not create buffer: %s\n", Error(err));
+    return NULL;
+  }
+
+  Buffer* buf = new Buffer();
+  buf->cl_buffer_ = cl_buffer;
+  buf->host_ptr_ = buffer;
+  buf->size_ = size;
+  buf->access_ = access;
+  buf->zero_copy_ = true;
+  buffers_.insert(buf);
+  return buf;
+}
+
+CommandQueue::CommandQueue(cl_command_queue queue, const DeviceInfo* device,
+    bool enable_profiling)
+  : queue_(queue), device_(device), enable_profiling_(enable_profiling),
+    track_(-1), clock_offset_ns_(0) {
+  if (!enable_profiling_) return;
+  CalibrateClock();
+  static atomic<int> num_queues(0);
+  stringstream ss;
+  ss << "Queue " << num_queues++ << " (" << device_->name << ")";
+  track_ = Profiler::RegisterTrack(ss.str(), HarvestEvents, this);
+}
+
+CommandQueue::~CommandQueue() {
+  if (enable_profiling_) {
+    // Harvested first so the track is kept for the spans of this queue.
+    HarvestEvents();
+    Profiler::UnregisterTrack(track_);
+    Profiler::CountDropped(pending_events_.size());
+    pending_events_.clear();
+  }
+  if (queue_ != NULL) clReleaseCommandQueue(queue_);
+}
+
+void CommandQueue::CalibrateClock() {
+  // The marker completes right away on an empty queue, so its end time is
+  // close to the host time after waiting for it.
+  Event marker = EnqueueMarker();
+  if (!marker.Wait()) return;
+  double host_ns = timestamp_ms() * 1e6;
+  cl_ulong queued, submit, start, end;
+  if (!marker.GetProfile(&queued, &submit, &start, &end)) return;
+  clock_offset_ns_ = host_ns - end;
+}
+
+void CommandQueue::EnqueueEvent(cl_event e, const string& name, size_t bytes) {
+  if (!enable_profiling_) return;
+  bool full;
+  {
+    lock_guard<mutex> l(profile_lock_);
+    full = pending_events_.size() >= kMaxPendingEvents;
+  }
+  // Make room without blocking, only completed commands are harvested.
+  if (full) HarvestEvents();
+
+  lock_guard<mutex> l(profile_lock_);
+  while (pending_events_.size() >= kMaxPendingEvents) {
+    pending_events_.pop_front();
+    Profiler::CountDropped(1);
+  }
+  pending_events_.push_back(ProfileEvent(name == "" ? "Event" : name, Event(e), bytes));
+}
+
+void CommandQueue::HarvestEvents(void* queue) {
+  reinterpret_cast<CommandQueue*>(queue)->HarvestEvents();
+}
+
+void CommandQueue::HarvestEvents() {
+  lock_guard<mutex> l(profile_lock_);
+  // Commands on a queue complete in order so stop at the first one still
+  // running.
+  while (!pending_events_.empty() && pending_events_.front().event.IsComplete()) {
+    const ProfileEvent& pending = pending_events_.front();
     cl_ulong queued, submit, start, end;
-    err = clGetEventProfilingInfo(profiling_events_[i].e,
-        CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
-    err = clGetEventProfilingInfo(profiling_events_[i].e,
-        CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &submit, NULL);
-    err = clGetEventProfilingInfo(profiling_events_[i].e,
-        CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
-    err = clGetEventProfilingInfo(profiling_events_[i].e,
-        CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
-    if (queue_start == 0) queue_start = start;
-
-    ss << profiling_events_[i].name
-       << " (" << PrintNanos(start - queue_start) << ")" << endl
-       << "  Submit: " << PrintNanos(submit - queued) << endl
-       << "  Start: " << PrintNanos(start - submit) << endl
-       << "  End: " << PrintNanos(end - start) << endl;
+    if (pending.event.GetProfile(&queued, &submit, &start, &end)) {
+      Profiler::Span span;
+      span.name = pending.name;
+      span.track = track_;
+      span.queued_us = (queued + clock_offset_ns_) / 1000.;
+      span.submit_us = (submit + clock_offset_ns_) / 1000.;
+      span.start_us = (start + clock_offset_ns_) / 1000.;
+      span.end_us = (end + clock_offset_ns_) / 1000.;
+      span.bytes = pending.bytes;
+      Profiler::Record(span);
+    } else {
+      // The command failed.
+      Profiler::CountDropped(1);
+    }
+    pending_events_.pop_front();
+  }
+}
+
+void CommandQueue::SetEvent(cl_event e, const string& name, Event* event,
+    CommandMetrics* sampled, size_t bytes) {
+  if (e == NULL) return;
+  Metrics::Track(e, sampled, bytes);
+  if (event == NULL) {
+    if (enable_profiling_) {
+      EnqueueEvent(e, name, bytes);
+    } else {
+      clReleaseEvent(e);
+    }
+    return;
+  }
+  if (enable_profiling_) {
+    // Both the profile and the caller own a reference.
+    clRetainEvent(e);
+    EnqueueEvent(e, name, bytes);
+  }
+  *event = Event(e);
+}
+
+bool CommandQueue::EnqueueKernel(Kernel* kernel, size_t global_size,
+    int64_t local_size, const EventList& wait_for, Event* event,
+    const string& event_name) {
+  NDRange range(global_size);
+  if (local_size != -1) range.set_local(local_size);
+  return EnqueueKernel(kernel, range, wait_for, event, event_name);
+}
+
+bool CommandQueue::EnqueueKernel(Kernel* kernel, const NDRange& requested_range,
+    const EventList& wait_for, Event* event, const string& event_name) {
+  NDRange range = requested_range;
+  if (!range.has_local() && kernel->tuner_ != NULL) {
+    kernel->tuner_->Lookup(device_, kernel, &range);
+  }
+  string error;
+  if (!range.Validate(device_, kernel, &error)) {
+    fprintf(stderr, "Could not queue kernel %s: %s\n",
+        kernel->fn_name().c_str(), error.c_str());
+    return false;
+  }
+  CommandMetrics* sampled = Metrics::Sample(kernel->metrics_);
+  vector<cl_event> storage;
+  const cl_event* wait_list = Event::ToClEvents(wait_for, &storage);
+  cl_event e = NULL;
+  cl_int err = clEnqueueNDRangeKernel(queue_, kernel->kernel_, range.dims(),
+      range.offsets(), range.global_sizes(), range.local_sizes(),
+      storage.size(), wait_list, EventArg(event, sampled, &e));
+  if (err < 0) {
+    fprintf(stderr, "Could not queue kernel: %s\n", Error(err));
+    return false;
+  }
+  SetEvent(e, event_name == "" ? kernel->fn_name() : event_name, event,
+      sampled);
+  return true;
+}
+
+bool CommandQueue::EnqueueWait(const EventList& wait_for) {
+  vector<cl_event> storage;
+  const cl_event* wait_list = Event::ToClEvents(wait_for, &storage);
+  if (wait_list == NULL) return true;
+  cl_int err = clEnqueueBarrierWithWaitList(queue_, storage.size(), wait_list, NULL);
+  if (err < 0) {
+    fprintf(stderr, "Could not enqueue wait: %s\n", Error(err));
+    return false;
+  }
+  return true;
+}
+
+Event CommandQueue::EnqueueMarker() {
+  cl_event e;
+  cl_int err = clEnqueueMarkerWithWaitList(queue_, 0, NULL, &e);
+  if (err < 0) {
+    fprintf(stderr, "Could not enqueue marker: %s\n", Error(err));
+    return Event();
+  }
+  return Event(e);
+}
+
+string CommandQueue::GetEventsProfile() {
+  if (!enable_profiling_) return "";
+  const vector<Profiler::Span>& spans = Profiler::Spans(track_);
+  stringstream ss;
+  for (size_t i = 0; i < spans.size(); ++i) {
+    const Profiler::Span& span = spans[i];
+    ss << span.name
+       << " (" << PrintNanos((span.start_us - spans[0].start_us) * 1000) << ")" << endl
+       << "  Submit: " << PrintNanos((span.submit_us - span.queued_us) * 1000) << endl
+       << "  Start: " << PrintNanos((span.start_us - span.submit_us) * 1000) << endl
+       << "  End: " << PrintNanos((span.end_us - span.start_us) * 1000) << endl;
+    if (span.bytes > 0) ss << "  Bytes: " << PrintBytes(span.bytes) << endl;
   }
   return ss.str();
 }
@@ -1,15 +1,70 @@
 #ifndef NONG_CONTEXT_H
 #define NONG_CONTEXT_H
 
+#include "metrics.h"
 #include "platform.h"
+#include "program_cache.h"
 
+class BufferPool;
 class CommandQueue;
 class Context;
 class Program;
 class Kernel;
+class WorkGroupTuner;
 
 const char* Error(cl_int err);
 
+class Event;
+typedef std::vector<Event> EventList;
+
+// Handle to an enqueued command. Copies refer to the same command; the
+// underlying cl_event is released when the last copy is destroyed.
+class Event {
+ public:
+  // Called with CL_COMPLETE or the (negative) error the command failed with.
+  // This is called from a runtime thread.
+  typedef void (*Callback)(cl_int status, void* user_data);
+
+  Event() : event_(NULL) {}
+  Event(const Event& other);
+  Event& operator=(const Event& other);
+  ~Event();
+
+  // Blocks until the command is complete. Returns false if the command failed.
+  bool Wait() const;
+
+  // Returns true if the command is done, either successfully or not.
+  bool IsComplete() const;
+
+  // Calls fn(status, user_data) once the command is done.
+  bool OnComplete(Callback fn, void* user_data);
+
+  // Blocks until all events are complete.
+  static bool WaitAll(const EventList& events);
+
+  // Returns the device timestamps (in ns) of the command. Only available for
+  // commands on queues with profiling enabled, once they are complete.
+  bool GetProfile(cl_ulong* queued, cl_ulong* submit, cl_ulong* start,
+      cl_ulong* end) const;
+
+  // False for default constructed events and events from failed enqueues.
+  bool valid() const { return event_ != NULL; }
+
+ private:
+  friend class Buffer;
+  friend class CommandQueue;
+
+  // Takes ownership of e.
+  explicit Event(cl_event e) : event_(e) {}
+
+  // Returns the events as an array to pass to the opencl enqueue functions,
+  // using storage as the backing memory. Returns NULL if there are no events.
+  static const cl_event* ToClEvents(const EventList& events,
+      std::vector<cl_event>* storage);
+
+  cl_event event_;
+};
+
 class Buffer {
  public:
   enum AccessType {
@@ -24,16 +79,59 @@ class Buffer {
   bool CopyFrom(CommandQueue* queue, const void* src_buffer, size_t buffer_len);
   bool CopyTo(CommandQueue* queue, void* dst_buffer, size_t buffer_len);
 
+  // Versions of the above that start after all events in wait_for are
+  // complete. The events can come from any queue of the same context. If
+  // event is not NULL, it is set to the event of the transfer.
+  void* Read(CommandQueue* queue, const EventList& wait_for, Event* event = NULL);
+  bool CopyFrom(CommandQueue* queue, const void* src_buffer, size_t buffer_len,
+      const EventList& wait_for, Event* event = NULL);
+  bool CopyTo(CommandQueue* queue, void* dst_buffer, size_t buffer_len,
+      const EventList& wait_for, Event* event = NULL);
+
+  // Non-blocking versions of CopyTo/CopyFrom. The command starts after all
+  // events in wait_for are complete. The host memory must stay valid until the
+  // returned event is complete. Returns an invalid event on failure.
+  Event ReadAsync(CommandQueue* queue, void* dst_buffer, size_t buffer_len,
+      const EventList& wait_for = EventList());
+  Event WriteAsync(CommandQueue* queue, const void* src_buffer,
+      size_t buffer_len, const EventList& wait_for = EventList());
+
+  // Like CopyTo/CopyFrom but for [offset, offset + len) of the buffer.
+  bool CopyRegionTo(CommandQueue* queue, size_t offset, void* dst_buffer,
+      size_t len, const EventList& wait_for = EventList(), Event* event = NULL);
+  bool CopyRegionFrom(CommandQueue* queue, size_t offset, const void* src_buffer,
+      size_t len, const EventList& wait_for = EventList(), Event* event = NULL);
+
+  // Moves the buffer's memory to the device of queue ahead of the commands
+  // using it. If content_undefined is true, the content is not copied, which
+  // is useful to place a new buffer.
+  bool Migrate(CommandQueue* queue, bool content_undefined = false,
+      const EventList& wait_for = EventList(), Event* event = NULL);
+
+  // Maps [offset, offset + len) of the buffer into host memory and returns the
+  // host pointer. len == 0 maps to the end of the buffer. This blocks until the
+  // mapping is ready. For zero-copy buffers this does not copy any data.
+  // The region must be unmapped before the device uses the buffer again.
+  void* Map(CommandQueue* queue, AccessType access, size_t offset = 0,
+      size_t len = 0);
+  bool Unmap(CommandQueue* queue, void* mapped_ptr);
+
   static cl_mem_flags to_cl_flags(AccessType t);
+  static cl_map_flags to_cl_map_flags(AccessType t);
 
   bool can_read() const { return access_ == READ_ONLY || access_ == READ_WRITE; }
   bool can_write() const { return access_ == WRITE_ONLY || access_ == READ_WRITE; }
   size_t size() const { return size_; }
 
+  // True if the buffer shares memory with the host (see
+  // Context::CreateZeroCopyBuffer).
+  bool zero_copy() const { return zero_copy_; }
+
  private:
   Buffer(const Buffer&);
   Buffer& operator=(const Buffer&);
 
+  friend class BufferPool;
   friend class Context;
   friend class Kernel;
 
@@ -41,21 +139,129 @@ class Buffer {
 
   const cl_mem& cl_buffer() { return cl_buffer_; }
 
+  bool EnqueueRead(CommandQueue* queue, bool blocking, size_t offset,
+      void* dst_buffer, size_t buffer_len, const EventList& wait_for,
+      Event* event, const char* name);
+  bool EnqueueWrite(CommandQueue* queue, bool blocking, size_t offset,
+      const void* src_buffer, size_t buffer_len, const EventList& wait_for,
+      Event* event, const char* name);
+
   cl_mem cl_buffer_;
   void* host_ptr_;
   size_t size_;
   AccessType access_;
+  bool zero_copy_;
+  BufferPool* pool_; // Set if the buffer belongs to a pool.
+};
+
+// The work items of a kernel launch in 1 to 3 dimensions: the global size,
+// optionally the work group (local) size and optionally global offsets.
+class NDRange {
+ public:
+  explicit NDRange(size_t x);
+  NDRange(size_t x, size_t y);
+  NDRange(size_t x, size_t y, size_t z);
+
+  // Sets the work group size. Unused dimensions are ignored. By default the
+  // device picks the work group size.
+  NDRange& set_local(size_t x, size_t y = 1, size_t z = 1);
+
+  // Sets the global id of the first work item, e.g. to split a launch across
+  // devices. Unused dimensions are ignored.
+  NDRange& set_offset(size_t x, size_t y = 0, size_t z = 0);
+
+  // Removes the work group size so the device picks it.
+  NDRange& clear_local() { has_local_ = false; return *this; }
+
+  int dims() const { return dims_; }
+  size_t global(int dim) const { return global_[dim]; }
+  size_t local(int dim) const { return local_[dim]; }
+  size_t offset(int dim) const { return offset_[dim]; }
+  bool has_local() const { return has_local_; }
+  bool has_offset() const { return has_offset_; }
+
+  // Arrays to pass to clEnqueueNDRangeKernel.
+  const size_t* global_sizes() const { return global_; }
+  const size_t* local_sizes() const { return has_local_ ? local_ : NULL; }
+  const size_t* offsets() const { return has_offset_ ? offset_ : NULL; }
+
+  // Total number of work items.
+  size_t num_items() const { return global_[0] * global_[1] * global_[2]; }
+
+  // Total number of work items in a work group, 0 if not set.
+  size_t num_local_items() const {
+    return has_local_ ? local_[0] * local_[1] * local_[2] : 0;
+  }
+
+  // Checks the range against the limits of the device and kernel (kernel may
+  // be NULL). Returns false and sets error if it can't be launched.
+  bool Validate(const DeviceInfo* device, const Kernel* kernel,
+      std::string* error) const;
+
+  std::string ToString() const;
+
+ private:
+  void Init(int dims, size_t x, size_t y, size_t z);
+
+  int dims_;
+  size_t global_[3];
+  size_t local_[3];
+  size_t offset_[3];
+  bool has_local_;
+  bool has_offset_;
+};
+
+// The size of a __local argument, e.g. for Kernel::SetArgs().
+struct LocalMem {
+  explicit LocalMem(size_t bytes) : bytes(bytes) {}
+  size_t bytes;
 };
 
 class Kernel {
  public:
   ~Kernel();
   bool SetArg(int index, Buffer* buffer);
-  bool SetArg(int index, cl_uint v);
+  bool SetArg(int index, const LocalMem& local) {
+    return SetLocalArg(index, local.bytes);
+  }
+  // Sets a by-value argument of any type that is copied bytewise: scalars,
+  // vectors like cl_float4 or structs laid out like the kernel's, e.g. Plane
+  // in kernels/ao.cl. Device memory must be passed as a Buffer.
+  template<typename T> bool SetArg(int index, const T& value) {
+    static_assert(!std::is_pointer<T>::value, "pass device memory as a Buffer*");
+    static_assert(std::is_trivially_copy_constructible<T>::value &&
+        std::is_trivially_destructible<T>::value,
+        "kernel arguments are copied bytewise");
+    return SetRawArg(index, sizeof(T), &value);
+  }
   bool SetLocalArg(int index, size_t v);
+  // Sets an argument from size bytes at value.
+  bool SetRawArg(int index, size_t size, const void* value);
+
+  // Sets all arguments in order, e.g.
+  //   kernel->SetArgs(input, LocalMem(256 * sizeof(cl_float)), (cl_uint)n);
+  template<typename... Args> bool SetArgs(const Args&... args) {
+    return SetArgsFrom(0, args...);
+  }
+
+  // Sets all arguments and launches the kernel over range on queue.
+  template<typename... Args> bool operator()(CommandQueue* queue,
+      const NDRange& range, const Args&... args);
 
   const size_t max_work_group_size() const { return max_work_group_size_; }
 
+  // Work group sizes should be a multiple of this for best performance.
+  size_t preferred_work_group_multiple() const {
+    return preferred_work_group_multiple_;
+  }
+
+  // Local memory used by the kernel, not including local arguments.
+  cl_ulong local_mem_size() const { return local_mem_size_; }
+
+  // Calls to SetArg and friends that didn't reach the driver because the
+  // argument already had the value.
+  uint64_t skipped_args() const { return skipped_args_; }
+
   std::string ToString(bool detail = false) const;
   std::string fn_name() const { return fn_name_; }
 
@@ -65,14 +271,82 @@ class Kernel {
 
   friend class CommandQueue;
   friend class Context;
+  friend class LaunchBatch;
+  friend class WorkGroupTuner;
 
-  Kernel() {}
+  Kernel()
+    : program_(NULL), tuner_(NULL), metrics_(NULL), has_arg_info_(false),
+      skipped_args_(0) {}
+
+  bool SetArgsFrom(int) { return true; }
+  template<typename T, typename... Rest> bool SetArgsFrom(int index,
+      const T& first, const Rest&... rest) {
+    return SetArg(index, first) && SetArgsFrom(index + 1, rest...);
+  }
+
+  // Reads the arguments from the driver. Without arg info (before OpenCL
+  // 1.2, or some programs from binaries) only their number is checked.
+  bool LoadArgInfo();
+
+  // Forgets arguments set to buffer, which is being deleted, so a new buffer
+  // with the same handle isn't skipped.
+  void ForgetBuffer(const Buffer* buffer);
+
+  // Returns a key of the values of all arguments, equal for two kernels of
+  // the same function iff they launch with the same arguments.
+  std::string ArgsKey() const;
+
+  // Sets the arguments of this kernel, a clone of from, to those of from.
+  bool CopyArgs(const Kernel* from);
+
+  // Returns false if size bytes (a local size if local) don't fit the
+  // argument.
+  bool CheckArg(int index, size_t size, bool local) const;
 
   std::string fn_name_;
   cl_kernel kernel_;
+  // The file program this kernel holds a use of (see Context::Release), or
+  // NULL.
+  Program* program_;
 
   // The maximum number of work items in a work group when running this kernel.
   size_t max_work_group_size_;
+  size_t preferred_work_group_multiple_;
+  cl_ulong local_mem_size_;
+
+  // If set, launches that don't specify a work group size use the tuned one.
+  const WorkGroupTuner* tuner_;
+
+  // The tuner's result for a (dims, size bucket), see WorkGroupTuner::Lookup.
+  struct TunedLocal {
+    uint64_t generation;
+    bool found;
+    size_t local[3];
+    TunedLocal() : generation(0), found(false) {}
+  };
+  std::map<std::pair<int, int>, TunedLocal> tuned_;
+
+  // Shared by all kernels with the same function name.
+  CommandMetrics* metrics_;
+
+  struct Arg {
+    // From clGetKernelArgInfo, if available.
+    cl_kernel_arg_address_qualifier address;
+    std::string type_name;
+    // The size of a value of type_name, 0 if unknown (e.g. structs).
+    size_t size;
+
+    // The last value set, the bytes or for local arguments the size.
+    bool is_set;
+    bool local;
+    std::string value;
+
+    Arg() : address(CL_KERNEL_ARG_ADDRESS_PRIVATE), size(0), is_set(false),
+      local(false) {}
+  };
+  std::vector<Arg> args_;
+  bool has_arg_info_;
+  uint64_t skipped_args_;
 };
 
 class Program {
@@ -87,13 +361,22 @@ class Program {
     bool strict_aliasing;
     bool unsafe_math;
 
-    BuildOptions() {
-      memset(this, 0, sizeof(BuildOptions));
-      warnings_as_errors = true;
-      strict_aliasing = true;
+    // Preprocessor definitions (name -> value) added to the top of the source.
+    // Values may be any expression, e.g. defines["OP(a, b)"] = "((a) + (b))".
+    std::map<std::string, std::string> defines;
+
+    BuildOptions()
+      : warnings_as_errors(true),
+        disable_optimizations(false),
+        strict_aliasing(true),
+        unsafe_math(false) {
     }
 
+    // Returns the compiler flags.
     std::string ToString() const;
+
+    // Returns the #define lines for defines.
+    std::string Preamble() const;
   };
 
  private:
@@ -101,32 +384,59 @@ class Program {
   Program& operator=(const Program&);
 
   friend class Context;
-  Program(cl_program p) : program_(p) { }
+  Program(cl_program p) : program_(p), users_(0) { }
   cl_program program() const { return program_; }
   cl_program program_;
+  // Uses of a program from a file that were not released yet. Access must
+  // hold Context::programs_lock_.
+  int users_;
 };
 
 class CommandQueue {
  public:
-  ~CommandQueue() {
-    if (queue_ != NULL) clReleaseCommandQueue(queue_);
-  }
+  ~CommandQueue();
 
   // local_size can be set to -1 if the device should decide.
   bool EnqueueKernel(Kernel* kernel, size_t global_size, int64_t local_size,
       const std::string& event_name = "") {
-    cl_event event;
-    cl_int err = clEnqueueNDRangeKernel(queue_, kernel->kernel_,
-        1, NULL, &global_size, local_size == -1 ? NULL : (size_t*)&local_size,
-        0, NULL, enable_profiling_ ? &event : NULL);
+    return EnqueueKernel(kernel, global_size, local_size, EventList(), NULL,
+        event_name);
+  }
+
+  // Same as above but the kernel starts after all events in wait_for are
+  // complete. The events can come from any queue of the same context. If event
+  // is not NULL, it is set to the event of the kernel.
+  bool EnqueueKernel(Kernel* kernel, size_t global_size, int64_t local_size,
+      const EventList& wait_for, Event* event = NULL,
+      const std::string& event_name = "");
+
+  // Launches kernel over a 1 to 3 dimensional range. The range is validated
+  // against the device and kernel limits first.
+  bool EnqueueKernel(Kernel* kernel, const NDRange& range,
+      const EventList& wait_for = EventList(), Event* event = NULL,
+      const std::string& event_name = "");
+
+  // Commands enqueued after this one start after all events in wait_for are
+  // complete. This is how work on one queue waits for work on another queue
+  // without stalling the host.
+  bool EnqueueWait(const EventList& wait_for);
+
+  // Returns an event that completes once all commands enqueued so far on this
+  // queue are complete. Returns an invalid event on failure.
+  Event EnqueueMarker();
+
+  // Submits all enqueued commands to the device without waiting for them.
+  // A queue must be submitted before other queues can wait on its events.
+  bool Submit() {
+    cl_int err = clFlush(queue_);
     if (err < 0) {
-      fprintf(stderr, "Could not queue kernel: %s\n", Error(err));
+      fprintf(stderr, "Could not submit queue: %s\n", Error(err));
       return false;
     }
-    EnqueueEvent(event, event_name == "" ? kernel->fn_name() : event_name);
     return true;
   }
 
+  // Blocks until all enqueued commands are complete.
   bool Flush() {
     cl_int err = clFinish(queue_);
     if (err < 0) {
@@ -136,7 +446,9 @@ class CommandQueue {
     return true;
   }
 
-  std::string GetEventsProfile() const;
+  // Returns the profile of the completed commands still kept by the
+  // Profiler. See profiler.h for the trace export.
+  std::string GetEventsProfile();
 
  private:
   CommandQueue(const CommandQueue&);
@@ -144,35 +456,89 @@ class CommandQueue {
 
   friend class Buffer;
   friend class Context;
+  friend class LaunchBatch;
 
   cl_command_queue queue() { return queue_; }
 
-  CommandQueue(cl_command_queue queue, bool enable_profiling)
-    : queue_(queue), enable_profiling_(enable_profiling) {}
+  CommandQueue(cl_command_queue queue, const DeviceInfo* device,
+      bool enable_profiling);
 
   cl_command_queue queue_;
+  const DeviceInfo* device_; // unowned
   const bool enable_profiling_;
 
-  // Only used if profiling is enabled.
+  // Only used if profiling is enabled. Commands are kept until they are
+  // complete and then moved into the Profiler, which releases their events.
+  // At most kMaxPendingEvents are kept, beyond that the oldest are dropped.
+  static const size_t kMaxPendingEvents = 4096;
   struct ProfileEvent {
     std::string name;
-    cl_event e;
-    ProfileEvent(const std::string& n, cl_event e) : name(n), e(e) {}
-    ProfileEvent() {}
+    Event event;
+    size_t bytes;
+    ProfileEvent(const std::string& n, const Event& e, size_t b)
+      : name(n), event(e), bytes(b) {}
   };
-  std::vector<ProfileEvent> profiling_events_;
+  std::mutex profile_lock_;
+  std::deque<ProfileEvent> pending_events_;
+  int track_;
+  // Added to device timestamps to get host timestamps (in ns).
+  double clock_offset_ns_;
+
+  // Measures clock_offset_ns_ with a marker on the (empty) queue.
+  void CalibrateClock();
+  void EnqueueEvent(cl_event e, const std::string& name, size_t bytes);
+  void HarvestEvents();
+  static void HarvestEvents(void* queue);
+
+  // Returns the event argument to pass to an enqueue: e if either the caller
+  // (event != NULL), the profiler or the metrics (sampled, from
+  // Metrics::Sample()) need the event, NULL otherwise. e must be initialized
+  // to NULL.
+  cl_event* EventArg(Event* event, CommandMetrics* sampled, cl_event* e) const {
+    return (enable_profiling_ || event != NULL || sampled != NULL) ? e : NULL;
+  }
 
-  void EnqueueEvent(cl_event e, const std::string& name);
+  // Hands off e, which was returned through EventArg(event, sampled, &e), to
+  // the metrics, the profiler and event. bytes is the amount of data copied by
+  // the command, if any.
+  void SetEvent(cl_event e, const std::string& name, Event* event,
+      CommandMetrics* sampled, size_t bytes = 0);
 };
 
+template<typename... Args> bool Kernel::operator()(CommandQueue* queue,
+    const NDRange& range, const Args&... args) {
+  return SetArgs(args...) && queue->EnqueueKernel(this, range);
+}
+
 class Context {
  public:
   // Creates the context object. The context is the root of all the other created
-  // objects. This is the *only* object that needs to be deleted. All objects
-  // created off of this have lifetime equal to the context.
+  // objects. By default, objects created off of this have lifetime equal to
+  // the context and are deleted with it. Long running code should instead
+  // free objects as soon as they are not needed with Release(), either
+  // directly or through Ref<> handles (see ref.h).
   static Context* Create(const DeviceInfo* device, bool enable_profiling = false);
   ~Context();
 
+  // Frees an object created by this context. Commands already enqueued that
+  // use the object are not affected. Buffers from the buffer pool are returned
+  // to the pool. The default queue can't be released. Programs from files
+  // (CreateProgramFromFile) are shared: every call that returns one, and
+  // every kernel CreateKernel loads from a file, is a use of it, and the
+  // program is freed once all uses are released.
+  void Release(Buffer* buffer);
+  void Release(Kernel* kernel);
+  void Release(Program* program);
+  void Release(CommandQueue* queue);
+
+  // Cleared when the context is deleted, so handles that may outlive it (see
+  // Ref) know its objects are gone.
+  std::shared_ptr<const std::atomic<bool> > alive() const { return alive_; }
+
+  // Returns a description of the objects that have not been released yet.
+  // These are deleted with the context.
+  std::string LeakReport() const;
+
   const DeviceInfo* device() const { return device_; }
 
   // Returns the default CommandQueue.
@@ -180,42 +546,137 @@ class Context {
 
   // Creates additional command queues.
   CommandQueue* CreateCommandQueue();
+  // Same as above but profiling is enabled independent of the context setting.
+  CommandQueue* CreateCommandQueue(bool enable_profiling);
+
+  // Kernels of this context that are launched without a work group size use
+  // the size tuned by tuner, if there is one. tuner is unowned and may be NULL.
+  void SetWorkGroupTuner(const WorkGroupTuner* tuner);
 
   // Loads a kernel from src_file with fn_name.
   Kernel* CreateKernel(const char* src_file, const char* fn_name,
       const Program::BuildOptions& = Program::BuildOptions());
   Kernel* CreateKernel(Program* program, const char* fn_name);
 
-  // Creates a program file from a file or in memory .cl code.
+  // Returns a new kernel for the same function as kernel, with its own
+  // arguments, so both can be set and launched independently.
+  Kernel* CloneKernel(const Kernel* kernel);
+
+  // Creates a program file from a file or in memory .cl code. Programs from
+  // files are cached by path and build options, so loading the same file with
+  // the same options returns the same program while it is in use.
   Program* CreateProgramFromFile(const char* path,
       const Program::BuildOptions& = Program::BuildOptions());
+
+  // Starts building the program in path and returns without waiting for the
+  // compiler. The future holds the program, or NULL if it failed to build.
+  // Use this to compile many programs concurrently. The programs are cached
+  // the same way as CreateProgramFromFile.
+  std::shared_future<Program*> CreateProgramAsync(const char* path,
+      const Program::BuildOptions& = Program::BuildOptions());
   Program* CreateProgramFromSrc(const char* source, size_t size,
     const Program::BuildOptions& = Program::BuildOptions(),
     const char* filename = NULL);
 
+  // Creates a device buffer like CreateBuffer() and places its memory on the
+  // device right away, instead of wherever it is first touched. On cpu
+  // sub-devices (see Platform::CreateSubDevicesByNuma()) this allocates the
+  // memory on the NUMA node of the sub-device. The content is undefined.
+  Buffer* CreateLocalBuffer(const Buffer::AccessType& access, size_t size);
+
   // Creates buffers shared between the host and opencl
   Buffer* CreateBufferFromMem(const Buffer::AccessType& access,
       void* buffer, size_t size);
 
+  // Creates a device buffer of size bytes without any host memory.
+  Buffer* CreateBuffer(const Buffer::AccessType& access, size_t size);
+
+  // Creates a buffer that shares its memory with the host instead of copying
+  // it. If buffer is NULL, the runtime allocates host accessible memory,
+  // otherwise buffer is used directly as the backing store and should come
+  // from AllocateHostMem(). On cpu and integrated gpu devices, reads and writes
+  // through Buffer::Map() do not copy.
+  Buffer* CreateZeroCopyBuffer(const Buffer::AccessType& access,
+      void* buffer, size_t size);
+
+  // Returns the pool for buffers that are allocated and released frequently.
+  // See BufferPool.
+  BufferPool* buffer_pool() { return buffer_pool_; }
+
+  // Allocates host memory aligned for zero-copy use with this device (see
+  // DeviceInfo::ptr_alignment). The allocation is rounded up to a cache line.
+  // Must be freed with FreeAligned().
+  void* AllocateHostMem(size_t size) const;
+
+  // Caches program binaries in dir so that later processes can skip building
+  // programs from source. Applies to programs created after this call.
+  void EnableProgramCache(const std::string& dir);
+
+  // Returns NULL if the program cache is not enabled.
+  const ProgramCache* program_cache() const { return program_cache_; }
+
   // Returns the error code from the last call.
   cl_int error() const { return err_; }
 
  private:
+  friend class BufferPool;
+
   Context(const DeviceInfo* device, bool enable_profiling);
   Context(const Context&);
   Context& operator=(const Context&);
 
+  // Clears buffer from the cached arguments of all kernels, before it is
+  // freed and its cl_mem can be reused.
+  void ForgetBuffer(const Buffer* buffer);
+
+  // Returns the compiler flags of options for this device, which add argument
+  // info on OpenCL 1.2 devices so kernels can check their arguments.
+  std::string BuildFlags(const Program::BuildOptions& options) const;
+
+  Kernel* CreateKernel(cl_program program, const std::string& fn_name);
+
+  // Builds the program without tracking it.
+  Program* BuildProgram(const char* source, size_t size,
+    const Program::BuildOptions& options, const char* filename);
+
   std::string GetBuildError(cl_program program);
+  void PrintBuildError(cl_program program, cl_int err, const char* filename);
+
+  // State for a program being built by CreateProgramAsync.
+  struct PendingBuild;
+  static void CL_CALLBACK OnBuildComplete(cl_program program, void* data);
+  void FinishBuild(PendingBuild* build, cl_program program);
+
+  // Creates and builds the program from the cached binary for key. Returns
+  // NULL if there is no usable binary.
+  cl_program LoadCachedProgram(const std::string& key, const std::string& build_str);
+  void StoreCachedProgram(const std::string& key, cl_program program);
 
   const DeviceInfo* device_; // unowned
   const bool enable_profiling_;
   cl_context ctx_;
   cl_int err_; // Last error.
-
+  ProgramCache* program_cache_; // NULL if not enabled.
+  const WorkGroupTuner* tuner_; // unowned
+  BufferPool* buffer_pool_;
+  std::shared_ptr<std::atomic<bool> > alive_;
+
+  // Programs from files, keyed by ProgramKey(), and programs from source.
+  // Access must hold programs_lock_ since async builds finish on runtime
+  // threads.
+  mutable std::mutex programs_lock_;
   std::map<std::string, Program*> programs_;
-  std::vector<Kernel*> kernels_;
+  // Async builds in progress, registered in the same critical section as the
+  // lookups so each key is only built once.
+  std::map<std::string, std::shared_ptr<PendingBuild> > pending_programs_;
+  std::set<Program*> src_programs_;
+
+  // Live objects, removed by Release(). kernels_ is also walked when pool
+  // buffers are freed, so access must hold kernels_lock_.
+  mutable std::mutex kernels_lock_;
+  std::set<Kernel*> kernels_;
   std::vector<CommandQueue*> command_queues_;
-  std::vector<Buffer*> buffers_;
+  std::set<Buffer*> buffers_;
 };
 
 #endif
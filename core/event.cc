@@ -0,0 +1,112 @@
+#include "context.h"
+
+using namespace std;
+
+Event::Event(const Event& other) : event_(other.event_) {
+  if (event_ != NULL) clRetainEvent(event_);
+}
+
+Event& Event::operator=(const Event& other) {
+  if (other.event_ != NULL) clRetainEvent(other.event_);
+  if (event_ != NULL) clReleaseEvent(event_);
+  event_ = other.event_;
+  return *this;
+}
+
+Event::~Event() {
+  if (event_ != NULL) clReleaseEvent(event_);
+}
+
+bool Event::Wait() const {
+  if (event_ == NULL) return false;
+  cl_int err = clWaitForEvents(1, &event_);
+  if (err < 0) {
+    fprintf(stderr, "Could not wait for event: %s\n", Error(err));
+    return false;
+  }
+  return true;
+}
+
+bool Event::IsComplete() const {
+  if (event_ == NULL) return true;
+  cl_int status;
+  cl_int err = clGetEventInfo(event_, CL_EVENT_COMMAND_EXECUTION_STATUS,
+      sizeof(status), &status, NULL);
+  if (err < 0) {
+    fprintf(stderr, "Could not get event status: %s\n", Error(err));
+    return true;
+  }
+  // Errors are reported as negative status.
+  return status <= CL_COMPLETE;
+}
+
+namespace {
+
+struct CallbackData {
+  Event::Callback fn;
+  void* user_data;
+};
+
+void CL_CALLBACK OnEventComplete(cl_event, cl_int status, void* data) {
+  CallbackData* cb = reinterpret_cast<CallbackData*>(data);
+  cb->fn(status, cb->user_data);
+  delete cb;
+}
+
+}
+
+bool Event::OnComplete(Callback fn, void* user_data) {
+  if (event_ == NULL) return false;
+  CallbackData* cb = new CallbackData();
+  cb->fn = fn;
+  cb->user_data = user_data;
+  cl_int err = clSetEventCallback(event_, CL_COMPLETE, OnEventComplete, cb);
+  if (err < 0) {
+    fprintf(stderr, "Could not set event callback: %s\n", Error(err));
+    delete cb;
+    return false;
+  }
+  return true;
+}
+
+bool Event::WaitAll(const EventList& events) {
+  vector<cl_event> storage;
+  const cl_event* cl_events = ToClEvents(events, &storage);
+  if (cl_events == NULL) return true;
+  cl_int err = clWaitForEvents(storage.size(), cl_events);
+  if (err < 0) {
+    fprintf(stderr, "Could not wait for events: %s\n", Error(err));
+    return false;
+  }
+  return true;
+}
+
+bool Event::GetProfile(cl_ulong* queued, cl_ulong* submit, cl_ulong* start,
+    cl_ulong* end) const {
+  if (event_ == NULL) return false;
+  const cl_profiling_info params[] = {
+    CL_PROFILING_COMMAND_QUEUED,
+    CL_PROFILING_COMMAND_SUBMIT,
+    CL_PROFILING_COMMAND_START,
+    CL_PROFILING_COMMAND_END,
+  };
+  cl_ulong* values[] = { queued, submit, start, end };
+  for (int i = 0; i < 4; ++i) {
+    cl_int err = clGetEventProfilingInfo(
+        event_, params[i], sizeof(cl_ulong), values[i], NULL);
+    if (err < 0) {
+      fprintf(stderr, "Could not get event profile: %s\n", Error(err));
+      return false;
+    }
+  }
+  return true;
+}
+
+const cl_event* Event::ToClEvents(const EventList& events,
+    vector<cl_event>* storage) {
+  storage->clear();
+  for (size_t i = 0; i < events.size(); ++i) {
+    if (events[i].event_ != NULL) storage->push_back(events[i].event_);
+  }
+  return storage->empty() ? NULL : &(*storage)[0];
+}
@@ -0,0 +1,115 @@
+#include "fused_map.h"
+
+using namespace std;
+
+MapChain& MapChain::Then(const string& expr, Buffer* y) {
+  Stage stage;
+  stage.expr = expr;
+  stage.has_buffer = y != NULL;
+  stages_.push_back(stage);
+  if (y != NULL) buffers_.push_back(y);
+  return *this;
+}
+
+string MapChain::Source(int width) const {
+  const string type = width == 1 ? "float" : "float" + to_string(width);
+  const string vload = "vload" + to_string(width);
+  const string vstore = "vstore" + to_string(width);
+  stringstream ss;
+  ss << "__kernel void fused_map(__global const float* input, "
+     << "__global float* output";
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    ss << ", __global const float* y" << i;
+  }
+  ss << ", ulong n) {" << endl
+     << "  const ulong i = get_global_id(0) * " << width << ";" << endl;
+
+  // The vector path for whole vectors, then the scalar path for the rest.
+  if (width > 1) {
+    ss << "  if (i + " << width << " <= n) {" << endl
+       << "    " << type << " x = " << vload << "(0, input + i);" << endl;
+    for (size_t s = 0, b = 0; s < stages_.size(); ++s) {
+      if (stages_[s].has_buffer) {
+        ss << "    { const " << type << " y = " << vload << "(0, y" << b++
+           << " + i); x = (" << stages_[s].expr << "); }" << endl;
+      } else {
+        ss << "    x = (" << stages_[s].expr << ");" << endl;
+      }
+    }
+    ss << "    " << vstore << "(x, 0, output + i);" << endl
+       << "    return;" << endl
+       << "  }" << endl;
+  }
+  ss << "  for (ulong j = i; j < min(i + " << width << ", n); ++j) {" << endl
+     << "    float x = input[j];" << endl;
+  for (size_t s = 0, b = 0; s < stages_.size(); ++s) {
+    if (stages_[s].has_buffer) {
+      ss << "    { const float y = y" << b++ << "[j]; x = ("
+         << stages_[s].expr << "); }" << endl;
+    } else {
+      ss << "    x = (" << stages_[s].expr << ");" << endl;
+    }
+  }
+  ss << "    output[j] = x;" << endl
+     << "  }" << endl
+     << "}" << endl;
+  return ss.str();
+}
+
+FusedMap::FusedMap(Context* ctx) : ctx_(ctx) {
+  const cl_uint preferred = ctx->device()->preferred_float_width;
+  width_ = preferred >= 8 ? 8 : preferred >= 4 ? 4 : 1;
+}
+
+FusedMap::~FusedMap() {
+  for (map<string, pair<Program*, Kernel*> >::iterator it = kernels_.begin();
+      it != kernels_.end(); ++it) {
+    ctx_->Release(it->second.second);
+    ctx_->Release(it->second.first);
+  }
+}
+
+Kernel* FusedMap::GetKernel(const MapChain& chain) {
+  const string source = chain.Source(width_);
+  map<string, pair<Program*, Kernel*> >::iterator it = kernels_.find(source);
+  if (it != kernels_.end()) return it->second.second;
+
+  Program* program = ctx_->CreateProgramFromSrc(source.c_str(), source.size(),
+      Program::BuildOptions(), "fused_map");
+  if (program == NULL) return NULL;
+  Kernel* kernel = ctx_->CreateKernel(program, "fused_map");
+  if (kernel == NULL) {
+    ctx_->Release(program);
+    return NULL;
+  }
+  kernels_[source] = make_pair(program, kernel);
+  return kernel;
+}
+
+bool FusedMap::Run(const MapChain& chain, Buffer* input, Buffer* output,
+    size_t n, CommandQueue* queue) {
+  if (queue == NULL) queue = ctx_->default_queue();
+  const size_t bytes = n * sizeof(cl_float);
+  bool fits = input->size() >= bytes && output->size() >= bytes;
+  for (size_t i = 0; i < chain.buffers().size(); ++i) {
+    fits &= chain.buffers()[i]->size() >= bytes;
+  }
+  if (!fits) {
+    fprintf(stderr, "Could not run fused map: %lu values don't fit the buffers\n",
+        (unsigned long)n);
+    return false;
+  }
+  if (n == 0) return true;
+
+  Kernel* kernel = GetKernel(chain);
+  if (kernel == NULL) return false;
+  int arg = 0;
+  bool ok = kernel->SetArg(arg++, input) && kernel->SetArg(arg++, output);
+  for (size_t i = 0; i < chain.buffers().size(); ++i) {
+    ok = ok && kernel->SetArg(arg++, chain.buffers()[i]);
+  }
+  const cl_ulong count = n;
+  return ok && kernel->SetArg(arg, count) &&
+      queue->EnqueueKernel(kernel, NDRange((n + width_ - 1) / width_),
+          EventList(), NULL, "FusedMap");
+}
@@ -0,0 +1,73 @@
+#ifndef NONG_FUSED_MAP_H
+#define NONG_FUSED_MAP_H
+
+#include "context.h"
+
+// A chain of elementwise float ops, each an OpenCL expression of x, the
+// value so far, e.g.
+//
+//   MapChain chain;
+//   chain.Then("fabs(x)").Then("sin(x)").Then("x * y", weights);
+//
+// Stages with a buffer also see y, the element of that buffer at the same
+// index. Expressions are compiled for scalars and vectors alike, so they must
+// use builtins that work on both (fmax, select, ...) instead of ?: or ifs.
+class MapChain {
+ public:
+  MapChain& Then(const std::string& expr) { return Then(expr, NULL); }
+  MapChain& Then(const std::string& expr, Buffer* y);
+
+  // Returns the source of a kernel "fused_map" for the whole chain that works
+  // on width floats (1, 2, 4, 8 or 16) per work item. Its arguments are the
+  // input, the output, the buffers of the stages in order and the number of
+  // values as a ulong.
+  std::string Source(int width) const;
+
+  size_t num_stages() const { return stages_.size(); }
+  const std::vector<Buffer*>& buffers() const { return buffers_; }
+
+ private:
+  struct Stage {
+    std::string expr;
+    bool has_buffer;
+  };
+  std::vector<Stage> stages_;
+  std::vector<Buffer*> buffers_;
+};
+
+// Runs MapChains as one kernel each, so a chain of N stages reads the input
+// and writes the output once instead of N times. The kernel of a chain is
+// generated and built on first use and cached by its source, so chains with
+// the same expressions share it whatever their buffers. Values
+// are processed as floats of the device's preferred vector width (see
+// DeviceInfo::preferred_float_width), 8, 4 or 1.
+class FusedMap {
+ public:
+  // The object uses kernels of ctx and must be deleted before it.
+  explicit FusedMap(Context* ctx);
+  ~FusedMap();
+
+  // Enqueues chain over input[0, n) into output[0, n), which may be input.
+  // Returns without waiting.
+  bool Run(const MapChain& chain, Buffer* input, Buffer* output, size_t n,
+      CommandQueue* queue = NULL);
+
+  int width() const { return width_; }
+
+  // Programs built, one per distinct chain.
+  size_t num_programs() const { return kernels_.size(); }
+
+ private:
+  FusedMap(const FusedMap&);
+  FusedMap& operator=(const FusedMap&);
+
+  // Returns the kernel for chain, building it if needed. NULL on failure.
+  Kernel* GetKernel(const MapChain& chain);
+
+  Context* ctx_; // unowned
+  int width_;
+  // Keyed by the whole source, a hash could map two chains to one kernel.
+  std::map<std::string, std::pair<Program*, Kernel*> > kernels_;
+};
+
+#endif
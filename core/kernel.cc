@@ -10,34 +10,147 @@ string Kernel::ToString(bool detail) const {
   stringstream ss;
   ss << "Kernel '" << fn_name_ << "'" << endl;
   if (detail) {
-     ss << "  MaxWorkGroupSize: " << max_work_group_size_ << endl;
+     ss << "  MaxWorkGroupSize: " << max_work_group_size_ << endl
+        << "  PreferredWorkGroupMultiple: " << preferred_work_group_multiple_ << endl
+        << "  LocalMem: " << local_mem_size_ << endl;
   }
   return ss.str();
 }
 
-bool Kernel::SetArg(int index, Buffer* buffer) {
-  cl_int err = clSetKernelArg(kernel_, index, sizeof(cl_mem), &buffer->cl_buffer());
+// Returns the size of a scalar or vector type like "float4", 0 for other
+// types.
+static size_t TypeSize(const string& name) {
+  static const struct {
+    const char* name;
+    size_t size;
+  } kScalars[] = {
+    {"char", 1}, {"uchar", 1}, {"short", 2}, {"ushort", 2}, {"half", 2},
+    {"int", 4}, {"uint", 4}, {"float", 4},
+    {"long", 8}, {"ulong", 8}, {"double", 8},
+  };
+  const size_t digits = name.find_first_of("0123456789");
+  const string base = name.substr(0, digits);
+  size_t width = digits == string::npos ? 1 : atoi(name.c_str() + digits);
+  // 3 component vectors take the space of 4.
+  if (width == 3) width = 4;
+  for (size_t i = 0; i < sizeof(kScalars) / sizeof(kScalars[0]); ++i) {
+    if (base == kScalars[i].name) return kScalars[i].size * width;
+  }
+  return 0;
+}
+
+bool Kernel::LoadArgInfo() {
+  cl_uint num_args;
+  cl_int err = clGetKernelInfo(kernel_, CL_KERNEL_NUM_ARGS, sizeof(num_args),
+      &num_args, NULL);
   if (err < 0) {
-    fprintf(stderr, "Could not set kernel argument: %s\n", Error(err));
+    fprintf(stderr, "Could not get kernel info: %s\n", Error(err));
     return false;
   }
+  args_.resize(num_args);
+  has_arg_info_ = true;
+  for (cl_uint i = 0; i < num_args && has_arg_info_; ++i) {
+    Arg& arg = args_[i];
+    char type_name[256];
+    has_arg_info_ =
+        clGetKernelArgInfo(kernel_, i, CL_KERNEL_ARG_ADDRESS_QUALIFIER,
+            sizeof(arg.address), &arg.address, NULL) == CL_SUCCESS &&
+        clGetKernelArgInfo(kernel_, i, CL_KERNEL_ARG_TYPE_NAME,
+            sizeof(type_name), type_name, NULL) == CL_SUCCESS;
+    if (has_arg_info_) {
+      arg.type_name = type_name;
+      arg.size = TypeSize(arg.type_name);
+    }
+  }
   return true;
 }
 
-bool Kernel::SetArg(int index, cl_uint v) {
-  cl_int err = clSetKernelArg(kernel_, index, sizeof(v), &v);
-  if (err < 0) {
-    fprintf(stderr, "Could not set kernel argument: %s\n", Error(err));
+bool Kernel::CheckArg(int index, size_t size, bool local) const {
+  if (index < 0 || (size_t)index >= args_.size()) {
+    fprintf(stderr, "Could not set argument %d of kernel %s: it has %lu\n",
+        index, fn_name_.c_str(), (unsigned long)args_.size());
+    return false;
+  }
+  if (!has_arg_info_) return true;
+  const Arg& arg = args_[index];
+  const char* error = NULL;
+  if (arg.address == CL_KERNEL_ARG_ADDRESS_LOCAL) {
+    if (!local) error = "__local arguments take a size, see LocalMem";
+  } else if (arg.address != CL_KERNEL_ARG_ADDRESS_PRIVATE) {
+    if (size != sizeof(cl_mem)) error = "pointers must be passed as a Buffer";
+  } else if (local) {
+    error = "only __local arguments take a size";
+  } else if (arg.size != 0 && size != arg.size) {
+    error = "the size doesn't match the type";
+  }
+  if (error != NULL) {
+    fprintf(stderr, "Could not set argument %d (%s) of kernel %s to %lu bytes: %s\n",
+        index, arg.type_name.c_str(), fn_name_.c_str(), (unsigned long)size,
+        error);
     return false;
   }
   return true;
 }
 
-bool Kernel::SetLocalArg(int index, size_t v) {
-  cl_int err = clSetKernelArg(kernel_, index, v, NULL);
+bool Kernel::SetArg(int index, Buffer* buffer) {
+  return SetRawArg(index, sizeof(cl_mem), &buffer->cl_buffer());
+}
+
+bool Kernel::SetRawArg(int index, size_t size, const void* value) {
+  const bool local = value == NULL;
+  if (!CheckArg(index, size, local)) return false;
+  // Local arguments are set again only if their size changes.
+  string bytes = local ? string((const char*)&size, sizeof(size)) :
+      string((const char*)value, size);
+  Arg& arg = args_[index];
+  if (arg.is_set && arg.local == local && arg.value == bytes) {
+    ++skipped_args_;
+    return true;
+  }
+  cl_int err = clSetKernelArg(kernel_, index, size, value);
   if (err < 0) {
     fprintf(stderr, "Could not set kernel argument: %s\n", Error(err));
+    arg.is_set = false;
     return false;
   }
+  arg.is_set = true;
+  arg.local = local;
+  arg.value.swap(bytes);
+  return true;
+}
+
+bool Kernel::SetLocalArg(int index, size_t v) {
+  return SetRawArg(index, v, NULL);
+}
+
+void Kernel::ForgetBuffer(const Buffer* buffer) {
+  const string bytes((const char*)&buffer->cl_buffer_, sizeof(cl_mem));
+  for (size_t i = 0; i < args_.size(); ++i) {
+    if (args_[i].is_set && !args_[i].local && args_[i].value == bytes) {
+      args_[i].is_set = false;
+    }
+  }
+}
+
+string Kernel::ArgsKey() const {
+  string key;
+  for (size_t i = 0; i < args_.size(); ++i) {
+    const Arg& arg = args_[i];
+    key += !arg.is_set ? '-' : arg.local ? 'l' : 'v';
+    if (arg.is_set) key += arg.value;
+  }
+  return key;
+}
+
+bool Kernel::CopyArgs(const Kernel* from) {
+  for (size_t i = 0; i < from->args_.size(); ++i) {
+    const Arg& arg = from->args_[i];
+    if (!arg.is_set) continue;
+    size_t local_size;
+    if (arg.local) memcpy(&local_size, arg.value.data(), sizeof(local_size));
+    const bool ok = arg.local ? SetRawArg(i, local_size, NULL) :
+        SetRawArg(i, arg.value.size(), arg.value.data());
+    if (!ok) return false;
+  }
   return true;
 }
@@ -0,0 +1,58 @@
+#include "launch_batch.h"
+
+#include "work_group_tuner.h"
+
+using namespace std;
+
+LaunchBatch::~LaunchBatch() {
+  for (map<pair<const Kernel*, string>, Kernel*>::iterator it = clones_.begin();
+      it != clones_.end(); ++it) {
+    ctx_->Release(it->second);
+  }
+}
+
+bool LaunchBatch::Record(Kernel* kernel, const NDRange& requested_range) {
+  NDRange range = requested_range;
+  if (!range.has_local() && kernel->tuner_ != NULL) {
+    kernel->tuner_->Lookup(ctx_->device(), kernel, &range);
+  }
+  string error;
+  if (!range.Validate(ctx_->device(), kernel, &error)) {
+    fprintf(stderr, "Could not record kernel %s: %s\n",
+        kernel->fn_name().c_str(), error.c_str());
+    return false;
+  }
+
+  const pair<const Kernel*, string> key(kernel, kernel->ArgsKey());
+  map<pair<const Kernel*, string>, Kernel*>::iterator it = clones_.find(key);
+  if (it == clones_.end()) {
+    Kernel* clone = ctx_->CloneKernel(kernel);
+    if (clone == NULL) return false;
+    it = clones_.insert(make_pair(key, clone)).first;
+  }
+  // Sets nothing unless a buffer of the clone was released in between.
+  if (!it->second->CopyArgs(kernel)) return false;
+  launches_.push_back(Launch(it->second, range));
+  return true;
+}
+
+bool LaunchBatch::Submit(CommandQueue* queue, Event* event,
+    const string& event_name) {
+  if (queue == NULL) queue = ctx_->default_queue();
+  for (size_t i = 0; i < launches_.size(); ++i) {
+    const Launch& launch = launches_[i];
+    const bool last = i + 1 == launches_.size();
+    cl_event e = NULL;
+    cl_int err = clEnqueueNDRangeKernel(queue->queue_, launch.kernel->kernel_,
+        launch.range.dims(), launch.range.offsets(),
+        launch.range.global_sizes(), launch.range.local_sizes(), 0, NULL,
+        last ? queue->EventArg(event, NULL, &e) : NULL);
+    if (err < 0) {
+      fprintf(stderr, "Could not queue kernel %s: %s\n",
+          launch.kernel->fn_name().c_str(), Error(err));
+      return false;
+    }
+    if (last) queue->SetEvent(e, event_name, event, NULL);
+  }
+  return queue->Submit();
+}
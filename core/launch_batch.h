@@ -0,0 +1,68 @@
+#ifndef NONG_LAUNCH_BATCH_H
+#define NONG_LAUNCH_BATCH_H
+
+#include "context.h"
+
+// Records a sequence of kernel launches and enqueues them with as little host
+// work per launch as possible, e.g. the passes of a sort:
+//
+//   LaunchBatch batch(ctx);
+//   for (...) batch.Add(kernel, NDRange(n), buffer, (cl_uint)pass);
+//   batch.Submit(queue);
+//
+// Each distinct set of arguments of a kernel gets its own clone of the kernel
+// with the arguments set once, so launches don't wait on clSetKernelArg
+// calls and submitting the batch again (or recording the same launches after
+// Clear()) sets no arguments at all. Ranges are tuned and validated when
+// recorded. Submit() only enqueues, creates no events except for the last
+// launch and flushes the queue once.
+//
+// Launches in a batch don't show up in the profile or the metrics one by
+// one: with profiling on, the batch is one entry with the timing of its last
+// launch. The clones belong to ctx and are released with the batch.
+class LaunchBatch {
+ public:
+  explicit LaunchBatch(Context* ctx) : ctx_(ctx) {}
+  ~LaunchBatch();
+
+  // Records a launch of kernel over range with the arguments kernel has,
+  // after setting the given ones (from index 0) on it.
+  template<typename... Args> bool Add(Kernel* kernel, const NDRange& range,
+      const Args&... args) {
+    return kernel->SetArgs(args...) && Record(kernel, range);
+  }
+
+  // Enqueues the recorded launches in order on queue (by default the
+  // context's queue) and submits them to the device. Launches stay recorded
+  // and can be submitted again. If event is not NULL, it is set to an event
+  // that completes with the last launch.
+  bool Submit(CommandQueue* queue = NULL, Event* event = NULL,
+      const std::string& event_name = "Batch");
+
+  // Forgets the recorded launches. The clones are kept for the next ones.
+  void Clear() { launches_.clear(); }
+
+  size_t size() const { return launches_.size(); }
+
+  // Number of kernel clones, one per distinct kernel and arguments.
+  size_t num_clones() const { return clones_.size(); }
+
+ private:
+  LaunchBatch(const LaunchBatch&);
+  LaunchBatch& operator=(const LaunchBatch&);
+
+  bool Record(Kernel* kernel, const NDRange& range);
+
+  struct Launch {
+    Kernel* kernel; // A clone.
+    NDRange range;
+    Launch(Kernel* k, const NDRange& r) : kernel(k), range(r) {}
+  };
+
+  Context* ctx_; // unowned
+  std::vector<Launch> launches_;
+  // (kernel, ArgsKey()) -> clone with those arguments.
+  std::map<std::pair<const Kernel*, std::string>, Kernel*> clones_;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include "metrics.h"
+#include "context.h"
+#include "util.h"
+
+using namespace std;
+
+void LatencyHistogram::Record(uint64_t ns) {
+  int bucket = 0;
+  if (ns > 1) {
+    bucket = std::min<int>(kNumBuckets - 1, (int)ceil(log2((double)ns) * 4));
+  }
+  buckets_[bucket].fetch_add(1, memory_order_relaxed);
+  sum_.fetch_add(ns, memory_order_relaxed);
+}
+
+void LatencyHistogram::Reset() {
+  for (int i = 0; i < kNumBuckets; ++i) buckets_[i] = 0;
+  sum_ = 0;
+}
+
+uint64_t LatencyHistogram::count() const {
+  uint64_t count = 0;
+  for (int i = 0; i < kNumBuckets; ++i) count += buckets_[i];
+  return count;
+}
+
+uint64_t LatencyHistogram::Percentile(double p) const {
+  uint64_t counts[kNumBuckets];
+  uint64_t total = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    counts[i] = buckets_[i];
+    total += counts[i];
+  }
+  if (total == 0) return 0;
+  uint64_t target = std::max<uint64_t>(1, (uint64_t)ceil(p * total));
+  uint64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += counts[i];
+    if (seen >= target) return (uint64_t)pow(2.0, i / 4.0);
+  }
+  return (uint64_t)pow(2.0, (kNumBuckets - 1) / 4.0);
+}
+
+double LatencyHistogram::mean() const {
+  uint64_t n = count();
+  return n == 0 ? 0 : (double)sum_ / n;
+}
+
+void CommandMetrics::Record(uint64_t queue_to_start_ns, uint64_t start_to_end_ns,
+    size_t bytes) {
+  count_.fetch_add(1, memory_order_relaxed);
+  timed_bytes_.fetch_add(bytes, memory_order_relaxed);
+  queue_to_start_.Record(queue_to_start_ns);
+  start_to_end_.Record(start_to_end_ns);
+}
+
+void CommandMetrics::Reset() {
+  commands_ = 0;
+  count_ = 0;
+  failed_ = 0;
+  bytes_ = 0;
+  timed_bytes_ = 0;
+  queue_to_start_.Reset();
+  start_to_end_.Reset();
+}
+
+atomic<bool> Metrics::enabled_(true);
+atomic<uint32_t> Metrics::sample_interval_(64);
+mutex Metrics::lock_;
+map<string, CommandMetrics*> Metrics::commands_;
+
+CommandMetrics* Metrics::Get(const string& name) {
+  lock_guard<mutex> l(lock_);
+  map<string, CommandMetrics*>::iterator it = commands_.find(name);
+  if (it != commands_.end()) return it->second;
+  const string& key = commands_.size() < kMaxCommands ? name : "other";
+  CommandMetrics*& metrics = commands_[key];
+  if (metrics == NULL) metrics = new CommandMetrics(key);
+  return metrics;
+}
+
+namespace {
+
+// Shared by the running and complete callbacks of a command, the last one to
+// run deletes it.
+struct TrackedCommand {
+  CommandMetrics* metrics;
+  size_t bytes;
+  double queued_ms;
+  atomic<double> start_ms;
+  atomic<int> refs;
+};
+
+void Unref(TrackedCommand* command) {
+  if (--command->refs == 0) delete command;
+}
+
+void CL_CALLBACK OnCommandRunning(cl_event, cl_int, void* data) {
+  TrackedCommand* command = reinterpret_cast<TrackedCommand*>(data);
+  command->start_ms = timestamp_ms();
+  Unref(command);
+}
+
+void CL_CALLBACK OnCommandComplete(cl_event, cl_int status, void* data) {
+  TrackedCommand* command = reinterpret_cast<TrackedCommand*>(data);
+  if (status < 0) {
+    command->metrics->RecordFailure();
+  } else {
+    double end_ms = timestamp_ms();
+    // Runtimes may skip the running state for short commands.
+    double start_ms = command->start_ms;
+    if (start_ms == 0) start_ms = end_ms;
+    command->metrics->Record(
+        std::max(0.0, start_ms - command->queued_ms) * 1e6,
+        std::max(0.0, end_ms - start_ms) * 1e6, command->bytes);
+  }
+  Unref(command);
+}
+
+}
+
+bool Metrics::Track(cl_event e, CommandMetrics* metrics, size_t bytes) {
+  if (!enabled_ || e == NULL || metrics == NULL) return false;
+  TrackedCommand* command = new TrackedCommand();
+  command->metrics = metrics;
+  command->bytes = bytes;
+  command->queued_ms = timestamp_ms();
+  command->start_ms = 0;
+  command->refs = 2;
+  cl_int err = clSetEventCallback(e, CL_RUNNING, OnCommandRunning, command);
+  if (err < 0) {
+    fprintf(stderr, "Could not set event callback: %s\n", Error(err));
+    delete command;
+    return false;
+  }
+  err = clSetEventCallback(e, CL_COMPLETE, OnCommandComplete, command);
+  if (err < 0) {
+    fprintf(stderr, "Could not set event callback: %s\n", Error(err));
+    Unref(command);
+    return false;
+  }
+  return true;
+}
+
+Metrics::Snapshot Metrics::GetSnapshot() {
+  lock_guard<mutex> l(lock_);
+  Snapshot snapshot;
+  for (map<string, CommandMetrics*>::iterator it = commands_.begin();
+      it != commands_.end(); ++it) {
+    const CommandMetrics& metrics = *it->second;
+    Entry entry;
+    entry.name = metrics.name_;
+    entry.commands = metrics.commands_;
+    entry.bytes = metrics.bytes_;
+    entry.count = metrics.count_;
+    entry.failed = metrics.failed_;
+    entry.queue_to_start_p50_ns = metrics.queue_to_start_.Percentile(0.5);
+    entry.queue_to_start_p99_ns = metrics.queue_to_start_.Percentile(0.99);
+    entry.start_to_end_p50_ns = metrics.start_to_end_.Percentile(0.5);
+    entry.start_to_end_p99_ns = metrics.start_to_end_.Percentile(0.99);
+    entry.start_to_end_mean_ns = metrics.start_to_end_.mean();
+    double busy_ns = entry.start_to_end_mean_ns * metrics.start_to_end_.count();
+    entry.gbps = busy_ns > 0 ? metrics.timed_bytes_ / busy_ns : 0;
+    snapshot.push_back(entry);
+  }
+  return snapshot;
+}
+
+void Metrics::Reset() {
+  lock_guard<mutex> l(lock_);
+  for (map<string, CommandMetrics*>::iterator it = commands_.begin();
+      it != commands_.end(); ++it) {
+    it->second->Reset();
+  }
+}
+
+string Metrics::ToString() {
+  const Snapshot& snapshot = GetSnapshot();
+  stringstream ss;
+  ss << "Metrics" << endl;
+  for (size_t i = 0; i < snapshot.size(); ++i) {
+    const Entry& entry = snapshot[i];
+    if (entry.commands == 0 && entry.failed == 0) continue;
+    ss << "  " << entry.name << ": " << entry.commands << " runs, "
+       << entry.count << " timed";
+    if (entry.failed > 0) ss << ", " << entry.failed << " failed";
+    ss << endl
+       << "    Queue to start: p50 " << PrintNanos(entry.queue_to_start_p50_ns)
+       << ", p99 " << PrintNanos(entry.queue_to_start_p99_ns) << endl
+       << "    Start to end: p50 " << PrintNanos(entry.start_to_end_p50_ns)
+       << ", p99 " << PrintNanos(entry.start_to_end_p99_ns) << endl;
+    if (entry.bytes > 0) {
+      ss << "    Transferred: " << PrintBytes(entry.bytes)
+         << " (" << entry.gbps << " GB/s)" << endl;
+    }
+  }
+  return ss.str();
+}
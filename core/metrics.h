@@ -0,0 +1,128 @@
+#ifndef NONG_METRICS_H
+#define NONG_METRICS_H
+
+#include "platform.h"
+
+// Histogram of latencies in ns with 4 log2 buckets per power of 2, up to
+// ~18 minutes. Recording is lock free.
+class LatencyHistogram {
+ public:
+  static const int kNumBuckets = 4 * 40;
+
+  LatencyHistogram() { Reset(); }
+
+  void Record(uint64_t ns);
+  void Reset();
+
+  uint64_t count() const;
+  // Returns the upper bound of the bucket containing the p quantile
+  // (0 <= p <= 1), so it's within 19% of the real value.
+  uint64_t Percentile(double p) const;
+  double mean() const;
+
+ private:
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+  std::atomic<uint64_t> sum_;
+};
+
+// Metrics of all commands with the same name, e.g. all launches of a kernel.
+class CommandMetrics {
+ public:
+  CommandMetrics(const std::string& name) : name_(name) { Reset(); }
+
+  // queue_to_start_ns is the time between enqueueing the command and it
+  // starting to run, start_to_end_ns the time it ran, for a timed command.
+  // Failed commands are only counted.
+  void Record(uint64_t queue_to_start_ns, uint64_t start_to_end_ns, size_t bytes);
+  void RecordFailure() { ++failed_; }
+  void Reset();
+
+  const std::string& name() const { return name_; }
+
+ private:
+  friend class Metrics;
+
+  const std::string name_;
+  // All commands, and the ones timed (see Metrics::Sample()).
+  std::atomic<uint64_t> commands_;
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> failed_;
+  // Bytes copied by all commands, and by the timed ones.
+  std::atomic<uint64_t> bytes_;
+  std::atomic<uint64_t> timed_bytes_;
+  LatencyHistogram queue_to_start_;
+  LatencyHistogram start_to_end_;
+};
+
+// Process wide registry of command metrics. Launches and buffer reads/writes
+// are recorded automatically (by name) as long as metrics are enabled, which
+// they are by default. Every command is counted, but only one in
+// sample_interval() is timed, since timing takes an event and two callbacks.
+// Times are taken on the host from event callbacks, so no profiling queue is
+// needed.
+//
+// Memory is bounded: there are at most kMaxCommands names, further names are
+// recorded as "other".
+class Metrics {
+ public:
+  static const size_t kMaxCommands = 1024;
+
+  struct Entry {
+    std::string name;
+    uint64_t commands;
+    // Bytes copied by all commands.
+    uint64_t bytes;
+    // The timed commands, which the rest of the entry is about.
+    uint64_t count;
+    uint64_t failed;
+    uint64_t queue_to_start_p50_ns;
+    uint64_t queue_to_start_p99_ns;
+    uint64_t start_to_end_p50_ns;
+    uint64_t start_to_end_p99_ns;
+    double start_to_end_mean_ns;
+    // Transfer rate while the commands ran, 0 if they copy nothing.
+    double gbps;
+  };
+  typedef std::vector<Entry> Snapshot;
+
+  static void SetEnabled(bool enabled) { enabled_ = enabled; }
+  static bool enabled() { return enabled_; }
+
+  // Times one in interval commands of each name, 1 times all of them.
+  static void SetSampleInterval(uint32_t interval) {
+    sample_interval_ = std::max<uint32_t>(1, interval);
+  }
+  static uint32_t sample_interval() { return sample_interval_; }
+
+  // Counts a command of metrics that copies bytes. Returns metrics if the
+  // command should be timed with Track(), NULL if not or if metrics are
+  // disabled.
+  static CommandMetrics* Sample(CommandMetrics* metrics, size_t bytes = 0) {
+    if (!enabled_ || metrics == NULL) return NULL;
+    metrics->bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    const uint64_t n = metrics->commands_.fetch_add(1, std::memory_order_relaxed);
+    return n % sample_interval_ == 0 ? metrics : NULL;
+  }
+
+  // Returns the metrics for commands called name. The pointer stays valid
+  // for the lifetime of the process.
+  static CommandMetrics* Get(const std::string& name);
+
+  // Records the command of e in metrics once it's complete. Does not take
+  // ownership of e.
+  static bool Track(cl_event e, CommandMetrics* metrics, size_t bytes);
+
+  static Snapshot GetSnapshot();
+  static void Reset();
+
+  // Returns the snapshot as a table.
+  static std::string ToString();
+
+ private:
+  static std::atomic<bool> enabled_;
+  static std::atomic<uint32_t> sample_interval_;
+  static std::mutex lock_;
+  static std::map<std::string, CommandMetrics*> commands_;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "multi_device_executor.h"
+#include "util.h"
+
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+// Returns the part [start, start + rows) of range along dim.
+NDRange Slice(const NDRange& range, int dim, size_t start, size_t rows) {
+  size_t global[3] = { range.global(0), range.global(1), range.global(2) };
+  size_t offset[3] = { range.offset(0), range.offset(1), range.offset(2) };
+  global[dim] = rows;
+  offset[dim] += start;
+  NDRange chunk(global[0]);
+  if (range.dims() == 2) chunk = NDRange(global[0], global[1]);
+  if (range.dims() == 3) chunk = NDRange(global[0], global[1], global[2]);
+  if (range.has_local()) chunk.set_local(range.local(0), range.local(1), range.local(2));
+  chunk.set_offset(offset[0], offset[1], offset[2]);
+  return chunk;
+}
+
+}
+
+MultiDeviceExecutor* MultiDeviceExecutor::Create(
+    const vector<const DeviceInfo*>& devices) {
+  if (devices.empty()) {
+    fprintf(stderr, "Could not create executor: no devices\n");
+    return NULL;
+  }
+  MultiDeviceExecutor* executor = new MultiDeviceExecutor();
+  for (size_t i = 0; i < devices.size(); ++i) {
+    Context* ctx = Context::Create(devices[i]);
+    if (ctx == NULL) {
+      delete executor;
+      return NULL;
+    }
+    executor->contexts_.push_back(ctx);
+  }
+  executor->throughput_.resize(devices.size(), 0);
+  return executor;
+}
+
+MultiDeviceExecutor* MultiDeviceExecutor::CreateForAllDevices() {
+  vector<const DeviceInfo*> devices;
+  for (int i = 0; i < Platform::num_devices(); ++i) {
+    devices.push_back(Platform::device(i));
+  }
+  return Create(devices);
+}
+
+MultiDeviceExecutor::~MultiDeviceExecutor() {
+  for (size_t i = 0; i < contexts_.size(); ++i) {
+    delete contexts_[i];
+  }
+}
+
+bool MultiDeviceExecutor::Run(Workload* workload, const NDRange& range) {
+  RunState state(range);
+  state.workload = workload;
+  state.split_dim = range.dims() - 1;
+  state.granularity = range.has_local() ? range.local(state.split_dim) : 1;
+  state.next = 0;
+  state.failed = false;
+
+  stats_.clear();
+  for (size_t i = 0; i < contexts_.size(); ++i) {
+    DeviceStats stats;
+    stats.device = contexts_[i]->device();
+    stats.items = 0;
+    stats.chunks = 0;
+    stats.busy_ms = 0;
+    stats.throughput = 0;
+    stats_.push_back(stats);
+  }
+
+  vector<thread> threads;
+  for (size_t i = 0; i < contexts_.size(); ++i) {
+    threads.push_back(thread(&MultiDeviceExecutor::RunDevice, this, &state, (int)i));
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+  for (size_t i = 0; i < stats_.size(); ++i) {
+    stats_[i].throughput = throughput_[i];
+  }
+  return !state.failed;
+}
+
+size_t MultiDeviceExecutor::NextChunk(RunState* state, int device, size_t* start) {
+  lock_guard<mutex> l(state->lock);
+  const size_t total = state->range.global(state->split_dim);
+  if (state->failed || state->next >= total) return 0;
+
+  // Devices without a measurement yet count as average.
+  double known = 0;
+  int num_known = 0;
+  for (size_t i = 0; i < throughput_.size(); ++i) {
+    if (throughput_[i] > 0) {
+      known += throughput_[i];
+      ++num_known;
+    }
+  }
+  const double average = num_known > 0 ? known / num_known : 1;
+  double sum = 0;
+  for (size_t i = 0; i < throughput_.size(); ++i) {
+    sum += throughput_[i] > 0 ? throughput_[i] : average;
+  }
+  const double share = (throughput_[device] > 0 ? throughput_[device] : average) / sum;
+
+  // Take half of this device's share of what is left, so later chunks are
+  // smaller and correct for bad estimates.
+  const size_t remaining = total - state->next;
+  size_t rows = (size_t)ceil(remaining * share / 2);
+  rows = std::max(rows, total / (64 * throughput_.size()));
+  rows = (rows + state->granularity - 1) / state->granularity * state->granularity;
+  rows = std::min(std::max(rows, state->granularity), remaining);
+
+  *start = state->next;
+  state->next += rows;
+  return rows;
+}
+
+void MultiDeviceExecutor::RunDevice(RunState* state, int device) {
+  Context* ctx = contexts_[device];
+  Kernel* kernel = state->workload->Setup(ctx, device);
+  if (kernel == NULL) {
+    lock_guard<mutex> l(state->lock);
+    state->failed = true;
+    return;
+  }
+
+  const size_t items_per_row =
+      state->range.num_items() / state->range.global(state->split_dim);
+  CommandQueue* queue = ctx->default_queue();
+  size_t start;
+  size_t rows;
+  while ((rows = NextChunk(state, device, &start)) > 0) {
+    const NDRange& chunk = Slice(state->range, state->split_dim, start, rows);
+    double start_ms = timestamp_ms();
+    bool ok = queue->EnqueueKernel(kernel, chunk) &&
+        state->workload->Merge(ctx, queue, device, chunk) && queue->Flush();
+    double elapsed_ms = std::max(timestamp_ms() - start_ms, 1e-3);
+
+    lock_guard<mutex> l(state->lock);
+    if (!ok) {
+      state->failed = true;
+      break;
+    }
+    const double throughput = rows * items_per_row / elapsed_ms;
+    throughput_[device] = throughput_[device] == 0 ?
+        throughput : (throughput_[device] + throughput) / 2;
+    stats_[device].items += rows * items_per_row;
+    stats_[device].chunks++;
+    stats_[device].busy_ms += elapsed_ms;
+  }
+  ctx->Release(kernel);
+}
+
+string MultiDeviceExecutor::ToString() const {
+  stringstream ss;
+  ss << "MultiDeviceExecutor (" << contexts_.size() << " devices)" << endl;
+  for (size_t i = 0; i < stats_.size(); ++i) {
+    ss << "  " << stats_[i].device->name << ": " << stats_[i].items << " items in "
+       << stats_[i].chunks << " chunks, busy " << stats_[i].busy_ms << "ms, "
+       << stats_[i].throughput << " items/ms" << endl;
+  }
+  return ss.str();
+}
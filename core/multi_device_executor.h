@@ -0,0 +1,90 @@
+#ifndef NONG_MULTI_DEVICE_EXECUTOR_H
+#define NONG_MULTI_DEVICE_EXECUTOR_H
+
+#include "context.h"
+
+// Runs one kernel launch split across several devices. Each device gets its
+// own context; the range is cut along its last dimension (rows for 2D) into
+// chunks which the devices take from a shared position, one host thread per
+// device. Chunk sizes follow the measured throughput of each device: the
+// first chunks are large and shrink as the range runs out, so fast devices
+// take more work and all devices finish close together. Throughputs are
+// updated from every chunk and kept across runs.
+//
+// Kernels see their real global ids (the chunks are launched with offsets),
+// so kernels that write result[get_global_id(0)] work unchanged.
+class MultiDeviceExecutor {
+ public:
+  // The work to split. All methods are called from the device's thread.
+  class Workload {
+   public:
+    virtual ~Workload() {}
+
+    // Creates the kernel and its arguments in ctx. Called once per device and
+    // run. The kernel is released after the run.
+    virtual Kernel* Setup(Context* ctx, int device) = 0;
+
+    // Copies the results of chunk back to the host. The kernel has been
+    // enqueued on queue but may not be done yet.
+    virtual bool Merge(Context* ctx, CommandQueue* queue, int device,
+        const NDRange& chunk) = 0;
+  };
+
+  struct DeviceStats {
+    const DeviceInfo* device;
+    size_t items;
+    int chunks;
+    double busy_ms;
+    // Work items per ms, as used to size the chunks.
+    double throughput;
+  };
+
+  // Returns NULL if a context could not be created for every device.
+  static MultiDeviceExecutor* Create(const std::vector<const DeviceInfo*>& devices);
+
+  // All devices of the platform.
+  static MultiDeviceExecutor* CreateForAllDevices();
+
+  ~MultiDeviceExecutor();
+
+  // Runs workload over range. If range has a work group size, chunks are
+  // multiples of it. Blocks until all chunks are merged.
+  bool Run(Workload* workload, const NDRange& range);
+
+  int num_devices() const { return contexts_.size(); }
+  Context* context(int idx) { return contexts_[idx]; }
+
+  // Stats of the last Run().
+  const std::vector<DeviceStats>& stats() const { return stats_; }
+  std::string ToString() const;
+
+ private:
+  MultiDeviceExecutor() {}
+  MultiDeviceExecutor(const MultiDeviceExecutor&);
+  MultiDeviceExecutor& operator=(const MultiDeviceExecutor&);
+
+  // Shared by the device threads of one Run().
+  struct RunState {
+    Workload* workload;
+    NDRange range;
+    int split_dim;
+    size_t granularity;
+    std::mutex lock;
+    // Next index along split_dim to hand out.
+    size_t next;
+    bool failed;
+    explicit RunState(const NDRange& r) : range(r) {}
+  };
+
+  void RunDevice(RunState* state, int device);
+
+  // Returns the number of rows (along split_dim) for the next chunk of device,
+  // 0 if there is no work left. Sets *start.
+  size_t NextChunk(RunState* state, int device, size_t* start);
+
+  std::vector<Context*> contexts_;
+  std::vector<DeviceStats> stats_;
+  std::vector<double> throughput_;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "context.h"
+
+using namespace std;
+
+NDRange::NDRange(size_t x) {
+  Init(1, x, 1, 1);
+}
+
+NDRange::NDRange(size_t x, size_t y) {
+  Init(2, x, y, 1);
+}
+
+NDRange::NDRange(size_t x, size_t y, size_t z) {
+  Init(3, x, y, z);
+}
+
+void NDRange::Init(int dims, size_t x, size_t y, size_t z) {
+  dims_ = dims;
+  global_[0] = x;
+  global_[1] = y;
+  global_[2] = z;
+  for (int i = 0; i < 3; ++i) {
+    local_[i] = 1;
+    offset_[i] = 0;
+  }
+  has_local_ = false;
+  has_offset_ = false;
+}
+
+NDRange& NDRange::set_local(size_t x, size_t y, size_t z) {
+  local_[0] = x;
+  local_[1] = dims_ > 1 ? y : 1;
+  local_[2] = dims_ > 2 ? z : 1;
+  has_local_ = true;
+  return *this;
+}
+
+NDRange& NDRange::set_offset(size_t x, size_t y, size_t z) {
+  offset_[0] = x;
+  offset_[1] = dims_ > 1 ? y : 0;
+  offset_[2] = dims_ > 2 ? z : 0;
+  has_offset_ = true;
+  return *this;
+}
+
+bool NDRange::Validate(const DeviceInfo* device, const Kernel* kernel,
+    string* error) const {
+  stringstream ss;
+  if (dims_ > (int)device->max_work_item_sizes.size()) {
+    ss << "Device supports " << device->max_work_item_sizes.size()
+       << " dimensions, range has " << dims_ << ".";
+    *error = ss.str();
+    return false;
+  }
+  for (int i = 0; i < dims_; ++i) {
+    if (global_[i] == 0) {
+      ss << "Global size of dimension " << i << " is 0.";
+      *error = ss.str();
+      return false;
+    }
+  }
+  if (!has_local_) return true;
+
+  for (int i = 0; i < dims_; ++i) {
+    if (local_[i] == 0 || local_[i] > device->max_work_item_sizes[i]) {
+      ss << "Local size " << local_[i] << " of dimension " << i
+         << " is not in [1, " << device->max_work_item_sizes[i] << "].";
+      *error = ss.str();
+      return false;
+    }
+    if (global_[i] % local_[i] != 0) {
+      ss << "Global size " << global_[i] << " of dimension " << i
+         << " is not a multiple of the local size " << local_[i] << ".";
+      *error = ss.str();
+      return false;
+    }
+  }
+  size_t max_items = device->max_work_group_size;
+  if (kernel != NULL) max_items = std::min(max_items, kernel->max_work_group_size());
+  if (num_local_items() > max_items) {
+    ss << "Work group has " << num_local_items() << " items, at most "
+       << max_items << " are supported.";
+    *error = ss.str();
+    return false;
+  }
+  return true;
+}
+
+string NDRange::ToString() const {
+  stringstream ss;
+  ss << "NDRange(" << global_[0];
+  for (int i = 1; i < dims_; ++i) ss << "x" << global_[i];
+  if (has_local_) {
+    ss << ", local " << local_[0];
+    for (int i = 1; i < dims_; ++i) ss << "x" << local_[i];
+  }
+  if (has_offset_) {
+    ss << ", offset " << offset_[0];
+    for (int i = 1; i < dims_; ++i) ss << "," << offset_[i];
+  }
+  ss << ")";
+  return ss.str();
+}
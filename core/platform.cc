@@ -1,4 +1,5 @@
 #include "platform.h"
+#include "context.h"
 #include "util.h"
 
 #include <boost/algorithm/string.hpp>
@@ -15,6 +16,7 @@ DeviceInfo* Platform::devices_;
 DeviceInfo* Platform::default_device_;
 DeviceInfo* Platform::cpu_device_;
 DeviceInfo* Platform::gpu_device_;
+vector<DeviceInfo*> Platform::sub_devices_;
 
 string VersionToString(DeviceInfo::Version::Type t) {
   switch (t) {
@@ -34,11 +36,23 @@ string DeviceInfo::ToString(bool detail) const {
 
   ss << "  Vendor: " << vendor_string << endl
      << "  Version: " << VersionToString(version) << endl
+     << "  DriverVersion: " << driver_version << endl
      << "  NumComputeUnits: " << num_compute_units << endl
      << "  MaxWorkGroupSize: " << max_work_group_size << endl
+     << "  MaxWorkItemSizes:";
+  for (size_t i = 0; i < max_work_item_sizes.size(); ++i) {
+    ss << " " << max_work_item_sizes[i];
+  }
+  ss << endl
      << "  MaxLocalMem: " << PrintBytes(max_local_mem) << endl
      << "  MaxGlobalMem: " << PrintBytes(max_global_mem) << endl
      << "  PtrAlignement: " << ptr_alignment << endl
+     << "  PreferredFloatWidth: " << preferred_float_width << endl
+     << "  Partition" << endl
+     << "    MaxSubDevices: " << partition.max_sub_devices << endl
+     << "    Equally: " << (partition.equally ? "Yes" : "No") << endl
+     << "    ByCounts: " << (partition.by_counts ? "Yes" : "No") << endl
+     << "    ByNuma: " << (partition.by_numa ? "Yes" : "No") << endl
      << "  Extensions" << endl
      << "    AtomicsInt32: " << (extensions.atomics_int32 ? "Yes" : "No") << endl
      << "    AtomicsInt64: " << (extensions.atomics_int64 ? "Yes" : "No") << endl
@@ -112,6 +126,9 @@ bool GetDeviceInfo(DeviceInfo* info, cl_device_id id) {
   info->version_str.erase(info->version_str.find_last_not_of(" ") + 1);
   info->version = ParseVesion(info->version_str);
 
+  clGetDeviceInfo(id, CL_DRIVER_VERSION, sizeof(buf), buf, NULL);
+  info->driver_version = buf;
+
   clGetDeviceInfo(id, CL_DEVICE_VENDOR, sizeof(buf), buf, NULL);
   info->vendor_string = buf;
   info->vendor = ParseVendor(info->vendor_string);
@@ -125,13 +142,13 @@ bool GetDeviceInfo(DeviceInfo* info, cl_device_id id) {
       &info->max_work_group_size, 0);
 
   cl_uint max_dims;
-  clGetDeviceInfo(id, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(size_t),
+  clGetDeviceInfo(id, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(cl_uint),
       &max_dims, 0);
-  size_t max_per_dim[max_dims];
-  clGetDeviceInfo(id, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_per_dim),
-      &max_per_dim, 0);
+  info->max_work_item_sizes.resize(max_dims);
+  clGetDeviceInfo(id, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(size_t) * max_dims,
+      &info->max_work_item_sizes[0], 0);
   info->max_work_group_size =
-    std::min(info->max_work_group_size, max_per_dim[0]);
+    std::min(info->max_work_group_size, info->max_work_item_sizes[0]);
 
   clGetDeviceInfo(id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint),
       &info->num_compute_units, 0);
@@ -141,6 +158,39 @@ bool GetDeviceInfo(DeviceInfo* info, cl_device_id id) {
       &info->max_global_mem, 0);
   clGetDeviceInfo(id, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint),
       &info->ptr_alignment, 0);
+  // Reported in bits.
+  info->ptr_alignment /= 8;
+  if (clGetDeviceInfo(id, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, sizeof(cl_uint),
+          &info->preferred_float_width, 0) != CL_SUCCESS) {
+    info->preferred_float_width = 1;
+  }
+
+  // Partitioning is only available since 1.2, the queries fail before.
+  info->parent = NULL;
+  memset(&info->partition, 0, sizeof(info->partition));
+  cl_device_partition_property properties[8];
+  size_t properties_size = 0;
+  if (clGetDeviceInfo(id, CL_DEVICE_PARTITION_MAX_SUB_DEVICES, sizeof(cl_uint),
+          &info->partition.max_sub_devices, 0) == CL_SUCCESS &&
+      clGetDeviceInfo(id, CL_DEVICE_PARTITION_PROPERTIES, sizeof(properties),
+          properties, &properties_size) == CL_SUCCESS) {
+    cl_device_affinity_domain domains = 0;
+    clGetDeviceInfo(id, CL_DEVICE_PARTITION_AFFINITY_DOMAIN,
+        sizeof(domains), &domains, 0);
+    for (size_t i = 0; i < properties_size / sizeof(properties[0]); ++i) {
+      switch (properties[i]) {
+        case CL_DEVICE_PARTITION_EQUALLY:
+          info->partition.equally = true;
+          break;
+        case CL_DEVICE_PARTITION_BY_COUNTS:
+          info->partition.by_counts = true;
+          break;
+        case CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN:
+          info->partition.by_numa = (domains & CL_DEVICE_AFFINITY_DOMAIN_NUMA) != 0;
+          break;
+      }
+    }
+  }
   return true;
 }
 
@@ -173,3 +223,76 @@ bool Platform::Init() {
   free(ids);
   return true;
 }
+
+bool Platform::CreateSubDevices(const DeviceInfo* device,
+    const cl_device_partition_property* properties, const char* type,
+    vector<const DeviceInfo*>* sub_devices) {
+  cl_uint num_ids = 0;
+  cl_int err = clCreateSubDevices(device->id, properties, 0, NULL, &num_ids);
+  if (err < 0) {
+    fprintf(stderr, "Could not partition %s %s: %s\n",
+        device->name.c_str(), type, Error(err));
+    return false;
+  }
+  vector<cl_device_id> ids(num_ids);
+  err = clCreateSubDevices(device->id, properties, num_ids, &ids[0], NULL);
+  if (err < 0) {
+    fprintf(stderr, "Could not partition %s %s: %s\n",
+        device->name.c_str(), type, Error(err));
+    return false;
+  }
+
+  for (size_t i = 0; i < ids.size(); ++i) {
+    DeviceInfo* info = new DeviceInfo();
+    if (!GetDeviceInfo(info, ids[i])) {
+      delete info;
+      return false;
+    }
+    EnableDeviceOptimizations(info);
+    info->parent = device;
+    sub_devices_.push_back(info);
+    sub_devices->push_back(info);
+  }
+  return true;
+}
+
+bool Platform::CreateSubDevicesEqually(const DeviceInfo* device,
+    int units_per_device, vector<const DeviceInfo*>* sub_devices) {
+  if (!device->partition.equally) {
+    fprintf(stderr, "Could not partition %s equally: not supported\n",
+        device->name.c_str());
+    return false;
+  }
+  const cl_device_partition_property properties[] = {
+    CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property)units_per_device, 0,
+  };
+  return CreateSubDevices(device, properties, "equally", sub_devices);
+}
+
+bool Platform::CreateSubDevicesByCounts(const DeviceInfo* device,
+    const vector<int>& counts, vector<const DeviceInfo*>* sub_devices) {
+  if (!device->partition.by_counts) {
+    fprintf(stderr, "Could not partition %s by counts: not supported\n",
+        device->name.c_str());
+    return false;
+  }
+  vector<cl_device_partition_property> properties;
+  properties.push_back(CL_DEVICE_PARTITION_BY_COUNTS);
+  for (size_t i = 0; i < counts.size(); ++i) properties.push_back(counts[i]);
+  properties.push_back(CL_DEVICE_PARTITION_BY_COUNTS_LIST_END);
+  properties.push_back(0);
+  return CreateSubDevices(device, &properties[0], "by counts", sub_devices);
+}
+
+bool Platform::CreateSubDevicesByNuma(const DeviceInfo* device,
+    vector<const DeviceInfo*>* sub_devices) {
+  if (!device->partition.by_numa) {
+    fprintf(stderr, "Could not partition %s by NUMA node: not supported\n",
+        device->name.c_str());
+    return false;
+  }
+  const cl_device_partition_property properties[] = {
+    CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0,
+  };
+  return CreateSubDevices(device, properties, "by NUMA node", sub_devices);
+}
@@ -38,6 +38,7 @@ struct DeviceInfo {
   std::string name;
   std::string version_str;
   Version::Type version;
+  std::string driver_version;
   std::string vendor_string;
   Vendor::Type vendor;
   cl_device_type type;
@@ -46,12 +47,34 @@ struct DeviceInfo {
   cl_ulong max_global_mem;
   cl_ulong max_local_mem;
 
-  // Optimal alignmenet to use when sharing between host and device memory.
+  // Optimal alignmenet (in bytes) to use when sharing between host and device
+  // memory. Host allocations with this alignment can be used for zero-copy
+  // buffers (see Context::CreateZeroCopyBuffer).
   cl_uint ptr_alignment;
 
+  // The float vector width the compiler prefers, e.g. 8 for AVX cpus and
+  // often 1 for gpus, which vectorize across work items.
+  cl_uint preferred_float_width;
+
   // The maximum number of work items in a work group.
   size_t max_work_group_size;
 
+  // The maximum number of work items in a work group in each dimension. The
+  // size is the maximum number of dimensions.
+  std::vector<size_t> max_work_item_sizes;
+
+  // Set for sub-devices (see Platform::CreateSubDevicesEqually()).
+  const DeviceInfo* parent;
+
+  // How the device can be partitioned into sub-devices. All false if it
+  // can't be partitioned.
+  struct {
+    cl_uint max_sub_devices;
+    bool equally;
+    bool by_counts;
+    bool by_numa;
+  } partition;
+
   // Extensions supported on this device;
   struct {
     bool atomics_int32;
@@ -75,17 +98,38 @@ class Platform {
   // First gpu device.
   static const DeviceInfo* gpu_device() { return gpu_device_; }
 
+  // Partition device into sub-devices with a subset of its compute units,
+  // appended to sub_devices. Sub-devices can be used like any other device,
+  // e.g. with Context::Create(), and stay valid until the process exits.
+  // Buffers of a context on a sub-device are placed close to its compute
+  // units (see Context::CreateLocalBuffer()).
+  //
+  // As many sub-devices with units_per_device compute units as fit.
+  static bool CreateSubDevicesEqually(const DeviceInfo* device,
+      int units_per_device, std::vector<const DeviceInfo*>* sub_devices);
+  // One sub-device with counts[i] compute units for each entry of counts.
+  static bool CreateSubDevicesByCounts(const DeviceInfo* device,
+      const std::vector<int>& counts, std::vector<const DeviceInfo*>* sub_devices);
+  // One sub-device per NUMA node, e.g. per socket of a multi-socket host.
+  static bool CreateSubDevicesByNuma(const DeviceInfo* device,
+      std::vector<const DeviceInfo*>* sub_devices);
+
  private:
   Platform();
 
   // Updates info with device specific optimizations.
   static void EnableDeviceOptimizations(DeviceInfo* info);
 
+  static bool CreateSubDevices(const DeviceInfo* device,
+      const cl_device_partition_property* properties, const char* type,
+      std::vector<const DeviceInfo*>* sub_devices);
+
   static cl_uint num_devices_;
   static DeviceInfo* devices_;
   static DeviceInfo* default_device_;
   static DeviceInfo* cpu_device_;
   static DeviceInfo* gpu_device_;
+  static std::vector<DeviceInfo*> sub_devices_;
 };
 
 #endif
@@ -0,0 +1,219 @@
+#include "profiler.h"
+
+#include <thread>
+
+using namespace std;
+
+mutex Profiler::tracks_lock_;
+map<int, Profiler::Track> Profiler::tracks_;
+int Profiler::next_track_ = 1;
+map<string, int> Profiler::host_tracks_;
+
+mutex Profiler::spans_lock_;
+deque<Profiler::Span> Profiler::spans_;
+size_t Profiler::capacity_ = 65536;
+size_t Profiler::dropped_ = 0;
+
+int Profiler::RegisterTrack(const string& name, HarvestFn harvest, void* data) {
+  lock_guard<mutex> l(tracks_lock_);
+  Track track;
+  track.name = name;
+  track.harvest = harvest;
+  track.data = data;
+  track.retired = false;
+  tracks_[next_track_] = track;
+  return next_track_++;
+}
+
+void Profiler::UnregisterTrack(int track) {
+  lock_guard<mutex> l(tracks_lock_);
+  map<int, Track>::iterator it = tracks_.find(track);
+  if (it == tracks_.end()) return;
+  // The name is still needed for spans already recorded.
+  it->second.harvest = NULL;
+  it->second.data = NULL;
+  it->second.retired = true;
+  RemoveRetiredTracks();
+}
+
+void Profiler::RemoveRetiredTracks() {
+  set<int> used;
+  {
+    lock_guard<mutex> l(spans_lock_);
+    for (size_t i = 0; i < spans_.size(); ++i) used.insert(spans_[i].track);
+  }
+  for (map<int, Track>::iterator it = tracks_.begin(); it != tracks_.end();) {
+    if (it->second.retired && used.count(it->first) == 0) {
+      tracks_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+int Profiler::HostTrack() {
+  stringstream ss;
+  ss << this_thread::get_id();
+  lock_guard<mutex> l(tracks_lock_);
+  map<string, int>::iterator it = host_tracks_.find(ss.str());
+  if (it != host_tracks_.end()) return it->second;
+
+  Track track;
+  stringstream name;
+  name << "Host thread " << host_tracks_.size();
+  track.name = name.str();
+  track.harvest = NULL;
+  track.data = NULL;
+  track.retired = false;
+  tracks_[next_track_] = track;
+  host_tracks_[ss.str()] = next_track_;
+  return next_track_++;
+}
+
+void Profiler::Record(const Span& span) {
+  lock_guard<mutex> l(spans_lock_);
+  while (spans_.size() >= capacity_ && !spans_.empty()) {
+    spans_.pop_front();
+    ++dropped_;
+  }
+  if (capacity_ > 0) spans_.push_back(span);
+}
+
+void Profiler::RecordHostSpan(const char* name, double start_ms, double end_ms) {
+  Span span;
+  span.name = name;
+  span.track = HostTrack();
+  span.queued_us = span.submit_us = span.start_us = start_ms * 1000;
+  span.end_us = end_ms * 1000;
+  span.bytes = 0;
+  Record(span);
+}
+
+void Profiler::SetCapacity(size_t capacity) {
+  lock_guard<mutex> l(spans_lock_);
+  capacity_ = capacity;
+  while (spans_.size() > capacity_) {
+    spans_.pop_front();
+    ++dropped_;
+  }
+}
+
+void Profiler::Harvest() {
+  lock_guard<mutex> l(tracks_lock_);
+  for (map<int, Track>::iterator it = tracks_.begin(); it != tracks_.end(); ++it) {
+    if (it->second.harvest != NULL) it->second.harvest(it->second.data);
+  }
+}
+
+vector<Profiler::Span> Profiler::Spans(int track) {
+  Harvest();
+  lock_guard<mutex> l(spans_lock_);
+  vector<Span> result;
+  for (size_t i = 0; i < spans_.size(); ++i) {
+    if (track == -1 || spans_[i].track == track) result.push_back(spans_[i]);
+  }
+  return result;
+}
+
+size_t Profiler::dropped() {
+  lock_guard<mutex> l(spans_lock_);
+  return dropped_;
+}
+
+void Profiler::CountDropped(size_t n) {
+  lock_guard<mutex> l(spans_lock_);
+  dropped_ += n;
+}
+
+void Profiler::Clear() {
+  Harvest();
+  {
+    lock_guard<mutex> l(spans_lock_);
+    spans_.clear();
+    dropped_ = 0;
+  }
+  lock_guard<mutex> l(tracks_lock_);
+  RemoveRetiredTracks();
+}
+
+namespace {
+
+string EscapeJson(const string& s) {
+  stringstream ss;
+  for (size_t i = 0; i < s.size(); ++i) {
+    char c = s[i];
+    if (c == '"' || c == '\\') {
+      ss << '\\' << c;
+    } else if ((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      ss << buf;
+    } else {
+      ss << c;
+    }
+  }
+  return ss.str();
+}
+
+}
+
+string Profiler::ToChromeTrace() {
+  const vector<Span>& spans = Spans();
+  map<int, string> track_names;
+  {
+    lock_guard<mutex> l(tracks_lock_);
+    for (map<int, Track>::iterator it = tracks_.begin(); it != tracks_.end(); ++it) {
+      track_names[it->first] = it->second.name;
+    }
+  }
+
+  // Timestamps are relative to the first span to keep them readable.
+  double origin = 0;
+  for (size_t i = 0; i < spans.size(); ++i) {
+    if (i == 0 || spans[i].queued_us < origin) origin = spans[i].queued_us;
+  }
+
+  stringstream ss;
+  ss.precision(3);
+  ss << fixed;
+  ss << "{\"traceEvents\":[" << endl;
+  bool first = true;
+  for (map<int, string>::iterator it = track_names.begin();
+      it != track_names.end(); ++it) {
+    if (!first) ss << "," << endl;
+    first = false;
+    ss << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << it->first
+       << ",\"args\":{\"name\":\"" << EscapeJson(it->second) << "\"}}";
+  }
+  for (size_t i = 0; i < spans.size(); ++i) {
+    const Span& span = spans[i];
+    if (!first) ss << "," << endl;
+    first = false;
+    ss << "{\"name\":\"" << EscapeJson(span.name) << "\",\"ph\":\"X\",\"pid\":1"
+       << ",\"tid\":" << span.track
+       << ",\"ts\":" << span.start_us - origin
+       << ",\"dur\":" << span.end_us - span.start_us
+       << ",\"args\":{\"queued_us\":" << span.start_us - span.queued_us;
+    if (span.bytes > 0) {
+      ss << ",\"bytes\":" << span.bytes;
+      if (span.end_us > span.start_us) {
+        ss << ",\"gbps\":" << span.bytes / ((span.end_us - span.start_us) * 1000.);
+      }
+    }
+    ss << "}}";
+  }
+  ss << endl << "],\"displayTimeUnit\":\"ns\"}" << endl;
+  return ss.str();
+}
+
+bool Profiler::WriteChromeTrace(const string& path) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == NULL) {
+    fprintf(stderr, "Could not write trace to %s\n", path.c_str());
+    return false;
+  }
+  const string& trace = ToChromeTrace();
+  bool ok = fwrite(trace.data(), 1, trace.size(), file) == trace.size();
+  fclose(file);
+  return ok;
+}
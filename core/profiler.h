@@ -0,0 +1,88 @@
+#ifndef NONG_PROFILER_H
+#define NONG_PROFILER_H
+
+#include "common.h"
+
+// Collects completed device commands and host spans for export as a Chrome
+// trace (chrome://tracing or ui.perfetto.dev). Each command queue with
+// profiling enabled gets its own track, host spans from ScopedTimeMeasure go
+// to one track per thread. Device timestamps are converted to the host clock
+// so both line up.
+//
+// Spans are kept in a bounded ring; once it is full the oldest spans are
+// dropped.
+class Profiler {
+ public:
+  // Times are in us on the host clock (see timestamp_ms()).
+  struct Span {
+    std::string name;
+    int track;
+    double queued_us;
+    double submit_us;
+    double start_us;
+    double end_us;
+    // Bytes transferred for copies, 0 otherwise.
+    size_t bytes;
+  };
+
+  // Called to move completed commands of a track into the profiler.
+  typedef void (*HarvestFn)(void* data);
+
+  // Returns the id of a new track. harvest is called (with data) before
+  // spans are read.
+  static int RegisterTrack(const std::string& name, HarvestFn harvest = NULL,
+      void* data = NULL);
+  // Stops harvesting track. It is removed once none of its spans are left,
+  // so short lived queues don't add up.
+  static void UnregisterTrack(int track);
+
+  static void Record(const Span& span);
+  static void RecordHostSpan(const char* name, double start_ms, double end_ms);
+
+  // Sets the maximum number of spans kept. Defaults to 65536.
+  static void SetCapacity(size_t capacity);
+
+  // Moves completed commands of all tracks into the profiler.
+  static void Harvest();
+
+  // Returns the spans of track, or of all tracks if track is -1.
+  static std::vector<Span> Spans(int track = -1);
+
+  // Number of spans (and commands) that were dropped.
+  static size_t dropped();
+  static void CountDropped(size_t n);
+
+  static void Clear();
+
+  // Returns all spans in the chrome trace_event JSON format.
+  static std::string ToChromeTrace();
+  static bool WriteChromeTrace(const std::string& path);
+
+ private:
+  struct Track {
+    std::string name;
+    HarvestFn harvest;
+    void* data;
+    // Unregistered, kept only for the name of its spans.
+    bool retired;
+  };
+
+  static int HostTrack();
+
+  // Removes retired tracks without spans. Must hold tracks_lock_.
+  static void RemoveRetiredTracks();
+
+  // Guards tracks_ and is held while harvesting so a track isn't removed while
+  // it's being harvested.
+  static std::mutex tracks_lock_;
+  static std::map<int, Track> tracks_;
+  static int next_track_;
+  static std::map<std::string, int> host_tracks_;
+
+  static std::mutex spans_lock_;
+  static std::deque<Span> spans_;
+  static size_t capacity_;
+  static size_t dropped_;
+};
+
+#endif
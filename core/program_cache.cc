@@ -0,0 +1,82 @@
+#include "program_cache.h"
+#include "util.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+ProgramCache::ProgramCache(const string& dir)
+  : dir_(dir), hits_(0), misses_(0) {
+  if (mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Could not create program cache dir %s: %s\n",
+        dir_.c_str(), strerror(errno));
+  }
+}
+
+string ProgramCache::Key(const DeviceInfo* device, const char* source,
+    size_t size, const string& build_options) {
+  // Include the terminators so adjacent values can't run into each other.
+  uint64_t hash = Hash(source, size);
+  hash = Hash(build_options.c_str(), build_options.size() + 1, hash);
+  hash = Hash(device->name.c_str(), device->name.size() + 1, hash);
+  hash = Hash(device->version_str.c_str(), device->version_str.size() + 1, hash);
+  hash = Hash(device->driver_version.c_str(),
+      device->driver_version.size() + 1, hash);
+
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)hash);
+  return buf;
+}
+
+string ProgramCache::Path(const string& key) const {
+  return dir_ + "/" + key + ".bin";
+}
+
+bool ProgramCache::Load(const string& key, vector<unsigned char>* binary) const {
+  const string& path = Path(key);
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) return false;
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  if (size <= 0) {
+    fclose(file);
+    return false;
+  }
+
+  binary->resize(size);
+  size_t num_bytes = fread(&(*binary)[0], 1, size, file);
+  fclose(file);
+  return num_bytes == (size_t)size;
+}
+
+bool ProgramCache::Store(const string& key, const vector<unsigned char>& binary) {
+  if (binary.empty()) return false;
+  // Write to a temporary file first so concurrent processes never read a
+  // partially written binary.
+  const string& path = Path(key);
+  stringstream tmp_path;
+  tmp_path << path << ".tmp." << getpid();
+  FILE* file = fopen(tmp_path.str().c_str(), "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not write program cache file %s\n", path.c_str());
+    return false;
+  }
+  size_t num_bytes = fwrite(&binary[0], 1, binary.size(), file);
+  fclose(file);
+  if (num_bytes != binary.size() || rename(tmp_path.str().c_str(), path.c_str()) != 0) {
+    fprintf(stderr, "Could not write program cache file %s\n", path.c_str());
+    unlink(tmp_path.str().c_str());
+    return false;
+  }
+  return true;
+}
+
+string ProgramCache::ToString() const {
+  stringstream ss;
+  ss << "ProgramCache '" << dir_ << "': " << hits_ << " hits, "
+     << misses_ << " misses";
+  return ss.str();
+}
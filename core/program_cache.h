@@ -0,0 +1,43 @@
+#ifndef NONG_PROGRAM_CACHE_H
+#define NONG_PROGRAM_CACHE_H
+
+#include "platform.h"
+
+// On disk cache of compiled program binaries, so that processes don't have to
+// rebuild programs from source every time they start. Binaries are keyed by
+// a hash of the source, the build options, and the device name and driver
+// version, so changing any of them results in a rebuild.
+class ProgramCache {
+ public:
+  // Binaries are stored as files in dir, which is created if it does not exist.
+  ProgramCache(const std::string& dir);
+
+  static std::string Key(const DeviceInfo* device, const char* source,
+      size_t size, const std::string& build_options);
+
+  // Reads the binary for key. Returns false if there is none.
+  bool Load(const std::string& key, std::vector<unsigned char>* binary) const;
+
+  // Writes the binary for key, replacing any existing one.
+  bool Store(const std::string& key, const std::vector<unsigned char>& binary);
+
+  // A hit is a program that was created from a cached binary. Everything that
+  // had to be built from source is a miss.
+  void RecordHit() { ++hits_; }
+  void RecordMiss() { ++misses_; }
+  int hits() const { return hits_; }
+  int misses() const { return misses_; }
+
+  const std::string& dir() const { return dir_; }
+  std::string ToString() const;
+
+ private:
+  std::string Path(const std::string& key) const;
+
+  const std::string dir_;
+  // Async builds record from several threads.
+  std::atomic<int> hits_;
+  std::atomic<int> misses_;
+};
+
+#endif
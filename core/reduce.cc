@@ -0,0 +1,92 @@
+#include "reduce.h"
+#include "util.h"
+
+using namespace std;
+
+// Work groups larger than this don't make the first pass faster, the tree
+// reduction just gets deeper.
+static const size_t kMaxLocalSize = 256;
+
+ReduceKernel::ReduceKernel(Context* ctx)
+  : ctx_(ctx), kernel_(NULL), type_size_(0), vec_(0), local_size_(0),
+    max_groups_(0), partials_(NULL), result_(NULL) {
+}
+
+ReduceKernel::~ReduceKernel() {
+  if (kernel_ != NULL) ctx_->Release(kernel_);
+  if (partials_ != NULL) ctx_->Release(partials_);
+  if (result_ != NULL) ctx_->Release(result_);
+}
+
+bool ReduceKernel::Init(const char* type_name, size_t type_size,
+    const char* op, const char* identity) {
+  const DeviceInfo* device = ctx_->device();
+  // 16 byte loads, which is what both cpu and gpu devices read best.
+  vec_ = type_size >= 16 ? 1 : 16 / type_size;
+
+  Program::BuildOptions options;
+  options.defines["T"] = type_name;
+  options.defines["OP(a, b)"] = string("(") + op + ")";
+  options.defines["IDENTITY"] = identity;
+  options.defines["VEC"] = to_string(vec_);
+  kernel_ = ctx_->CreateKernel("kernels/reduce.cl", "reduce", options);
+  if (kernel_ == NULL) return false;
+  type_size_ = type_size;
+
+  // The largest power of two work group that fits the device, the kernel and
+  // the local memory.
+  size_t limit = min(min(kernel_->max_work_group_size(), kMaxLocalSize),
+      device->max_work_group_size);
+  if (device->max_local_mem > kernel_->local_mem_size()) {
+    limit = min<size_t>(limit,
+        (device->max_local_mem - kernel_->local_mem_size()) / type_size);
+  }
+  local_size_ = PowerOfTwoBelow(limit);
+
+  // Enough work groups to keep every compute unit busy while waiting on
+  // memory. More would only add partial results.
+  const size_t groups_per_unit = device->is_gpu() ? 8 : 2;
+  max_groups_ = max<size_t>(1, device->num_compute_units * groups_per_unit);
+
+  partials_ = ctx_->CreateBuffer(Buffer::READ_WRITE, max_groups_ * type_size);
+  result_ = ctx_->CreateBuffer(Buffer::READ_WRITE, type_size);
+  return partials_ != NULL && result_ != NULL;
+}
+
+bool ReduceKernel::Enqueue(CommandQueue* queue, Buffer* input, size_t n,
+    size_t groups, Buffer* output) {
+  const cl_ulong count = n;
+  if (!kernel_->SetArg(0, input) ||
+      !kernel_->SetArg(1, count) ||
+      !kernel_->SetLocalArg(2, local_size_ * type_size_) ||
+      !kernel_->SetArg(3, output)) {
+    return false;
+  }
+  NDRange range(groups * local_size_);
+  range.set_local(local_size_);
+  return queue->EnqueueKernel(kernel_, range, EventList(), NULL, "Reduce");
+}
+
+bool ReduceKernel::Run(CommandQueue* queue, Buffer* input, size_t n,
+    void* result) {
+  if (queue == NULL) queue = ctx_->default_queue();
+  if (input->size() < n * type_size_) {
+    fprintf(stderr, "Could not reduce: %lu values don't fit the buffer\n",
+        (unsigned long)n);
+    return false;
+  }
+
+  // Work groups that would get less than a few loads per work item aren't
+  // worth their partial result.
+  const size_t per_group = local_size_ * vec_ * 4;
+  const size_t groups = min(max_groups_, max<size_t>(1, (n + per_group - 1) / per_group));
+  if (groups == 1) {
+    if (!Enqueue(queue, input, n, 1, result_)) return false;
+  } else {
+    if (!Enqueue(queue, input, n, groups, partials_) ||
+        !Enqueue(queue, partials_, groups, 1, result_)) {
+      return false;
+    }
+  }
+  return result_->CopyTo(queue, result, type_size_);
+}
@@ -0,0 +1,141 @@
+#ifndef NONG_REDUCE_H
+#define NONG_REDUCE_H
+
+#include "context.h"
+
+// The opencl names of the element types Reduce supports, with their largest
+// and lowest values as opencl source.
+template<typename T> struct ReduceType;
+template<> struct ReduceType<cl_int> {
+  static const char* name() { return "int"; }
+  static const char* max() { return "INT_MAX"; }
+  static const char* lowest() { return "INT_MIN"; }
+};
+template<> struct ReduceType<cl_uint> {
+  static const char* name() { return "uint"; }
+  static const char* max() { return "UINT_MAX"; }
+  static const char* lowest() { return "0"; }
+};
+template<> struct ReduceType<cl_long> {
+  static const char* name() { return "long"; }
+  static const char* max() { return "LONG_MAX"; }
+  static const char* lowest() { return "LONG_MIN"; }
+};
+template<> struct ReduceType<cl_ulong> {
+  static const char* name() { return "ulong"; }
+  static const char* max() { return "ULONG_MAX"; }
+  static const char* lowest() { return "0"; }
+};
+template<> struct ReduceType<cl_float> {
+  static const char* name() { return "float"; }
+  static const char* max() { return "INFINITY"; }
+  static const char* lowest() { return "-INFINITY"; }
+};
+// Needs a device with cl_khr_fp64.
+template<> struct ReduceType<cl_double> {
+  static const char* name() { return "double"; }
+  static const char* max() { return "INFINITY"; }
+  static const char* lowest() { return "-INFINITY"; }
+};
+
+// Reduce ops. An op is the opencl expression combining the values a and b and
+// the identity value of the op. The op must be associative and commutative
+// (the order of the combines is unspecified) and, like the opencl builtins,
+// also work on vectors of T. Custom ops follow the same form, e.g.
+//
+//   struct ReduceProduct {
+//     static const char* op() { return "(a) * (b)"; }
+//     static const char* identity() { return "1"; }
+//   };
+template<typename T> struct ReduceSum {
+  static const char* op() { return "(a) + (b)"; }
+  static const char* identity() { return "0"; }
+};
+template<typename T> struct ReduceMin {
+  static const char* op() { return "min(a, b)"; }
+  static const char* identity() { return ReduceType<T>::max(); }
+};
+template<typename T> struct ReduceMax {
+  static const char* op() { return "max(a, b)"; }
+  static const char* identity() { return ReduceType<T>::lowest(); }
+};
+
+// The type independent part of Reduce, see below.
+class ReduceKernel {
+ public:
+  ~ReduceKernel();
+
+  // Reduces the first n values of input into result (type_size bytes) on
+  // queue. Blocks until the result is on the host.
+  bool Run(CommandQueue* queue, Buffer* input, size_t n, void* result);
+
+  // The launch limits picked for the device.
+  size_t local_size() const { return local_size_; }
+  size_t max_groups() const { return max_groups_; }
+
+ protected:
+  ReduceKernel(Context* ctx);
+
+  // Builds kernels/reduce.cl for the type and op (see ReduceType and
+  // ReduceSum) and sizes the launches for the device.
+  bool Init(const char* type_name, size_t type_size, const char* op,
+      const char* identity);
+
+ private:
+  ReduceKernel(const ReduceKernel&);
+  ReduceKernel& operator=(const ReduceKernel&);
+
+  bool Enqueue(CommandQueue* queue, Buffer* input, size_t n, size_t groups,
+      Buffer* output);
+
+  Context* ctx_; // unowned
+  Kernel* kernel_;
+  size_t type_size_;
+  // Values per load.
+  size_t vec_;
+  size_t local_size_;
+  size_t max_groups_;
+  // The per work group results of the first pass.
+  Buffer* partials_;
+  Buffer* result_;
+};
+
+// Reduces device buffers of T to a single value with Op, e.g. the sum of
+// billions of floats:
+//
+//   Reduce<float>* sum = Reduce<float>::Create(ctx);
+//   float total;
+//   sum->Run(buffer, n, &total);
+//
+// The first pass runs a few work groups per compute unit, each work item
+// combines a strided slice of the input with vector loads and the work group
+// combines those in local memory. A second pass of a single work group
+// combines the per group results. Throughput is bound by reading the input.
+//
+// The kernel arguments are kept in the object, so an object must only be used
+// by one thread at a time.
+template<typename T, typename Op = ReduceSum<T> >
+class Reduce : public ReduceKernel {
+ public:
+  // Returns NULL if the kernel can't be built for the device. The object uses
+  // buffers of ctx and must be deleted before it.
+  static Reduce* Create(Context* ctx) {
+    Reduce* r = new Reduce(ctx);
+    if (!r->Init(ReduceType<T>::name(), sizeof(T), Op::op(), Op::identity())) {
+      delete r;
+      return NULL;
+    }
+    return r;
+  }
+
+  // Reduces input[0, n) into result on queue (by default the context's
+  // queue). For n == 0 the result is the identity of Op.
+  bool Run(Buffer* input, size_t n, T* result, CommandQueue* queue = NULL) {
+    return ReduceKernel::Run(queue, input, n, result);
+  }
+
+ private:
+  explicit Reduce(Context* ctx) : ReduceKernel(ctx) {}
+};
+
+#endif
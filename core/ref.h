@@ -0,0 +1,81 @@
+#ifndef NONG_REF_H
+#define NONG_REF_H
+
+#include "context.h"
+
+// Reference counted handle to an object created by a Context (Buffer, Kernel,
+// Program or CommandQueue). Copies share the object, which is released with
+// Context::Release() when the last handle goes away. Moving a handle does not
+// touch the count. Handles may outlive the context: its objects are deleted
+// with it and the handles then release nothing.
+//
+//   Ref<Buffer> buffer(ctx, ctx->CreateBuffer(Buffer::READ_WRITE, size));
+//   kernel->SetArg(0, buffer.get());
+template <typename T>
+class Ref {
+ public:
+  Ref() : ctx_(NULL), obj_(NULL), count_(NULL) {}
+
+  // Takes ownership of obj, which was created by ctx. obj may be NULL. If ctx
+  // is NULL, the handle only points to obj and never releases it.
+  Ref(Context* ctx, T* obj)
+    : ctx_(ctx), ctx_alive_(ctx == NULL ? NULL : ctx->alive()), obj_(obj),
+      count_(obj == NULL || ctx == NULL ? NULL : new std::atomic<int>(1)) {
+  }
+
+  Ref(const Ref& other)
+    : ctx_(other.ctx_), ctx_alive_(other.ctx_alive_), obj_(other.obj_),
+      count_(other.count_) {
+    if (count_ != NULL) ++*count_;
+  }
+
+  Ref(Ref&& other)
+    : ctx_(other.ctx_), ctx_alive_(std::move(other.ctx_alive_)),
+      obj_(other.obj_), count_(other.count_) {
+    other.ctx_ = NULL;
+    other.obj_ = NULL;
+    other.count_ = NULL;
+  }
+
+  Ref& operator=(Ref other) {
+    std::swap(ctx_, other.ctx_);
+    std::swap(ctx_alive_, other.ctx_alive_);
+    std::swap(obj_, other.obj_);
+    std::swap(count_, other.count_);
+    return *this;
+  }
+
+  ~Ref() { Reset(); }
+
+  // Drops this handle's reference.
+  void Reset() {
+    if (count_ != NULL && --*count_ == 0) {
+      if (*ctx_alive_) ctx_->Release(obj_);
+      delete count_;
+    }
+    ctx_ = NULL;
+    ctx_alive_.reset();
+    obj_ = NULL;
+    count_ = NULL;
+  }
+
+  T* get() const { return obj_; }
+  T* operator->() const { return obj_; }
+  T& operator*() const { return *obj_; }
+  explicit operator bool() const { return obj_ != NULL; }
+
+  int use_count() const { return count_ == NULL ? 0 : count_->load(); }
+
+ private:
+  Context* ctx_;
+  std::shared_ptr<const std::atomic<bool> > ctx_alive_;
+  T* obj_;
+  std::atomic<int>* count_;
+};
+
+template <typename T>
+Ref<T> MakeRef(Context* ctx, T* obj) {
+  return Ref<T>(ctx, obj);
+}
+
+#endif
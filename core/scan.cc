@@ -0,0 +1,176 @@
+#include "scan.h"
+#include "util.h"
+
+using namespace std;
+
+// Larger work groups only make the in-group scan deeper.
+static const size_t kMaxLocalSize = 256;
+// Values scanned serially by each work item of scan_tiles.
+static const size_t kItemsPerWorkItem = 8;
+
+ScanKernel::ScanKernel(Context* ctx)
+  : ctx_(ctx), reduce_kernel_(NULL), tiles_kernel_(NULL), type_size_(0),
+    local_size_(0), items_(0) {
+}
+
+ScanKernel::~ScanKernel() {
+  if (reduce_kernel_ != NULL) ctx_->Release(reduce_kernel_);
+  if (tiles_kernel_ != NULL) ctx_->Release(tiles_kernel_);
+  for (size_t i = 0; i < tile_sums_.size(); ++i) {
+    if (tile_sums_[i] != NULL) ctx_->Release(tile_sums_[i]);
+  }
+}
+
+bool ScanKernel::Init(const char* type_name, size_t type_size) {
+  const DeviceInfo* device = ctx_->device();
+  items_ = kItemsPerWorkItem;
+
+  Program::BuildOptions options;
+  options.defines["T"] = type_name;
+  options.defines["ITEMS"] = to_string(items_);
+  reduce_kernel_ = ctx_->CreateKernel("kernels/scan.cl", "scan_reduce", options);
+  tiles_kernel_ = ctx_->CreateKernel("kernels/scan.cl", "scan_tiles", options);
+  if (reduce_kernel_ == NULL || tiles_kernel_ == NULL) return false;
+  type_size_ = type_size;
+
+  // A tile and the work item sums must fit the local memory.
+  size_t limit = min(min(reduce_kernel_->max_work_group_size(),
+      tiles_kernel_->max_work_group_size()), device->max_work_group_size);
+  local_size_ = PowerOfTwoBelow(min(limit, kMaxLocalSize));
+  const cl_ulong kernel_mem = tiles_kernel_->local_mem_size();
+  while (local_size_ > 1 &&
+      kernel_mem + (items_ + 1) * local_size_ * type_size > device->max_local_mem) {
+    local_size_ /= 2;
+  }
+  return true;
+}
+
+bool ScanKernel::ScanLevel(CommandQueue* queue, Buffer* input, size_t n,
+    Buffer* output, bool inclusive, size_t level) {
+  const size_t tiles = (n + tile_size() - 1) / tile_size();
+  const cl_ulong count = n;
+  NDRange range(tiles * local_size_);
+  range.set_local(local_size_);
+
+  Buffer* offsets = NULL;
+  if (tiles > 1) {
+    if (tile_sums_.size() <= level) tile_sums_.resize(level + 1, NULL);
+    if (tile_sums_[level] == NULL ||
+        tile_sums_[level]->size() < tiles * type_size_) {
+      ctx_->Release(tile_sums_[level]);
+      tile_sums_[level] = ctx_->CreateBuffer(Buffer::READ_WRITE, tiles * type_size_);
+      if (tile_sums_[level] == NULL) return false;
+    }
+    // Not a reference: the recursion below may grow tile_sums_.
+    Buffer* sums = tile_sums_[level];
+    if (!reduce_kernel_->SetArg(0, input) ||
+        !reduce_kernel_->SetArg(1, count) ||
+        !reduce_kernel_->SetLocalArg(2, local_size_ * type_size_) ||
+        !reduce_kernel_->SetArg(3, sums) ||
+        !queue->EnqueueKernel(reduce_kernel_, range, EventList(), NULL, "ScanReduce")) {
+      return false;
+    }
+    // The tile sums become the exclusive prefix sums of the tiles.
+    if (!ScanLevel(queue, sums, tiles, sums, false, level + 1)) return false;
+    offsets = sums;
+  }
+
+  // Without offsets the argument is unused but must still be a buffer.
+  return tiles_kernel_->SetArg(0, input) &&
+      tiles_kernel_->SetArg(1, count) &&
+      tiles_kernel_->SetLocalArg(2, (items_ + 1) * local_size_ * type_size_) &&
+      tiles_kernel_->SetArg(3, offsets != NULL ? offsets : input) &&
+      tiles_kernel_->SetArg(4, (cl_uint)(offsets != NULL)) &&
+      tiles_kernel_->SetArg(5, (cl_uint)inclusive) &&
+      tiles_kernel_->SetArg(6, output) &&
+      queue->EnqueueKernel(tiles_kernel_, range, EventList(), NULL, "ScanTiles");
+}
+
+bool ScanKernel::Run(CommandQueue* queue, Buffer* input, size_t n,
+    Buffer* output, bool inclusive) {
+  if (queue == NULL) queue = ctx_->default_queue();
+  if (input->size() < n * type_size_ || output->size() < n * type_size_) {
+    fprintf(stderr, "Could not scan: %lu values don't fit the buffers\n",
+        (unsigned long)n);
+    return false;
+  }
+  if (n == 0) return true;
+  return ScanLevel(queue, input, n, output, inclusive, 0);
+}
+
+CompactKernel::CompactKernel(Context* ctx)
+  : ctx_(ctx), flags_kernel_(NULL), scatter_kernel_(NULL), scan_(NULL),
+    type_size_(0), local_size_(0), positions_(NULL), count_(NULL) {
+}
+
+CompactKernel::~CompactKernel() {
+  if (flags_kernel_ != NULL) ctx_->Release(flags_kernel_);
+  if (scatter_kernel_ != NULL) ctx_->Release(scatter_kernel_);
+  if (positions_ != NULL) ctx_->Release(positions_);
+  if (count_ != NULL) ctx_->Release(count_);
+  delete scan_;
+}
+
+bool CompactKernel::Init(const char* type_name, size_t type_size,
+    const char* pred) {
+  Program::BuildOptions options;
+  options.defines["T"] = type_name;
+  options.defines["PRED(x)"] = string("(") + pred + ")";
+  flags_kernel_ = ctx_->CreateKernel("kernels/compact.cl", "compact_flags", options);
+  scatter_kernel_ = ctx_->CreateKernel("kernels/compact.cl", "compact_scatter", options);
+  if (flags_kernel_ == NULL || scatter_kernel_ == NULL) return false;
+  type_size_ = type_size;
+  local_size_ = PowerOfTwoBelow(min(min(flags_kernel_->max_work_group_size(),
+      scatter_kernel_->max_work_group_size()), kMaxLocalSize));
+
+  scan_ = Scan<cl_uint>::Create(ctx_);
+  count_ = ctx_->CreateBuffer(Buffer::READ_WRITE, sizeof(cl_uint));
+  return scan_ != NULL && count_ != NULL;
+}
+
+bool CompactKernel::Run(CommandQueue* queue, Buffer* input, size_t n,
+    Buffer* output, bool partition, size_t* count) {
+  if (queue == NULL) queue = ctx_->default_queue();
+  if (n > 0xffffffffu) {
+    fprintf(stderr, "Could not compact: %lu values don't have 32 bit positions\n",
+        (unsigned long)n);
+    return false;
+  }
+  if (input->size() < n * type_size_ || output->size() < n * type_size_) {
+    fprintf(stderr, "Could not compact: %lu values don't fit the buffers\n",
+        (unsigned long)n);
+    return false;
+  }
+  *count = 0;
+  if (n == 0) return true;
+
+  if (positions_ == NULL || positions_->size() < n * sizeof(cl_uint)) {
+    if (positions_ != NULL) ctx_->Release(positions_);
+    positions_ = ctx_->CreateBuffer(Buffer::READ_WRITE, n * sizeof(cl_uint));
+    if (positions_ == NULL) return false;
+  }
+
+  const cl_ulong num_values = n;
+  NDRange range((n + local_size_ - 1) / local_size_ * local_size_);
+  range.set_local(local_size_);
+  if (!flags_kernel_->SetArg(0, input) ||
+      !flags_kernel_->SetArg(1, num_values) ||
+      !flags_kernel_->SetArg(2, positions_) ||
+      !queue->EnqueueKernel(flags_kernel_, range, EventList(), NULL, "CompactFlags") ||
+      !scan_->Run(positions_, n, positions_, false, queue)) {
+    return false;
+  }
+  if (!scatter_kernel_->SetArg(0, input) ||
+      !scatter_kernel_->SetArg(1, num_values) ||
+      !scatter_kernel_->SetArg(2, positions_) ||
+      !scatter_kernel_->SetArg(3, (cl_uint)partition) ||
+      !scatter_kernel_->SetArg(4, output) ||
+      !scatter_kernel_->SetArg(5, count_) ||
+      !queue->EnqueueKernel(scatter_kernel_, range, EventList(), NULL, "CompactScatter")) {
+    return false;
+  }
+  cl_uint c = 0;
+  if (!count_->CopyTo(queue, &c, sizeof(c))) return false;
+  *count = c;
+  return true;
+}
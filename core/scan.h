@@ -0,0 +1,159 @@
+#ifndef NONG_SCAN_H
+#define NONG_SCAN_H
+
+#include "context.h"
+#include "reduce.h"
+
+// The type independent part of Scan, see below.
+class ScanKernel {
+ public:
+  ~ScanKernel();
+
+  // Enqueues the prefix sums of input[0, n) into output on queue.
+  bool Run(CommandQueue* queue, Buffer* input, size_t n, Buffer* output,
+      bool inclusive);
+
+  // Work items per work group and values per work group.
+  size_t local_size() const { return local_size_; }
+  size_t tile_size() const { return local_size_ * items_; }
+
+ protected:
+  explicit ScanKernel(Context* ctx);
+
+  // Builds kernels/scan.cl for the type (see ReduceType) and sizes the tiles
+  // for the device.
+  bool Init(const char* type_name, size_t type_size);
+
+ private:
+  ScanKernel(const ScanKernel&);
+  ScanKernel& operator=(const ScanKernel&);
+
+  // Scans input into output, using the tile sums buffers from level on.
+  bool ScanLevel(CommandQueue* queue, Buffer* input, size_t n, Buffer* output,
+      bool inclusive, size_t level);
+
+  Context* ctx_; // unowned
+  Kernel* reduce_kernel_;
+  Kernel* tiles_kernel_;
+  size_t type_size_;
+  size_t local_size_;
+  // Values per work item.
+  size_t items_;
+  // The sums of the tiles of each level of the scan, grown as needed.
+  std::vector<Buffer*> tile_sums_;
+};
+
+// Device wide prefix sums of T (cl_int, cl_uint, cl_long, cl_ulong, cl_float
+// or cl_double).
+//
+// Each work group scans a tile of tile_size() values in local memory. Tiles
+// are first reduced to their sums, the sums are scanned the same way (a
+// single work group for up to tile_size() tiles) and then every tile is
+// scanned starting from its scanned sum. That reads the input twice and
+// writes the output once.
+//
+// Like Reduce, an object must only be used by one thread at a time.
+template<typename T>
+class Scan : public ScanKernel {
+ public:
+  // Returns NULL if the kernels can't be built for the device. The object
+  // uses buffers of ctx and must be deleted before it.
+  static Scan* Create(Context* ctx) {
+    Scan* s = new Scan(ctx);
+    if (!s->Init(ReduceType<T>::name(), sizeof(T))) {
+      delete s;
+      return NULL;
+    }
+    return s;
+  }
+
+  // Enqueues output[i] = input[0] + ... + input[i] (inclusive) or
+  // input[0] + ... + input[i - 1] (exclusive) for i in [0, n) on queue (by
+  // default the context's queue) and returns without waiting. output may be
+  // input.
+  bool Run(Buffer* input, size_t n, Buffer* output, bool inclusive = true,
+      CommandQueue* queue = NULL) {
+    return ScanKernel::Run(queue, input, n, output, inclusive);
+  }
+
+ private:
+  explicit Scan(Context* ctx) : ScanKernel(ctx) {}
+};
+
+// The type independent part of Compact, see below.
+class CompactKernel {
+ public:
+  ~CompactKernel();
+
+  // Moves the values of input[0, n) that pass the predicate to the front of
+  // output and, if partition is set, the others after them. Blocks until
+  // count is on the host.
+  bool Run(CommandQueue* queue, Buffer* input, size_t n, Buffer* output,
+      bool partition, size_t* count);
+
+ protected:
+  explicit CompactKernel(Context* ctx);
+
+  // Builds kernels/compact.cl for the type and predicate.
+  bool Init(const char* type_name, size_t type_size, const char* pred);
+
+ private:
+  CompactKernel(const CompactKernel&);
+  CompactKernel& operator=(const CompactKernel&);
+
+  Context* ctx_; // unowned
+  Kernel* flags_kernel_;
+  Kernel* scatter_kernel_;
+  Scan<cl_uint>* scan_;
+  size_t type_size_;
+  size_t local_size_;
+  // The flags and, scanned in place, the output positions of the values.
+  Buffer* positions_;
+  Buffer* count_;
+};
+
+// Stream compaction and stable partition of T by Pred, the opencl expression
+// of a value x that is true for the values to keep, e.g.
+//
+//   struct Positive {
+//     static const char* pred() { return "(x) > 0"; }
+//   };
+//   Compact<cl_float, Positive>* compact = Compact<cl_float, Positive>::Create(ctx);
+//   size_t count;
+//   compact->Run(input, n, output, &count);
+//
+// The values are flagged with Pred, the flags are scanned into output
+// positions and the values are scattered to them. n must be less than 2^32.
+template<typename T, typename Pred>
+class Compact : public CompactKernel {
+ public:
+  // Returns NULL if the kernels can't be built for the device. The object
+  // uses buffers of ctx and must be deleted before it.
+  static Compact* Create(Context* ctx) {
+    Compact* c = new Compact(ctx);
+    if (!c->Init(ReduceType<T>::name(), sizeof(T), Pred::pred())) {
+      delete c;
+      return NULL;
+    }
+    return c;
+  }
+
+  // Writes the values of input[0, n) that pass Pred to output[0, count) in
+  // their order. Blocks until count is on the host.
+  bool Run(Buffer* input, size_t n, Buffer* output, size_t* count,
+      CommandQueue* queue = NULL) {
+    return CompactKernel::Run(queue, input, n, output, false, count);
+  }
+
+  // Like Run() but the values that don't pass Pred follow in their order, so
+  // output is a stable partition of input.
+  bool Partition(Buffer* input, size_t n, Buffer* output, size_t* count,
+      CommandQueue* queue = NULL) {
+    return CompactKernel::Run(queue, input, n, output, true, count);
+  }
+
+ private:
+  explicit Compact(Context* ctx) : CompactKernel(ctx) {}
+};
+
+#endif
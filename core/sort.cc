@@ -0,0 +1,300 @@
+#include "sort.h"
+#include "util.h"
+
+using namespace std;
+
+// Bitonic tiles larger than this need more local memory than most devices
+// have for 64 bit keys and values.
+static const size_t kMaxLocalSize = 256;
+// Outputs merged by each work item of a merge pass. The binary search that
+// finds the start of each work item is paid once per this many outputs.
+static const size_t kMergeItems = 32;
+
+// Bits of the key sorted by each radix sort pass, also in radix_sort.cl.
+static const int kRadixBits = 8;
+// Keys counted and scattered by each work item of a radix sort pass at least,
+// fewer blocks keep the digit counts small.
+static const size_t kMinRadixChunk = 1024;
+
+bool SortBackend::CheckArgs(const SortTypes& types, Buffer* keys,
+    Buffer* values, size_t n) {
+  const bool has_values = types.value_name != NULL;
+  if ((values != NULL) != has_values) {
+    fprintf(stderr, "Could not sort: the sorter was created %s values\n",
+        has_values ? "with" : "without");
+    return false;
+  }
+  if (keys->size() < n * types.key_size ||
+      (has_values && values->size() < n * types.value_size)) {
+    fprintf(stderr, "Could not sort: %lu values don't fit the buffers\n",
+        (unsigned long)n);
+    return false;
+  }
+  return true;
+}
+
+SortAlgorithm PickSortAlgorithm(const DeviceInfo* device,
+    const SortTypes& types, size_t n) {
+  // Radix sort runs at most a few work items per compute unit, each walking
+  // 1024 keys or more, and its positions are 32 bit.
+  if (!device->is_cpu() || n > 0xffffffffu) return SORT_BITONIC;
+  const size_t radix_min = types.key_size > 4 ? 1 << 20 : 1 << 16;
+  return n >= radix_min ? SORT_RADIX : SORT_BITONIC;
+}
+
+BitonicSorter::BitonicSorter(Context* ctx, const SortTypes& types)
+  : ctx_(ctx), types_(types), tiles_kernel_(NULL), merge_kernel_(NULL),
+    local_size_(0), merge_local_size_(0), temp_keys_(NULL),
+    temp_values_(NULL) {
+}
+
+BitonicSorter::~BitonicSorter() {
+  if (tiles_kernel_ != NULL) ctx_->Release(tiles_kernel_);
+  if (merge_kernel_ != NULL) ctx_->Release(merge_kernel_);
+  if (temp_keys_ != NULL) ctx_->Release(temp_keys_);
+  if (temp_values_ != NULL) ctx_->Release(temp_values_);
+}
+
+BitonicSorter* BitonicSorter::Create(Context* ctx, const SortTypes& types) {
+  Program::BuildOptions options;
+  options.defines["K"] = types.key_name;
+  options.defines["KEY_MAX"] = types.key_max;
+  options.defines["KEY_LOWEST"] = types.key_lowest;
+  options.defines["MERGE_ITEMS"] = to_string(kMergeItems);
+  if (types.value_name != NULL) options.defines["V"] = types.value_name;
+
+  BitonicSorter* sorter = new BitonicSorter(ctx, types);
+  sorter->tiles_kernel_ = ctx->CreateKernel("kernels/sort.cl", "sort_tiles", options);
+  sorter->merge_kernel_ = ctx->CreateKernel("kernels/sort.cl", "merge_runs", options);
+  if (sorter->tiles_kernel_ == NULL || sorter->merge_kernel_ == NULL) {
+    delete sorter;
+    return NULL;
+  }
+
+  // Two keys (and their indices) per work item must fit the local memory.
+  const DeviceInfo* device = ctx->device();
+  const size_t bytes_per_item =
+      2 * (types.key_size + (types.value_name != NULL ? sizeof(cl_uint) : 0));
+  sorter->local_size_ = PowerOfTwoBelow(min(min(
+      sorter->tiles_kernel_->max_work_group_size(), device->max_work_group_size),
+      kMaxLocalSize));
+  while (sorter->local_size_ > 1 && sorter->tiles_kernel_->local_mem_size() +
+      sorter->local_size_ * bytes_per_item > device->max_local_mem) {
+    sorter->local_size_ /= 2;
+  }
+  sorter->merge_local_size_ = PowerOfTwoBelow(min(
+      sorter->merge_kernel_->max_work_group_size(), kMaxLocalSize));
+  return sorter;
+}
+
+bool BitonicSorter::Enqueue(CommandQueue* queue, Kernel* kernel,
+    const NDRange& range, Buffer* in_keys, Buffer* in_values, Buffer* out_keys,
+    Buffer* out_values, const char* name) {
+  // Without values the value arguments are unused but must be buffers.
+  return kernel->SetArg(0, in_keys) &&
+      kernel->SetArg(1, in_values != NULL ? in_values : in_keys) &&
+      kernel->SetArg(2, out_keys) &&
+      kernel->SetArg(3, out_values != NULL ? out_values : out_keys) &&
+      queue->EnqueueKernel(kernel, range, EventList(), NULL, name);
+}
+
+bool BitonicSorter::Run(CommandQueue* queue, Buffer* keys, Buffer* values,
+    size_t n, bool descending) {
+  if (queue == NULL) queue = ctx_->default_queue();
+  if (!CheckArgs(types_, keys, values, n)) return false;
+  if (n == 0) return true;
+
+  const bool has_values = types_.value_name != NULL;
+  const size_t tile = tile_size();
+  int passes = 0;
+  for (size_t width = tile; width < n; width *= 2) ++passes;
+  if (passes > 0) {
+    if (temp_keys_ == NULL || temp_keys_->size() < n * types_.key_size) {
+      if (temp_keys_ != NULL) ctx_->Release(temp_keys_);
+      temp_keys_ = ctx_->CreateBuffer(Buffer::READ_WRITE, n * types_.key_size);
+      if (temp_keys_ == NULL) return false;
+    }
+    if (has_values &&
+        (temp_values_ == NULL || temp_values_->size() < n * types_.value_size)) {
+      if (temp_values_ != NULL) ctx_->Release(temp_values_);
+      temp_values_ = ctx_->CreateBuffer(Buffer::READ_WRITE, n * types_.value_size);
+      if (temp_values_ == NULL) return false;
+    }
+  }
+
+  // The passes alternate between the buffers and the temporary buffers,
+  // starting such that the last pass writes to keys and values.
+  Buffer* sorted_keys = passes % 2 ? temp_keys_ : keys;
+  Buffer* sorted_values = has_values ? (passes % 2 ? temp_values_ : values) : NULL;
+
+  const cl_ulong count = n;
+  const cl_uint desc = descending;
+  NDRange tiles_range((n + tile - 1) / tile * local_size_);
+  tiles_range.set_local(local_size_);
+  if (!tiles_kernel_->SetArg(4, count) ||
+      !tiles_kernel_->SetArg(5, desc) ||
+      !tiles_kernel_->SetLocalArg(6, tile * types_.key_size) ||
+      !tiles_kernel_->SetLocalArg(7, has_values ? tile * sizeof(cl_uint) : 1) ||
+      !Enqueue(queue, tiles_kernel_, tiles_range, keys, values, sorted_keys,
+          sorted_values, "SortTiles")) {
+    return false;
+  }
+
+  const size_t merge_items = (n + kMergeItems - 1) / kMergeItems;
+  NDRange merge_range((merge_items + merge_local_size_ - 1) /
+      merge_local_size_ * merge_local_size_);
+  merge_range.set_local(merge_local_size_);
+  if (!merge_kernel_->SetArg(4, count) ||
+      !merge_kernel_->SetArg(6, desc)) {
+    return false;
+  }
+  for (size_t width = tile; width < n; width *= 2) {
+    Buffer* out_keys = sorted_keys == keys ? temp_keys_ : keys;
+    Buffer* out_values =
+        has_values ? (sorted_values == values ? temp_values_ : values) : NULL;
+    const cl_ulong run = width;
+    if (!merge_kernel_->SetArg(5, run) ||
+        !Enqueue(queue, merge_kernel_, merge_range, sorted_keys, sorted_values,
+            out_keys, out_values, "MergeRuns")) {
+      return false;
+    }
+    sorted_keys = out_keys;
+    sorted_values = out_values;
+  }
+  return true;
+}
+
+RadixSorter::RadixSorter(Context* ctx, const SortTypes& types)
+  : ctx_(ctx), types_(types), count_kernel_(NULL), scatter_kernel_(NULL),
+    scan_(NULL), local_size_(0), max_groups_(0), counts_(NULL),
+    temp_keys_(NULL), temp_values_(NULL) {
+}
+
+RadixSorter::~RadixSorter() {
+  if (count_kernel_ != NULL) ctx_->Release(count_kernel_);
+  if (scatter_kernel_ != NULL) ctx_->Release(scatter_kernel_);
+  if (counts_ != NULL) ctx_->Release(counts_);
+  if (temp_keys_ != NULL) ctx_->Release(temp_keys_);
+  if (temp_values_ != NULL) ctx_->Release(temp_values_);
+  delete scan_;
+}
+
+RadixSorter* RadixSorter::Create(Context* ctx, const SortTypes& types) {
+  Program::BuildOptions options;
+  options.defines["K"] = types.key_name;
+  options.defines["KEY_BITS"] = to_string(types.key_size * 8);
+  options.defines["RADIX_BITS"] = to_string(kRadixBits);
+  if (types.key_float) {
+    options.defines["KEY_FLOAT"] = "1";
+  } else if (types.key_signed) {
+    options.defines["KEY_SIGNED"] = "1";
+  }
+  if (types.value_name != NULL) options.defines["V"] = types.value_name;
+
+  RadixSorter* sorter = new RadixSorter(ctx, types);
+  sorter->count_kernel_ =
+      ctx->CreateKernel("kernels/radix_sort.cl", "radix_count", options);
+  sorter->scatter_kernel_ =
+      ctx->CreateKernel("kernels/radix_sort.cl", "radix_scatter", options);
+  sorter->scan_ = Scan<cl_uint>::Create(ctx);
+  if (sorter->count_kernel_ == NULL || sorter->scatter_kernel_ == NULL ||
+      sorter->scan_ == NULL) {
+    delete sorter;
+    return NULL;
+  }
+
+  // Each work item keeps a count per digit in local memory. Blocks only need
+  // to be spread over the compute units, so work groups stay small.
+  const DeviceInfo* device = ctx->device();
+  const size_t hist_bytes = (1 << kRadixBits) * sizeof(cl_uint);
+  const cl_ulong kernel_mem = max(sorter->count_kernel_->local_mem_size(),
+      sorter->scatter_kernel_->local_mem_size());
+  sorter->local_size_ = PowerOfTwoBelow(min(min(min(
+      sorter->count_kernel_->max_work_group_size(),
+      sorter->scatter_kernel_->max_work_group_size()),
+      device->max_work_group_size), (size_t)64));
+  while (sorter->local_size_ > 1 &&
+      kernel_mem + sorter->local_size_ * hist_bytes > device->max_local_mem) {
+    sorter->local_size_ /= 2;
+  }
+  sorter->max_groups_ = max(1, device->num_compute_units * 4);
+  sorter->counts_ = ctx->CreateBuffer(Buffer::READ_WRITE,
+      sorter->max_groups_ * sorter->local_size_ * hist_bytes);
+  if (sorter->counts_ == NULL) {
+    delete sorter;
+    return NULL;
+  }
+  return sorter;
+}
+
+bool RadixSorter::Run(CommandQueue* queue, Buffer* keys, Buffer* values,
+    size_t n, bool descending) {
+  if (queue == NULL) queue = ctx_->default_queue();
+  if (!CheckArgs(types_, keys, values, n)) return false;
+  if (n > 0xffffffffu) {
+    fprintf(stderr, "Could not radix sort: %lu keys don't have 32 bit positions\n",
+        (unsigned long)n);
+    return false;
+  }
+  if (n == 0) return true;
+
+  const bool has_values = types_.value_name != NULL;
+  if (temp_keys_ == NULL || temp_keys_->size() < n * types_.key_size) {
+    if (temp_keys_ != NULL) ctx_->Release(temp_keys_);
+    temp_keys_ = ctx_->CreateBuffer(Buffer::READ_WRITE, n * types_.key_size);
+    if (temp_keys_ == NULL) return false;
+  }
+  if (has_values &&
+      (temp_values_ == NULL || temp_values_->size() < n * types_.value_size)) {
+    if (temp_values_ != NULL) ctx_->Release(temp_values_);
+    temp_values_ = ctx_->CreateBuffer(Buffer::READ_WRITE, n * types_.value_size);
+    if (temp_values_ == NULL) return false;
+  }
+
+  const size_t groups = max<size_t>(1, min(max_groups_,
+      n / (local_size_ * kMinRadixChunk)));
+  const size_t blocks = groups * local_size_;
+  const size_t num_counts = blocks << kRadixBits;
+  const cl_ulong count = n;
+  const cl_ulong chunk = (n + blocks - 1) / blocks;
+  const cl_uint desc = descending;
+  const size_t hist_bytes = local_size_ * (1 << kRadixBits) * sizeof(cl_uint);
+  NDRange range(blocks);
+  range.set_local(local_size_);
+
+  // An even number of passes, so the last one writes to keys and values.
+  Buffer* in_keys = keys;
+  Buffer* in_values = has_values ? values : keys;
+  Buffer* out_keys = temp_keys_;
+  Buffer* out_values = has_values ? temp_values_ : temp_keys_;
+  for (cl_uint shift = 0; shift < types_.key_size * 8; shift += kRadixBits) {
+    if (!count_kernel_->SetArg(0, in_keys) ||
+        !count_kernel_->SetArg(1, count) ||
+        !count_kernel_->SetArg(2, chunk) ||
+        !count_kernel_->SetArg(3, shift) ||
+        !count_kernel_->SetArg(4, desc) ||
+        !count_kernel_->SetLocalArg(5, hist_bytes) ||
+        !count_kernel_->SetArg(6, counts_) ||
+        !queue->EnqueueKernel(count_kernel_, range, EventList(), NULL, "RadixCount") ||
+        !scan_->Run(counts_, num_counts, counts_, false, queue)) {
+      return false;
+    }
+    // Without values the value arguments are unused but must be buffers.
+    if (!scatter_kernel_->SetArg(0, in_keys) ||
+        !scatter_kernel_->SetArg(1, in_values) ||
+        !scatter_kernel_->SetArg(2, out_keys) ||
+        !scatter_kernel_->SetArg(3, out_values) ||
+        !scatter_kernel_->SetArg(4, count) ||
+        !scatter_kernel_->SetArg(5, chunk) ||
+        !scatter_kernel_->SetArg(6, shift) ||
+        !scatter_kernel_->SetArg(7, desc) ||
+        !scatter_kernel_->SetLocalArg(8, hist_bytes) ||
+        !scatter_kernel_->SetArg(9, counts_) ||
+        !queue->EnqueueKernel(scatter_kernel_, range, EventList(), NULL, "RadixScatter")) {
+      return false;
+    }
+    swap(in_keys, out_keys);
+    swap(in_values, out_values);
+  }
+  return true;
+}
@@ -0,0 +1,221 @@
+#ifndef NONG_SORT_H
+#define NONG_SORT_H
+
+#include <limits>
+
+#include "context.h"
+#include "reduce.h"
+#include "scan.h"
+
+// The key and value types of a sort, for the type independent sorters. Keys
+// and values are ReduceType types.
+struct SortTypes {
+  const char* key_name;
+  size_t key_size;
+  const char* key_max;
+  const char* key_lowest;
+  bool key_signed;
+  bool key_float;
+  // NULL and 0 for sorts without values.
+  const char* value_name;
+  size_t value_size;
+
+  template<typename K, typename V> static SortTypes Of();
+};
+
+template<typename V> struct SortValue {
+  static const char* name() { return ReduceType<V>::name(); }
+  static size_t size() { return sizeof(V); }
+};
+template<> struct SortValue<void> {
+  static const char* name() { return NULL; }
+  static size_t size() { return 0; }
+};
+
+template<typename K, typename V> SortTypes SortTypes::Of() {
+  SortTypes types;
+  types.key_name = ReduceType<K>::name();
+  types.key_size = sizeof(K);
+  types.key_max = ReduceType<K>::max();
+  types.key_lowest = ReduceType<K>::lowest();
+  types.key_signed = std::numeric_limits<K>::is_signed;
+  types.key_float = !std::numeric_limits<K>::is_integer;
+  types.value_name = SortValue<V>::name();
+  types.value_size = SortValue<V>::size();
+  return types;
+}
+
+// A sort algorithm of Sorter, for keys and values described by SortTypes.
+class SortBackend {
+ public:
+  virtual ~SortBackend() {}
+
+  // Enqueues the sort of keys[0, n) and, for sorts with values, values[0, n)
+  // along with them. values must be NULL for sorts without values.
+  virtual bool Run(CommandQueue* queue, Buffer* keys, Buffer* values, size_t n,
+      bool descending) = 0;
+
+ protected:
+  // Returns false if the buffers don't match types or don't hold n keys.
+  static bool CheckArgs(const SortTypes& types, Buffer* keys, Buffer* values,
+      size_t n);
+};
+
+// Sorts with kernels/sort.cl: every tile of tile_size() keys is sorted by a
+// bitonic network in local memory in a single launch, then passes of merge
+// path merges combine the sorted tiles, each reading and writing the keys
+// once. That is 1 + log2(n / tile_size()) launches instead of the
+// O(log2(n)^2) launches of a global bitonic sort. Any n works, the last tile
+// is padded in local memory.
+class BitonicSorter : public SortBackend {
+ public:
+  // Returns NULL if the kernels can't be built for the device.
+  static BitonicSorter* Create(Context* ctx, const SortTypes& types);
+  ~BitonicSorter();
+
+  bool Run(CommandQueue* queue, Buffer* keys, Buffer* values, size_t n,
+      bool descending);
+
+  size_t tile_size() const { return 2 * local_size_; }
+
+ private:
+  BitonicSorter(Context* ctx, const SortTypes& types);
+  BitonicSorter(const BitonicSorter&);
+  BitonicSorter& operator=(const BitonicSorter&);
+
+  // Enqueues kernel from in to out. values may be NULL.
+  bool Enqueue(CommandQueue* queue, Kernel* kernel, const NDRange& range,
+      Buffer* in_keys, Buffer* in_values, Buffer* out_keys, Buffer* out_values,
+      const char* name);
+
+  Context* ctx_; // unowned
+  const SortTypes types_;
+  Kernel* tiles_kernel_;
+  Kernel* merge_kernel_;
+  size_t local_size_;
+  size_t merge_local_size_;
+  // The other side of the merge passes, grown as needed.
+  Buffer* temp_keys_;
+  Buffer* temp_values_;
+};
+
+// LSD radix sort with kernels/radix_sort.cl, 8 bits per pass: each pass
+// counts the digits of blocks of keys, scans the counts with Scan into the
+// output position of every digit of every block and scatters the keys there.
+// A pass reads the keys twice and writes them once, independent of n, which
+// beats the O(n log n) merges of BitonicSorter for large sorts. Each block is
+// a work item that runs through its keys in order, which suits cpu devices.
+// n must be less than 2^32.
+class RadixSorter : public SortBackend {
+ public:
+  // Returns NULL if the kernels can't be built for the device.
+  static RadixSorter* Create(Context* ctx, const SortTypes& types);
+  ~RadixSorter();
+
+  bool Run(CommandQueue* queue, Buffer* keys, Buffer* values, size_t n,
+      bool descending);
+
+ private:
+  RadixSorter(Context* ctx, const SortTypes& types);
+  RadixSorter(const RadixSorter&);
+  RadixSorter& operator=(const RadixSorter&);
+
+  Context* ctx_; // unowned
+  const SortTypes types_;
+  Kernel* count_kernel_;
+  Kernel* scatter_kernel_;
+  Scan<cl_uint>* scan_;
+  size_t local_size_;
+  // Work groups of blocks for large sorts.
+  size_t max_groups_;
+  // The digit counts, then positions, of every block.
+  Buffer* counts_;
+  // The other side of the passes, grown as needed.
+  Buffer* temp_keys_;
+  Buffer* temp_values_;
+};
+
+enum SortAlgorithm {
+  SORT_AUTO,
+  SORT_BITONIC,
+  SORT_RADIX,
+};
+
+// Returns the algorithm SORT_AUTO uses for n keys of types on device: radix
+// sort for large sorts on cpu devices, where its fixed number of passes wins,
+// with a higher cut-off for 64 bit keys, which take twice the passes. Other
+// devices always use bitonic sort, since RadixSorter runs too few work items
+// to fill them.
+SortAlgorithm PickSortAlgorithm(const DeviceInfo* device,
+    const SortTypes& types, size_t n);
+
+// Sorts device buffers of keys K (cl_int, cl_uint, cl_long, cl_ulong,
+// cl_float or cl_double), optionally moving values V of the same types along
+// with them, e.g.
+//
+//   Sorter<cl_uint, cl_uint>* sorter = Sorter<cl_uint, cl_uint>::Create(ctx);
+//   sorter->Run(keys, values, n);
+//
+// The algorithm (BitonicSorter or RadixSorter) is picked per call by device,
+// size and key width, see PickSortAlgorithm(). Sorts with values are stable and
+// descending order doesn't need other kernels. Like Reduce, an object must
+// only be used by one thread at a time.
+template<typename K, typename V = void>
+class Sorter {
+ public:
+  // Returns NULL if the kernels can't be built for the device. The object
+  // uses buffers of ctx and must be deleted before it.
+  static Sorter* Create(Context* ctx) {
+    const SortTypes types = SortTypes::Of<K, V>();
+    BitonicSorter* bitonic = BitonicSorter::Create(ctx, types);
+    RadixSorter* radix = RadixSorter::Create(ctx, types);
+    if (bitonic == NULL || radix == NULL) {
+      delete bitonic;
+      delete radix;
+      return NULL;
+    }
+    return new Sorter(ctx->device(), bitonic, radix);
+  }
+  ~Sorter() {
+    delete bitonic_;
+    delete radix_;
+  }
+
+  // Enqueues the sort of keys[0, n) on queue (by default the context's queue)
+  // and returns without waiting. Only for sorters without values.
+  bool Run(Buffer* keys, size_t n, bool descending = false,
+      CommandQueue* queue = NULL) {
+    return Backend(n)->Run(queue, keys, NULL, n, descending);
+  }
+
+  // Same as above but moves values[0, n) along with their keys.
+  bool Run(Buffer* keys, Buffer* values, size_t n, bool descending = false,
+      CommandQueue* queue = NULL) {
+    return Backend(n)->Run(queue, keys, values, n, descending);
+  }
+
+  // Forces an algorithm instead of SORT_AUTO, e.g. to compare them.
+  void set_algorithm(SortAlgorithm algorithm) { algorithm_ = algorithm; }
+
+ private:
+  Sorter(const DeviceInfo* device, BitonicSorter* bitonic, RadixSorter* radix)
+    : device_(device), bitonic_(bitonic), radix_(radix), algorithm_(SORT_AUTO) {}
+  Sorter(const Sorter&);
+  Sorter& operator=(const Sorter&);
+
+  SortBackend* Backend(size_t n) const {
+    SortAlgorithm algorithm = algorithm_;
+    if (algorithm == SORT_AUTO) {
+      algorithm = PickSortAlgorithm(device_, SortTypes::Of<K, V>(), n);
+    }
+    if (algorithm == SORT_RADIX) return radix_;
+    return bitonic_;
+  }
+
+  const DeviceInfo* device_; // unowned
+  BitonicSorter* bitonic_;
+  RadixSorter* radix_;
+  SortAlgorithm algorithm_;
+};
+
+#endif
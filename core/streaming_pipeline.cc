@@ -0,0 +1,121 @@
+#include "streaming_pipeline.h"
+#include "util.h"
+
+using namespace std;
+
+double StreamingPipeline::Stats::gbps() const {
+  if (elapsed_ms == 0) return 0;
+  return bytes / (1024. * 1024. * 1024.) / (elapsed_ms / 1000.);
+}
+
+string StreamingPipeline::Stats::ToString() const {
+  stringstream ss;
+  ss << PrintBytes(bytes) << " in " << chunks << " chunks, "
+     << elapsed_ms << "ms: " << gbps() << " GB/s";
+  return ss.str();
+}
+
+StreamingPipeline::StreamingPipeline(Context* ctx, Kernel* kernel,
+    size_t chunk_size, size_t bytes_per_item)
+  : ctx_(ctx), kernel_(kernel), chunk_size_(chunk_size),
+    bytes_per_item_(bytes_per_item), upload_queue_(NULL), exec_queue_(NULL),
+    download_queue_(NULL) {
+}
+
+StreamingPipeline::~StreamingPipeline() {
+  ctx_->Release(upload_queue_);
+  ctx_->Release(exec_queue_);
+  ctx_->Release(download_queue_);
+  for (size_t i = 0; i < inputs_.size(); ++i) {
+    ctx_->Release(inputs_[i]);
+    ctx_->Release(outputs_[i]);
+  }
+}
+
+StreamingPipeline* StreamingPipeline::Create(Context* ctx, Kernel* kernel,
+    size_t chunk_size, size_t bytes_per_item, int num_buffers) {
+  if (bytes_per_item == 0 || chunk_size % bytes_per_item != 0 || num_buffers < 1) {
+    fprintf(stderr, "Invalid pipeline chunk size.\n");
+    return NULL;
+  }
+  StreamingPipeline* pipeline =
+      new StreamingPipeline(ctx, kernel, chunk_size, bytes_per_item);
+  pipeline->upload_queue_ = ctx->CreateCommandQueue();
+  pipeline->exec_queue_ = ctx->CreateCommandQueue();
+  pipeline->download_queue_ = ctx->CreateCommandQueue();
+  if (pipeline->upload_queue_ == NULL || pipeline->exec_queue_ == NULL ||
+      pipeline->download_queue_ == NULL) {
+    delete pipeline;
+    return NULL;
+  }
+  for (int i = 0; i < num_buffers; ++i) {
+    Buffer* input = ctx->CreateBuffer(Buffer::READ_ONLY, chunk_size);
+    Buffer* output = ctx->CreateBuffer(Buffer::WRITE_ONLY, chunk_size);
+    // Added before checking, so the pipeline releases whichever was created.
+    pipeline->inputs_.push_back(input);
+    pipeline->outputs_.push_back(output);
+    if (input == NULL || output == NULL) {
+      delete pipeline;
+      return NULL;
+    }
+  }
+  return pipeline;
+}
+
+bool StreamingPipeline::Process(const void* input, void* output, size_t len) {
+  if (len % bytes_per_item_ != 0) {
+    fprintf(stderr, "Pipeline input is not a multiple of the item size.\n");
+    return false;
+  }
+
+  const char* src = reinterpret_cast<const char*>(input);
+  char* dst = reinterpret_cast<char*>(output);
+  const size_t num_slots = inputs_.size();
+
+  // Last upload, kernel and download per slot. A slot's input buffer can be
+  // reused once its kernel ran and its output buffer once it was downloaded.
+  vector<Event> uploaded(num_slots);
+  vector<Event> executed(num_slots);
+  EventList downloaded(num_slots);
+
+  double start = timestamp_ms();
+  int chunk = 0;
+  for (size_t offset = 0; offset < len; offset += chunk_size_, ++chunk) {
+    const size_t slot = chunk % num_slots;
+    const size_t chunk_len = std::min(chunk_size_, len - offset);
+
+    EventList wait_for;
+    if (executed[slot].valid()) wait_for.push_back(executed[slot]);
+    if (!inputs_[slot]->CopyFrom(upload_queue_, src + offset, chunk_len,
+        wait_for, &uploaded[slot])) {
+      return false;
+    }
+
+    wait_for.clear();
+    wait_for.push_back(uploaded[slot]);
+    if (downloaded[slot].valid()) wait_for.push_back(downloaded[slot]);
+    kernel_->SetArg(0, inputs_[slot]);
+    kernel_->SetArg(1, outputs_[slot]);
+    if (!exec_queue_->EnqueueKernel(kernel_, chunk_len / bytes_per_item_, -1,
+        wait_for, &executed[slot])) {
+      return false;
+    }
+
+    wait_for.clear();
+    wait_for.push_back(executed[slot]);
+    downloaded[slot] = outputs_[slot]->ReadAsync(
+        download_queue_, dst + offset, chunk_len, wait_for);
+    if (!downloaded[slot].valid()) return false;
+
+    // The queues wait on each other so they all need to be on the device.
+    upload_queue_->Submit();
+    exec_queue_->Submit();
+    download_queue_->Submit();
+  }
+  if (!Event::WaitAll(downloaded)) return false;
+
+  stats_.elapsed_ms += timestamp_ms() - start;
+  stats_.bytes += len;
+  stats_.chunks += chunk;
+  return true;
+}
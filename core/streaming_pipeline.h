@@ -0,0 +1,67 @@
+#ifndef NONG_STREAMING_PIPELINE_H
+#define NONG_STREAMING_PIPELINE_H
+
+#include "context.h"
+
+// Streams host data that can be larger than device memory through a kernel,
+// one chunk at a time. Chunks rotate through a set of staging buffers and use
+// separate queues for upload, execution and download so that the upload of
+// chunk i+1, the kernel on chunk i and the download of chunk i-1 all overlap.
+//
+// The kernel's first two arguments must be the input and output buffers and
+// it must process bytes_per_item bytes of input per work item. The output
+// of a chunk is the same size as its input. Any other kernel arguments must be
+// set by the caller before Process().
+class StreamingPipeline {
+ public:
+  struct Stats {
+    size_t bytes;
+    int chunks;
+    double elapsed_ms;
+
+    Stats() : bytes(0), chunks(0), elapsed_ms(0) {}
+
+    // Sustained throughput of the input stream.
+    double gbps() const;
+    std::string ToString() const;
+  };
+
+  // Creates a pipeline with num_buffers staging buffers of chunk_size bytes.
+  // The buffers and queues are created on ctx and released with the
+  // pipeline, which must be deleted before ctx. chunk_size must be a multiple
+  // of bytes_per_item. Returns NULL on failure.
+  static StreamingPipeline* Create(Context* ctx, Kernel* kernel,
+      size_t chunk_size, size_t bytes_per_item, int num_buffers = 3);
+  ~StreamingPipeline();
+
+  // Runs the kernel over len bytes of input, writing the results to output.
+  // len must be a multiple of bytes_per_item. Blocks until all the output is
+  // on the host.
+  bool Process(const void* input, void* output, size_t len);
+
+  // Stats for all calls to Process().
+  const Stats& stats() const { return stats_; }
+
+ private:
+  StreamingPipeline(Context* ctx, Kernel* kernel, size_t chunk_size,
+      size_t bytes_per_item);
+  StreamingPipeline(const StreamingPipeline&);
+  StreamingPipeline& operator=(const StreamingPipeline&);
+
+  Context* ctx_; // unowned
+  Kernel* kernel_;
+  const size_t chunk_size_;
+  const size_t bytes_per_item_;
+
+  CommandQueue* upload_queue_;
+  CommandQueue* exec_queue_;
+  CommandQueue* download_queue_;
+
+  // One entry per staging slot.
+  std::vector<Buffer*> inputs_;
+  std::vector<Buffer*> outputs_;
+
+  Stats stats_;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include "tile_scheduler.h"
+#include "util.h"
+
+#include <thread>
+
+using namespace std;
+
+TileScheduler::TileScheduler(size_t tile_x, size_t tile_y, int in_flight)
+  : tile_x_(tile_x), tile_y_(tile_y), in_flight_(std::max(1, in_flight)) {
+}
+
+TileScheduler::~TileScheduler() {
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    workers_[i].ctx->Release(workers_[i].queue);
+  }
+}
+
+bool TileScheduler::AddWorker(Context* ctx) {
+  CommandQueue* queue = ctx->CreateCommandQueue(true);
+  if (queue == NULL) return false;
+  Worker worker;
+  worker.ctx = ctx;
+  worker.queue = queue;
+  workers_.push_back(worker);
+  return true;
+}
+
+NDRange TileScheduler::Tile(const RunState& state, size_t index) const {
+  const NDRange& range = state.range;
+  NDRange tile(tile_x_);
+  if (range.dims() == 1) {
+    tile.set_offset(range.offset(0) + index * tile_x_);
+  } else {
+    tile = NDRange(tile_x_, tile_y_);
+    tile.set_offset(range.offset(0) + index % state.tiles_x * tile_x_,
+        range.offset(1) + index / state.tiles_x * tile_y_);
+  }
+  if (range.has_local()) tile.set_local(range.local(0), range.local(1));
+  return tile;
+}
+
+bool TileScheduler::Run(Workload* workload, const NDRange& range) {
+  if (workers_.empty()) {
+    fprintf(stderr, "Could not run tiles: no workers\n");
+    return false;
+  }
+  if (range.dims() > 2 || range.global(0) % tile_x_ != 0 ||
+      (range.dims() == 2 && range.global(1) % tile_y_ != 0)) {
+    fprintf(stderr, "Could not run tiles: %s is not divisible into %lux%lu tiles\n",
+        range.ToString().c_str(), (unsigned long)tile_x_, (unsigned long)tile_y_);
+    return false;
+  }
+
+  RunState state(range);
+  state.workload = workload;
+  state.tiles_x = range.global(0) / tile_x_;
+  state.num_tiles = state.tiles_x * (range.dims() == 2 ? range.global(1) / tile_y_ : 1);
+  state.next_tile = 0;
+  state.failed = false;
+
+  // Contexts aren't thread safe so the kernels are set up front. They belong
+  // to the workload, so there is nothing to release if one fails.
+  vector<Kernel*> kernels;
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    Kernel* kernel = workload->Setup(workers_[i].ctx, i);
+    if (kernel == NULL) return false;
+    kernels.push_back(kernel);
+  }
+
+  stats_.clear();
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    WorkerStats stats;
+    stats.device = workers_[i].ctx->device();
+    stats.tiles = 0;
+    stats.items = 0;
+    stats.busy_ms = 0;
+    stats.utilization = 0;
+    stats_.push_back(stats);
+  }
+
+  double start_ms = timestamp_ms();
+  vector<thread> threads;
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    threads.push_back(thread(&TileScheduler::RunWorker, this, &state, (int)i, kernels[i]));
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+  double elapsed_ms = timestamp_ms() - start_ms;
+  for (size_t i = 0; i < stats_.size(); ++i) {
+    stats_[i].utilization = elapsed_ms > 0 ? stats_[i].busy_ms / elapsed_ms : 0;
+  }
+  return !state.failed;
+}
+
+void TileScheduler::RunWorker(RunState* state, int worker, Kernel* kernel) {
+  CommandQueue* queue = workers_[worker].queue;
+  WorkerStats* stats = &stats_[worker];
+  vector<NDRange> tiles;
+  deque<Event> pending;
+
+  bool done = false;
+  while (!done || !pending.empty()) {
+    if (!done && (int)pending.size() < in_flight_) {
+      size_t index = state->next_tile++;
+      if (index >= state->num_tiles || state->failed) {
+        done = true;
+        queue->Submit();
+        continue;
+      }
+      const NDRange& tile = Tile(*state, index);
+      Event event;
+      if (!queue->EnqueueKernel(kernel, tile, EventList(), &event) ||
+          !queue->Submit()) {
+        state->failed = true;
+        done = true;
+        continue;
+      }
+      pending.push_back(event);
+      tiles.push_back(tile);
+      stats->tiles++;
+      stats->items += tile.num_items();
+      continue;
+    }
+
+    // Wait for the oldest tile before taking another one.
+    const Event& oldest = pending.front();
+    cl_ulong queued, submit, start, end;
+    if (!oldest.Wait()) {
+      state->failed = true;
+    } else if (oldest.GetProfile(&queued, &submit, &start, &end)) {
+      stats->busy_ms += (end - start) / 1e6;
+    }
+    pending.pop_front();
+  }
+
+  if (!state->failed &&
+      !state->workload->Finish(workers_[worker].ctx, queue, worker, tiles)) {
+    state->failed = true;
+  }
+}
+
+string TileScheduler::ToString() const {
+  stringstream ss;
+  ss << "TileScheduler (" << workers_.size() << " workers, " << tile_x_ << "x"
+     << tile_y_ << " tiles)" << endl;
+  for (size_t i = 0; i < stats_.size(); ++i) {
+    ss << "  Worker " << i << " (" << stats_[i].device->name << "): "
+       << stats_[i].tiles << " tiles, " << stats_[i].items << " items, busy "
+       << stats_[i].busy_ms << "ms, utilization "
+       << (int)(stats_[i].utilization * 100) << "%" << endl;
+  }
+  return ss.str();
+}
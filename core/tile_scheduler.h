@@ -0,0 +1,93 @@
+#ifndef NONG_TILE_SCHEDULER_H
+#define NONG_TILE_SCHEDULER_H
+
+#include "context.h"
+
+// Runs a launch as many small tiles for kernels with uneven per work item
+// cost. Workers (each a queue on some context, several may share a context)
+// take the next tile from a shared atomic counter until none are left, so
+// workers that get cheap tiles simply take more of them and no compute unit
+// idles while a single large launch drains. Each worker keeps a few tiles in
+// flight to hide the launch latency.
+//
+// Tiles are launched with global offsets, so kernels see their real ids.
+class TileScheduler {
+ public:
+  // The work to schedule.
+  class Workload {
+   public:
+    virtual ~Workload() {}
+
+    // Returns the kernel, with its arguments set, for worker in ctx. Called
+    // once per worker and run, from the thread calling Run(). The workload
+    // owns its kernels: the scheduler never releases them, so they can be
+    // kept for later runs and workers of the same context may share one.
+    virtual Kernel* Setup(Context* ctx, int worker) = 0;
+
+    // Called from the worker's thread once its tiles are complete, e.g. to
+    // read back the results of workers on other devices.
+    virtual bool Finish(Context* ctx, CommandQueue* queue, int worker,
+        const std::vector<NDRange>& tiles) { return true; }
+  };
+
+  struct WorkerStats {
+    const DeviceInfo* device;
+    int tiles;
+    size_t items;
+    // Time the device spent running this worker's tiles.
+    double busy_ms;
+    // busy_ms over the time of the whole run.
+    double utilization;
+  };
+
+  // tile_x by tile_y work items per tile (tile_y is ignored for 1D ranges).
+  // Each worker keeps up to in_flight tiles enqueued.
+  TileScheduler(size_t tile_x, size_t tile_y = 1, int in_flight = 2);
+  ~TileScheduler();
+
+  // Adds a worker with its own profiling queue on ctx.
+  bool AddWorker(Context* ctx);
+  int num_workers() const { return workers_.size(); }
+
+  // Runs workload over range, which must be divisible into tiles. If range has
+  // a work group size, the tile size must be a multiple of it. Blocks until
+  // all workers are finished.
+  bool Run(Workload* workload, const NDRange& range);
+
+  // Stats of the last Run().
+  const std::vector<WorkerStats>& stats() const { return stats_; }
+  std::string ToString() const;
+
+ private:
+  TileScheduler(const TileScheduler&);
+  TileScheduler& operator=(const TileScheduler&);
+
+  struct Worker {
+    Context* ctx;
+    CommandQueue* queue;
+  };
+
+  // Shared by the worker threads of one Run().
+  struct RunState {
+    Workload* workload;
+    NDRange range;
+    size_t tiles_x;
+    size_t num_tiles;
+    std::atomic<size_t> next_tile;
+    std::atomic<bool> failed;
+    explicit RunState(const NDRange& r) : range(r) {}
+  };
+
+  void RunWorker(RunState* state, int worker, Kernel* kernel);
+
+  // Returns the range of tile index.
+  NDRange Tile(const RunState& state, size_t index) const;
+
+  const size_t tile_x_;
+  const size_t tile_y_;
+  const int in_flight_;
+  std::vector<Worker> workers_;
+  std::vector<WorkerStats> stats_;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "util.h"
+#include "profiler.h"
 
 #include <sys/time.h>
 
@@ -46,3 +47,37 @@ double timestamp_ms() {
   gettimeofday(&t, 0);
   return t.tv_sec * 1000L + t.tv_usec / 1000.;
 }
+
+uint64_t Hash(const void* data, size_t len, uint64_t seed) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  uint64_t hash = seed;
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+size_t PowerOfTwoBelow(size_t limit) {
+  size_t v = 1;
+  while (v * 2 <= limit) v *= 2;
+  return v;
+}
+
+void* AllocAligned(size_t size, size_t alignment) {
+  if (alignment < sizeof(void*)) alignment = sizeof(void*);
+  void* ptr = NULL;
+  if (posix_memalign(&ptr, alignment, size) != 0) return NULL;
+  return ptr;
+}
+
+void FreeAligned(void* ptr) {
+  free(ptr);
+}
+
+ScopedTimeMeasure::~ScopedTimeMeasure() {
+  double end = timestamp_ms();
+  double delta = end - start_;
+  printf("%s: %fms\n", label_, delta);
+  Profiler::RecordHostSpan(label_, start_, end);
+}
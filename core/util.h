@@ -7,14 +7,25 @@ std::string PrintBytes(long bytes);
 std::string PrintNanos(long value);
 double timestamp_ms();
 
+// 64 bit FNV-1a hash of data. seed can be the result of a previous call to
+// hash multiple values.
+uint64_t Hash(const void* data, size_t len,
+    uint64_t seed = 14695981039346656037ULL);
+
+// Returns the largest power of two that is at most limit (and at least 1).
+size_t PowerOfTwoBelow(size_t limit);
+
+// Allocates size bytes aligned to alignment (which must be a power of 2).
+// Memory must be freed with FreeAligned().
+void* AllocAligned(size_t size, size_t alignment);
+void FreeAligned(void* ptr);
+
+// Prints the time spent in the scope and records it as a host span in the
+// Profiler.
 class ScopedTimeMeasure {
  public:
   ScopedTimeMeasure(const char* label) : label_(label), start_(timestamp_ms()) {}
-  ~ScopedTimeMeasure() {
-    double end = timestamp_ms();
-    double delta = end - start_;
-    printf("%s: %fms\n", label_, delta);
-  }
+  ~ScopedTimeMeasure();
 
  private:
   const char* label_;
@@ -0,0 +1,205 @@
+#include "work_group_tuner.h"
+#include "util.h"
+
+using namespace std;
+
+WorkGroupTuner::WorkGroupTuner(const string& path) : path_(path), generation_(1) {
+  if (!path_.empty()) Load();
+}
+
+int WorkGroupTuner::Bucket(const NDRange& range) {
+  int bucket = 0;
+  for (size_t n = range.num_items(); n > 1; n >>= 1) ++bucket;
+  return bucket;
+}
+
+string WorkGroupTuner::Key(const DeviceInfo* device, const Kernel* kernel,
+    const NDRange& range) {
+  stringstream ss;
+  ss << device->name << "\t" << kernel->fn_name() << "\t"
+     << range.dims() << "\t" << Bucket(range);
+  return ss.str();
+}
+
+vector<NDRange> WorkGroupTuner::Candidates(const DeviceInfo* device,
+    const Kernel* kernel, const NDRange& range, size_t local_mem_per_item) {
+  size_t max_items = std::min(device->max_work_group_size, kernel->max_work_group_size());
+  if (local_mem_per_item > 0) {
+    if (kernel->local_mem_size() >= device->max_local_mem) return vector<NDRange>();
+    max_items = std::min<size_t>(max_items,
+        (device->max_local_mem - kernel->local_mem_size()) / local_mem_per_item);
+  }
+  const size_t multiple = std::max<size_t>(1, kernel->preferred_work_group_multiple());
+
+  vector<NDRange> candidates;
+  // Let the device decide as the baseline.
+  NDRange device_default = range;
+  device_default.clear_local();
+  candidates.push_back(device_default);
+
+  string error;
+  if (range.dims() == 1) {
+    for (size_t x = multiple; x <= max_items; x *= 2) {
+      NDRange r = range;
+      r.set_local(x);
+      if (r.Validate(device, kernel, &error)) candidates.push_back(r);
+    }
+  } else {
+    // Only tune the first two dimensions, higher ones use 1.
+    for (size_t x = 1; x <= max_items; x *= 2) {
+      for (size_t y = 1; x * y <= max_items; y *= 2) {
+        if ((x * y) % multiple != 0) continue;
+        NDRange r = range;
+        r.set_local(x, y, 1);
+        if (r.Validate(device, kernel, &error)) candidates.push_back(r);
+      }
+    }
+  }
+  return candidates;
+}
+
+bool WorkGroupTuner::Tune(Context* ctx, Kernel* kernel, const NDRange& range,
+    NDRange* best, int iters, size_t local_mem_per_item) {
+  const vector<NDRange>& candidates =
+      Candidates(ctx->device(), kernel, range, local_mem_per_item);
+  if (candidates.empty()) {
+    fprintf(stderr, "No work group size fits kernel %s.\n", kernel->fn_name().c_str());
+    return false;
+  }
+
+  CommandQueue* queue = ctx->CreateCommandQueue(true);
+  if (queue == NULL) return false;
+
+  // Drop the old result so the baseline launch isn't given its size.
+  const string& key = Key(ctx->device(), kernel, range);
+  {
+    lock_guard<mutex> l(lock_);
+    results_.erase(key);
+    ++generation_;
+  }
+
+  double best_ns = -1;
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    // Warm up, the first launch can include compilation and caching effects.
+    Event warm_up;
+    if (!queue->EnqueueKernel(kernel, candidates[i], EventList(), &warm_up)) continue;
+    warm_up.Wait();
+
+    double total_ns = 0;
+    bool ok = true;
+    for (int iter = 0; iter < iters && ok; ++iter) {
+      Event event;
+      ok = queue->EnqueueKernel(kernel, candidates[i], EventList(), &event) &&
+          event.Wait();
+      cl_ulong queued, submit, start, end;
+      ok = ok && event.GetProfile(&queued, &submit, &start, &end);
+      if (ok) total_ns += end - start;
+    }
+    if (!ok) continue;
+    double ns = total_ns / iters;
+    if (best_ns < 0 || ns < best_ns) {
+      best_ns = ns;
+      *best = candidates[i];
+    }
+  }
+  ctx->Release(queue);
+  if (best_ns < 0) return false;
+
+  Result result;
+  for (int i = 0; i < 3; ++i) result.local[i] = best->has_local() ? best->local(i) : 0;
+  result.ns = best_ns;
+  {
+    lock_guard<mutex> l(lock_);
+    results_[key] = result;
+    ++generation_;
+  }
+  if (!path_.empty()) Save();
+  return true;
+}
+
+bool WorkGroupTuner::Lookup(const DeviceInfo* device, Kernel* kernel,
+    NDRange* range) const {
+  // Read before the results, so a change in between refreshes the entry on
+  // the next launch.
+  const uint64_t generation = generation_;
+  Kernel::TunedLocal& cached =
+      kernel->tuned_[make_pair(range->dims(), Bucket(*range))];
+  if (cached.generation != generation) {
+    lock_guard<mutex> l(lock_);
+    map<string, Result>::const_iterator it =
+        results_.find(Key(device, kernel, *range));
+    cached.found = it != results_.end();
+    for (int i = 0; i < 3; ++i) {
+      cached.local[i] = cached.found ? it->second.local[i] : 0;
+    }
+    cached.generation = generation;
+  }
+  if (!cached.found) return false;
+  // 0 means the device default was fastest.
+  if (cached.local[0] == 0) return true;
+  NDRange tuned = *range;
+  tuned.set_local(cached.local[0], cached.local[1], cached.local[2]);
+  // The bucket covers other sizes which might not be divisible.
+  string error;
+  if (!tuned.Validate(device, kernel, &error)) return false;
+  *range = tuned;
+  return true;
+}
+
+// The file has one result per line:
+//   device \t kernel \t dims \t bucket \t local_x local_y local_z \t ns
+bool WorkGroupTuner::Load() {
+  FILE* file = fopen(path_.c_str(), "r");
+  if (file == NULL) return false;
+  char line[1024];
+  lock_guard<mutex> l(lock_);
+  while (fgets(line, sizeof(line), file) != NULL) {
+    vector<string> fields;
+    stringstream ss(line);
+    string field;
+    while (getline(ss, field, '\t')) fields.push_back(field);
+    if (fields.size() != 6) continue;
+
+    Result result;
+    stringstream local(fields[4]);
+    local >> result.local[0] >> result.local[1] >> result.local[2];
+    result.ns = atof(fields[5].c_str());
+    results_[fields[0] + "\t" + fields[1] + "\t" + fields[2] + "\t" + fields[3]] = result;
+  }
+  ++generation_;
+  fclose(file);
+  return true;
+}
+
+bool WorkGroupTuner::Save() const {
+  const string& tmp_path = path_ + ".tmp";
+  FILE* file = fopen(tmp_path.c_str(), "w");
+  if (file == NULL) {
+    fprintf(stderr, "Could not save work group sizes to %s\n", path_.c_str());
+    return false;
+  }
+  {
+    lock_guard<mutex> l(lock_);
+    for (map<string, Result>::const_iterator it = results_.begin();
+        it != results_.end(); ++it) {
+      fprintf(file, "%s\t%lu %lu %lu\t%f\n", it->first.c_str(),
+          (unsigned long)it->second.local[0], (unsigned long)it->second.local[1],
+          (unsigned long)it->second.local[2], it->second.ns);
+    }
+  }
+  fclose(file);
+  return rename(tmp_path.c_str(), path_.c_str()) == 0;
+}
+
+string WorkGroupTuner::ToString() const {
+  lock_guard<mutex> l(lock_);
+  stringstream ss;
+  ss << "WorkGroupTuner (" << results_.size() << " results)" << endl;
+  for (map<string, Result>::const_iterator it = results_.begin();
+      it != results_.end(); ++it) {
+    ss << "  " << it->first << ": " << it->second.local[0] << "x"
+       << it->second.local[1] << "x" << it->second.local[2] << " "
+       << PrintNanos(it->second.ns) << endl;
+  }
+  return ss.str();
+}
@@ -0,0 +1,63 @@
+#ifndef NONG_WORK_GROUP_TUNER_H
+#define NONG_WORK_GROUP_TUNER_H
+
+#include "context.h"
+
+// Finds the fastest work group size for a kernel by timing it with a set of
+// candidate sizes. Candidates are multiples of the kernel's preferred work
+// group size multiple that fit the device, kernel and local memory limits and
+// divide the global size. Results are kept per (device, kernel, dimensions,
+// global size bucket), where the bucket is log2 of the number of work items,
+// and persisted to a file so they survive restarts.
+//
+// Set the tuner on a Context (Context::SetWorkGroupTuner) to have launches
+// without a work group size use the tuned one.
+class WorkGroupTuner {
+ public:
+  // Results are loaded from and saved to path. If path is empty, results are
+  // not persisted.
+  WorkGroupTuner(const std::string& path);
+
+  // Times kernel, whose arguments must already be set, over range with each
+  // candidate work group size. local_mem_per_item is the local memory the
+  // kernel's local arguments need per work item. Each candidate is run iters
+  // times. On success, best is set to range with the fastest work group size,
+  // which is also recorded (and saved).
+  bool Tune(Context* ctx, Kernel* kernel, const NDRange& range, NDRange* best,
+      int iters = 3, size_t local_mem_per_item = 0);
+
+  // Sets the tuned work group size for kernel on range. Returns false if the
+  // kernel was not tuned for this device and range size. The result is cached
+  // on kernel until the results change, so launches don't look it up again.
+  bool Lookup(const DeviceInfo* device, Kernel* kernel, NDRange* range) const;
+
+  // Loads/saves the results. Loading merges with results in memory.
+  bool Load();
+  bool Save() const;
+
+  std::string ToString() const;
+
+ private:
+  struct Result {
+    size_t local[3];
+    double ns;
+  };
+
+  // Returns log2 of the number of work items of range.
+  static int Bucket(const NDRange& range);
+  static std::string Key(const DeviceInfo* device, const Kernel* kernel,
+      const NDRange& range);
+
+  // Returns the candidate work group sizes for range (with the local size set).
+  static std::vector<NDRange> Candidates(const DeviceInfo* device,
+      const Kernel* kernel, const NDRange& range, size_t local_mem_per_item);
+
+  const std::string path_;
+  mutable std::mutex lock_;
+  std::map<std::string, Result> results_;
+  // Incremented whenever results_ changes, which invalidates the sizes cached
+  // on kernels. Starts at 1, 0 marks an empty cache entry.
+  std::atomic<uint64_t> generation_;
+};
+
+#endif
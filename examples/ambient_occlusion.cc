@@ -5,7 +5,10 @@
 #include <iostream>
 
 #include "core/context.h"
+#include "core/multi_device_executor.h"
 #include "core/platform.h"
+#include "core/profiler.h"
+#include "core/tile_scheduler.h"
 #include "core/util.h"
 
 using namespace std;
@@ -21,6 +24,7 @@ using namespace std;
 #include "shim/shim_begin.h"
 #include "kernels/ao.cl"
 #include "shim/shim_end.h"
+#include "shim/executor.h"
 
 Sphere spheres[3];
 Plane  plane;
@@ -54,6 +58,28 @@ void Render(unsigned char* img, int w, int h, int nsubsamples) {
   }
 }
 
+// Runs the TracePixel kernel on all cores without opencl.
+void RenderShim(unsigned char* img) {
+  float* ao = (float*)malloc(sizeof(float) * WIDTH * HEIGHT);
+  memset(ao, 0, sizeof(float) * WIDTH * HEIGHT);
+
+  ShimExecutor executor;
+  printf("Threads: %d\n", executor.num_threads());
+  {
+    ScopedTimeMeasure m("RenderShim");
+    executor.Run(ShimRange(WIDTH, HEIGHT), [&]() {
+      TracePixel(ao, spheres, plane, HEIGHT, WIDTH, NSUBSAMPLES, NAO_SAMPLES);
+    });
+  }
+
+  for (int i = 0; i < WIDTH * HEIGHT; ++i) {
+    img[i * 3 + 0] = Clamp(ao[i]);
+    img[i * 3 + 1] = img[i * 3];
+    img[i * 3 + 2] = img[i * 3];
+  }
+  free(ao);
+}
+
 void InitScene() {
   spheres[0].center = to_float4(-2.0, 0, -3.5, 0);
   spheres[0].radius2 = 0.5 * 0.5;
@@ -83,23 +109,23 @@ void RenderOpenCl(unsigned char* img) {
   memset(ao, 0, sizeof(float) * WIDTH * HEIGHT);
 
   Context* ctx = Context::Create(Platform::default_device(), enable_profiling);
+  ctx->EnableProgramCache(".clcache");
   Buffer* result_buffer = ctx->CreateBufferFromMem(
       Buffer::READ_WRITE, ao, sizeof(float) * WIDTH * HEIGHT);
   Buffer* spheres_buffer = ctx->CreateBufferFromMem(
       Buffer::READ_ONLY, spheres, sizeof(spheres));
-  Buffer* plane_buffer  = ctx->CreateBufferFromMem(
-      Buffer::READ_ONLY, &plane, sizeof(plane));
 
+  // The plane is small enough to pass by value.
   Kernel* kernel = ctx->CreateKernel("kernels/ao.cl", "TracePixel");
-  kernel->SetArg(0, result_buffer);
-  kernel->SetArg(1, spheres_buffer);
-  kernel->SetArg(2, plane_buffer);
-  kernel->SetArg(3, (cl_int)HEIGHT);
-  kernel->SetArg(4, (cl_int)WIDTH);
-  kernel->SetArg(5, (cl_int)NSUBSAMPLES);
-  kernel->SetArg(6, (cl_int)NAO_SAMPLES);
-
-  ctx->default_queue()->EnqueueKernel(kernel, WIDTH * HEIGHT, -1);
+  kernel->SetArgs(result_buffer, spheres_buffer, plane, HEIGHT, WIDTH,
+      NSUBSAMPLES, NAO_SAMPLES);
+
+  // Square tiles keep the rays of a work group close together.
+  NDRange range(WIDTH, HEIGHT);
+  range.set_local(8, 8);
+  string error;
+  if (!range.Validate(ctx->device(), kernel, &error)) range.clear_local();
+  ctx->default_queue()->EnqueueKernel(kernel, range);
   result_buffer->Read(ctx->default_queue());
 
   for (int i = 0; i < WIDTH * HEIGHT; ++i) {
@@ -110,12 +136,140 @@ void RenderOpenCl(unsigned char* img) {
 
   if (enable_profiling) {
     printf("Profile Events:\n\n%s", ctx->default_queue()->GetEventsProfile().c_str());
+    Profiler::WriteChromeTrace("ao_trace.json");
   }
+  printf("%s\n", ctx->program_cache()->ToString().c_str());
 
   free(ao);
   delete ctx;
 }
 
+// Renders rows of the image on every device.
+class AoWorkload : public MultiDeviceExecutor::Workload {
+ public:
+  AoWorkload(float* ao, int num_devices)
+    : ao_(ao), results_(num_devices), spheres_(num_devices) {}
+
+  virtual Kernel* Setup(Context* ctx, int device) {
+    // The buffers are made on the first run and reused by the next ones, the
+    // executor releases the kernel after each run.
+    if (results_[device] == NULL) {
+      ctx->EnableProgramCache(".clcache");
+      // Every device has a full result buffer but only writes its rows.
+      results_[device] = ctx->CreateBuffer(
+          Buffer::WRITE_ONLY, sizeof(float) * WIDTH * HEIGHT);
+      spheres_[device] = ctx->CreateBufferFromMem(
+          Buffer::READ_ONLY, spheres, sizeof(spheres));
+    }
+    Kernel* kernel = ctx->CreateKernel("kernels/ao.cl", "TracePixel");
+    if (kernel == NULL) return NULL;
+    if (results_[device] == NULL || spheres_[device] == NULL ||
+        !kernel->SetArgs(results_[device], spheres_[device], plane, HEIGHT,
+            WIDTH, NSUBSAMPLES, NAO_SAMPLES)) {
+      ctx->Release(kernel);
+      return NULL;
+    }
+    return kernel;
+  }
+
+  virtual bool Merge(Context* ctx, CommandQueue* queue, int device,
+      const NDRange& chunk) {
+    const size_t first = chunk.offset(1) * WIDTH;
+    const size_t len = chunk.global(1) * WIDTH;
+    return results_[device]->CopyRegionTo(queue, first * sizeof(float),
+        ao_ + first, len * sizeof(float));
+  }
+
+ private:
+  float* ao_;
+  vector<Buffer*> results_;
+  vector<Buffer*> spheres_;
+};
+
+void RenderMultiDevice(unsigned char* img) {
+  float* ao = (float*)malloc(sizeof(float) * WIDTH * HEIGHT);
+  MultiDeviceExecutor* executor = MultiDeviceExecutor::CreateForAllDevices();
+  if (executor == NULL) {
+    free(ao);
+    return;
+  }
+
+  AoWorkload workload(ao, executor->num_devices());
+  NDRange range(WIDTH, HEIGHT);
+  range.set_local(8, 8);
+  // Run twice, the second run splits by the throughput measured in the first.
+  for (int i = 0; i < 2; ++i) {
+    ScopedTimeMeasure m("RenderMultiDevice");
+    if (!executor->Run(&workload, range)) break;
+    printf("%s", executor->ToString().c_str());
+  }
+
+  for (int i = 0; i < WIDTH * HEIGHT; ++i) {
+    img[i * 3 + 0] = Clamp(ao[i]);
+    img[i * 3 + 1] = img[i * 3];
+    img[i * 3 + 2] = img[i * 3];
+  }
+  delete executor;
+  free(ao);
+}
+
+// Renders 64x64 pixel tiles from several queues on one device. Pixels that
+// hit an object cost much more than the ones that don't, so the workers take
+// tiles as they go instead of splitting the image up front.
+class AoTileWorkload : public TileScheduler::Workload {
+ public:
+  AoTileWorkload() : kernel_(NULL), result_(NULL) {}
+
+  virtual Kernel* Setup(Context* ctx, int worker) {
+    // All workers and runs share the context, and so the kernel and buffers.
+    if (kernel_ != NULL) return kernel_;
+    ctx->EnableProgramCache(".clcache");
+    result_ = ctx->CreateBuffer(Buffer::WRITE_ONLY, sizeof(float) * WIDTH * HEIGHT);
+    Buffer* spheres_buffer = ctx->CreateBufferFromMem(
+        Buffer::READ_ONLY, spheres, sizeof(spheres));
+    kernel_ = ctx->CreateKernel("kernels/ao.cl", "TracePixel");
+    if (kernel_ == NULL || result_ == NULL) return NULL;
+    if (!kernel_->SetArgs(result_, spheres_buffer, plane, HEIGHT, WIDTH,
+        NSUBSAMPLES, NAO_SAMPLES)) {
+      return NULL;
+    }
+    return kernel_;
+  }
+
+  Buffer* result() { return result_; }
+
+ private:
+  Kernel* kernel_;
+  Buffer* result_;
+};
+
+void RenderTiles(unsigned char* img) {
+  const int num_workers = 4;
+  float* ao = (float*)malloc(sizeof(float) * WIDTH * HEIGHT);
+  Context* ctx = Context::Create(Platform::default_device());
+
+  AoTileWorkload workload;
+  {
+    TileScheduler scheduler(64, 64);
+    for (int i = 0; i < num_workers; ++i) scheduler.AddWorker(ctx);
+    NDRange range(WIDTH, HEIGHT);
+    range.set_local(8, 8);
+    ScopedTimeMeasure m("RenderTiles");
+    if (scheduler.Run(&workload, range)) {
+      workload.result()->CopyTo(ctx->default_queue(), ao, sizeof(float) * WIDTH * HEIGHT);
+    }
+    printf("%s", scheduler.ToString().c_str());
+  }
+
+  for (int i = 0; i < WIDTH * HEIGHT; ++i) {
+    img[i * 3 + 0] = Clamp(ao[i]);
+    img[i * 3 + 1] = img[i * 3];
+    img[i * 3 + 2] = img[i * 3];
+  }
+  delete ctx;
+  free(ao);
+}
+
 int main(int argc, char** argv) {
   Platform::Init();
 
@@ -126,6 +280,18 @@ int main(int argc, char** argv) {
   printf("Rendering with opencl.\n");
   RenderOpenCl(img);
   SavePPM("ao_cl.ppm", WIDTH, HEIGHT, img);
+#elif 0
+  printf("Rendering with all opencl devices.\n");
+  RenderMultiDevice(img);
+  SavePPM("ao_multi.ppm", WIDTH, HEIGHT, img);
+#elif 0
+  printf("Rendering with tiles.\n");
+  RenderTiles(img);
+  SavePPM("ao_tiles.ppm", WIDTH, HEIGHT, img);
+#elif 0
+  printf("Rendering with the shim.\n");
+  RenderShim(img);
+  SavePPM("ao_shim.ppm", WIDTH, HEIGHT, img);
 #else
   printf("Rendering with cpu.\n");
   Render(img, WIDTH, HEIGHT, NSUBSAMPLES);
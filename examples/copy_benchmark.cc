@@ -4,6 +4,7 @@
 
 #include "core/context.h"
 #include "core/platform.h"
+#include "core/streaming_pipeline.h"
 #include "core/util.h"
 
 using namespace std;
@@ -13,6 +14,9 @@ const size_t TO_COPY = 20L * 1024L * 1024L * 1024L;
 #define CPU_CPU 0
 #define CPU_GPU 1
 #define GPU_CPU 2
+// Zero-copy: the device buffer aliases src, a batch is only a map/unmap.
+#define CPU_GPU_MAP 3
+#define GPU_CPU_MAP 4
 
 // CPU->CPU (1GB src, 64MB batch): 6.21311 GB/s
 // CPU->GPU (1GB src, 64MB batch): 4.32059 GB/s
@@ -21,36 +25,52 @@ template <int mode>
 void Copy(size_t num_bytes, size_t batch_size, char* dummy) {
   if (batch_size > num_bytes) batch_size = num_bytes;
 
-  char* src = (char*)malloc(num_bytes);
+  Context* gpu_ctx = Context::Create(Platform::gpu_device());
+
+  char* src = (char*)gpu_ctx->AllocateHostMem(num_bytes);
   char* dst = (char*)malloc(batch_size);
   double total_bytes = 0;
 
-  Context* gpu_ctx = Context::Create(Platform::gpu_device());
-  Buffer* gpu_buffer = gpu_ctx->CreateBufferFromMem(Buffer::READ_ONLY, dst, batch_size);
+  Buffer* gpu_buffer;
+  if (mode == CPU_GPU_MAP || mode == GPU_CPU_MAP) {
+    gpu_buffer = gpu_ctx->CreateZeroCopyBuffer(Buffer::READ_WRITE, src, num_bytes);
+  } else {
+    gpu_buffer = gpu_ctx->CreateBufferFromMem(Buffer::READ_ONLY, dst, batch_size);
+  }
 
   long start = timestamp_ms();
   while (total_bytes < TO_COPY) {
     size_t bytes_copied = 0;
+    // The queue is in order so only the last copy needs to be waited on.
+    Event last_copy;
 
     while (bytes_copied != num_bytes) {
       size_t to_copy = std::min(batch_size, num_bytes - bytes_copied);
       if (mode == CPU_CPU) {
         memcpy(dst, src + bytes_copied, to_copy);
       } else if (mode == CPU_GPU) {
-        gpu_buffer->CopyFrom(gpu_ctx->default_queue(), src + bytes_copied, to_copy);
-        gpu_ctx->default_queue()->Flush();
+        last_copy = gpu_buffer->WriteAsync(
+            gpu_ctx->default_queue(), src + bytes_copied, to_copy);
       } else if (mode == GPU_CPU) {
-        gpu_buffer->CopyTo(gpu_ctx->default_queue(), src + bytes_copied, to_copy);
+        last_copy = gpu_buffer->ReadAsync(
+            gpu_ctx->default_queue(), src + bytes_copied, to_copy);
+      } else if (mode == CPU_GPU_MAP || mode == GPU_CPU_MAP) {
+        Buffer::AccessType access =
+            mode == CPU_GPU_MAP ? Buffer::WRITE_ONLY : Buffer::READ_ONLY;
+        void* ptr = gpu_buffer->Map(
+            gpu_ctx->default_queue(), access, bytes_copied, to_copy);
+        gpu_buffer->Unmap(gpu_ctx->default_queue(), ptr);
         gpu_ctx->default_queue()->Flush();
       }
       bytes_copied += to_copy;
     }
-    *dummy += dst[0];
+    if (last_copy.valid()) last_copy.Wait();
+    // Map modes don't copy into dst.
+    if (mode != CPU_GPU_MAP && mode != GPU_CPU_MAP) *dummy += dst[0];
     total_bytes += bytes_copied;
   }
   double elapsed = timestamp_ms() - start;
 
-  free(src);
   free(dst);
 
   double mbs = total_bytes / (1024 * 1024 * 1024);
@@ -62,12 +82,42 @@ void Copy(size_t num_bytes, size_t batch_size, char* dummy) {
     cout << "CPU->GPU";
   } else if (mode == GPU_CPU) {
     cout << "GPU->CPU";
+  } else if (mode == CPU_GPU_MAP) {
+    cout << "CPU->GPU (zero copy)";
+  } else if (mode == GPU_CPU_MAP) {
+    cout << "GPU->CPU (zero copy)";
   }
 
   cout << " (" << PrintBytes(num_bytes) << " src, "
        << PrintBytes(batch_size) << " batch): " << mbs << " GB/s" << endl;
 
+  // The zero copy buffer uses src, it must be released first.
   delete gpu_ctx;
+  FreeAligned(src);
+}
+
+// Streams num_bytes of floats through SimpleKernel, overlapping transfers in
+// both directions with the kernel.
+void Stream(size_t num_bytes, size_t chunk_size, int num_buffers) {
+  float* input = (float*)malloc(num_bytes);
+  float* output = (float*)malloc(num_bytes);
+  for (size_t i = 0; i < num_bytes / sizeof(float); ++i) input[i] = i;
+
+  Context* ctx = Context::Create(Platform::default_device());
+  Kernel* kernel = ctx->CreateKernel("kernels/kernels.cl", "SimpleKernel");
+  StreamingPipeline* pipeline = StreamingPipeline::Create(
+      ctx, kernel, chunk_size, sizeof(float), num_buffers);
+  if (pipeline != NULL) {
+    pipeline->Process(input, output, num_bytes);
+    cout << "Stream (" << PrintBytes(num_bytes) << " src, "
+         << PrintBytes(chunk_size) << " chunk, " << num_buffers << " buffers): "
+         << pipeline->stats().ToString() << endl;
+  }
+
+  delete pipeline;
+  delete ctx;
+  free(input);
+  free(output);
 }
 
 int main(int argc, char** argv) {
@@ -92,7 +142,13 @@ int main(int argc, char** argv) {
   //Copy<CPU_GPU>(1024 * 1024L * 1024L, 16 * 1024 * 1024L, &dummy);
   Copy<CPU_GPU>(1024 * 1024L * 1024L, 64 * 1024 * 1024L, &dummy);
   Copy<GPU_CPU>(1024 * 1024L * 1024L, 64 * 1024 * 1024L, &dummy);
+  Copy<CPU_GPU_MAP>(1024 * 1024L * 1024L, 64 * 1024 * 1024L, &dummy);
+  Copy<GPU_CPU_MAP>(1024 * 1024L * 1024L, 64 * 1024 * 1024L, &dummy);
+
+  Stream(1024 * 1024L * 1024L, 64 * 1024 * 1024L, 1);
+  Stream(1024 * 1024L * 1024L, 64 * 1024 * 1024L, 3);
 
+  printf("%s", Metrics::ToString().c_str());
   printf("Done.\n");
   return dummy;
 }
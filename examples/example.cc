@@ -1,47 +1,190 @@
+#include <numeric>
+
+#include "core/buffer_pool.h"
 #include "core/context.h"
+#include "core/fused_map.h"
+#include "core/launch_batch.h"
 #include "core/platform.h"
+#include "core/reduce.h"
+#include "core/ref.h"
+#include "core/scan.h"
+#include "core/sort.h"
 #include "core/util.h"
+#include "core/work_group_tuner.h"
 
 using namespace std;
 
-// This is a very simple example that doesn't handle different input very well
-// or run the cpu device.
-void ArraySum() {
-  const int size = 64;
-  const int global_size = size / 8;
-  const int local_size = global_size / 2;
+// Cross compile the map and bitonic sort kernels to compare the shim with
+// the cpu device.
+#include "shim/shim_begin.h"
+#include "kernels/kernels.cl"
+#include "kernels/bitonic_sort.cl"
+#include "shim/shim_end.h"
+#include "shim/executor.h"
+#include "shim/packed.h"
 
-  float data[size];
-  float sum[local_size];
+// Sums, and finds the min and max of, size floats on the default device.
+void ArraySum(size_t size, int iters) {
+  vector<float> data(size);
+  for (size_t i = 0; i < size; ++i) data[i] = i % 1000;
 
-  for (int i = 0; i < size; ++i) data[i] = i;
-  for (int i = 0; i < local_size; ++i) sum[i] = 0;
+  Context* ctx = Context::Create(Platform::default_device());
+  Buffer* input = ctx->CreateBuffer(Buffer::READ_ONLY, size * sizeof(float));
+  input->CopyFrom(ctx->default_queue(), &data[0], size * sizeof(float));
+  Reduce<float>* sum = Reduce<float>::Create(ctx);
+  Reduce<float, ReduceMin<float> >* minimum = Reduce<float, ReduceMin<float> >::Create(ctx);
+  Reduce<float, ReduceMax<float> >* maximum = Reduce<float, ReduceMax<float> >::Create(ctx);
+  if (sum == NULL || minimum == NULL || maximum == NULL) {
+    printf("Could not create the reduce kernels.\n");
+    delete sum;
+    delete minimum;
+    delete maximum;
+    delete ctx;
+    return;
+  }
+  printf("Reduce: %lu work items per group, up to %lu groups\n",
+      (unsigned long)sum->local_size(), (unsigned long)sum->max_groups());
 
-  Context* ctx = Context::Create(Platform::gpu_device());
-  Kernel* kernel = ctx->CreateKernel("kernels/add_numbers.cl", "add_numbers");
-  Buffer* input_buffer =
-      ctx->CreateBufferFromMem(Buffer::READ_ONLY, data, sizeof(data));
-  Buffer* sum_buffer =
-      ctx->CreateBufferFromMem(Buffer::READ_WRITE, sum, sizeof(sum));
+  float cl_sum = 0;
+  double start_ms = timestamp_ms();
+  for (int i = 0; i < iters; ++i) sum->Run(input, size, &cl_sum);
+  double elapsed_ms = timestamp_ms() - start_ms;
+  float cl_min = 0;
+  float cl_max = 0;
+  minimum->Run(input, size, &cl_min);
+  maximum->Run(input, size, &cl_max);
 
-  kernel->SetArg(0, input_buffer);
-  kernel->SetLocalArg(1, sizeof(sum));
-  kernel->SetArg(2, sum_buffer);
+  double cpu_sum = 0;
+  for (size_t i = 0; i < size; ++i) cpu_sum += data[i];
 
-  ctx->default_queue()->EnqueueKernel(kernel, global_size, local_size);
-  sum_buffer->Read(ctx->default_queue());
+  printf("CPU Sum:    %f\n", cpu_sum);
+  printf("OpenCl Sum: %f (min %f, max %f)\n", cl_sum, cl_min, cl_max);
+  printf("%s/s\n", PrintBytes(size * sizeof(float) * iters / (elapsed_ms / 1000)).c_str());
 
-  float cpu_sum = 0;
-  for (int i = 0; i < size; ++i) cpu_sum += data[i];
+  delete sum;
+  delete minimum;
+  delete maximum;
+  delete ctx;
+}
 
-  float cl_sum = 0;
-  for (int i = 0; i < local_size; ++i) cl_sum += sum[i];
+// Values for Compact to keep.
+struct Positive {
+  static const char* pred() { return "(x) > 0"; }
+};
 
-  printf("%s\n", kernel->ToString(true).c_str());
+// Times Scan against std::partial_sum on size ints and compacts them. The
+// GB/s count the input and output once each, like copy_benchmark.
+void ScanBenchmark(size_t size, int iters) {
+  vector<cl_int> data(size);
+  for (size_t i = 0; i < size; ++i) data[i] = (int)(i % 7) - 3;
 
-  printf("CPU Sum:    %f\n", cpu_sum);
-  printf("OpenCl Sum: %f\n", cl_sum);
+  vector<cl_int> cpu_result(size);
+  double start_ms = timestamp_ms();
+  for (int i = 0; i < iters; ++i) {
+    partial_sum(data.begin(), data.end(), cpu_result.begin());
+  }
+  double cpu_ms = (timestamp_ms() - start_ms) / iters;
 
+  Context* ctx = Context::Create(Platform::default_device());
+  CommandQueue* queue = ctx->default_queue();
+  Buffer* input = ctx->CreateBuffer(Buffer::READ_WRITE, size * sizeof(cl_int));
+  Buffer* output = ctx->CreateBuffer(Buffer::READ_WRITE, size * sizeof(cl_int));
+  input->CopyFrom(queue, &data[0], size * sizeof(cl_int));
+  Scan<cl_int>* scan = Scan<cl_int>::Create(ctx);
+  Compact<cl_int, Positive>* compact = Compact<cl_int, Positive>::Create(ctx);
+  if (scan == NULL || compact == NULL) {
+    printf("Could not create the scan kernels.\n");
+    delete scan;
+    delete compact;
+    delete ctx;
+    return;
+  }
+
+  // Warm up, and check.
+  scan->Run(input, size, output);
+  vector<cl_int> cl_result(size);
+  output->CopyTo(queue, &cl_result[0], size * sizeof(cl_int));
+  start_ms = timestamp_ms();
+  for (int i = 0; i < iters; ++i) scan->Run(input, size, output);
+  queue->Flush();
+  double cl_ms = (timestamp_ms() - start_ms) / iters;
+
+  size_t count = 0;
+  compact->Run(input, size, output, &count);
+  size_t cpu_count = count_if(data.begin(), data.end(), [](cl_int x) { return x > 0; });
+
+  const double bytes = 2. * size * sizeof(cl_int);
+  printf("Scan of %lu ints (tile %lu): %s\n", (unsigned long)size,
+      (unsigned long)scan->tile_size(),
+      cl_result == cpu_result ? "ok" : "MISMATCH");
+  printf("  partial_sum: %.3fms, %s/s\n", cpu_ms, PrintBytes(bytes / (cpu_ms / 1000)).c_str());
+  printf("  Scan:        %.3fms, %s/s\n", cl_ms, PrintBytes(bytes / (cl_ms / 1000)).c_str());
+  printf("Compact kept %lu of %lu values: %s\n", (unsigned long)count,
+      (unsigned long)size, count == cpu_count ? "ok" : "MISMATCH");
+
+  // More than tile_size()^2 values take three levels, on a new Scan so its
+  // tile sums grow during the recursion.
+  Scan<cl_int>* deep_scan = Scan<cl_int>::Create(ctx);
+  const size_t deep_size = scan->tile_size() * scan->tile_size() + 1;
+  vector<cl_int> deep_data(deep_size);
+  for (size_t i = 0; i < deep_size; ++i) deep_data[i] = (int)(i % 5) - 2;
+  vector<cl_int> deep_cpu(deep_size);
+  partial_sum(deep_data.begin(), deep_data.end(), deep_cpu.begin());
+  Buffer* deep_buffer = ctx->CreateBuffer(Buffer::READ_WRITE, deep_size * sizeof(cl_int));
+  deep_buffer->CopyFrom(queue, &deep_data[0], deep_size * sizeof(cl_int));
+  deep_scan->Run(deep_buffer, deep_size, deep_buffer);
+  deep_buffer->CopyTo(queue, &deep_data[0], deep_size * sizeof(cl_int));
+  printf("Scan of %lu ints (3 levels): %s\n", (unsigned long)deep_size,
+      deep_data == deep_cpu ? "ok" : "MISMATCH");
+
+  delete deep_scan;
+  delete scan;
+  delete compact;
+  delete ctx;
+}
+
+// Compiles all the example programs concurrently.
+void LoadPrograms() {
+  const char* paths[] = {
+    "kernels/ao.cl",
+    "kernels/bitonic_sort.cl",
+    "kernels/compact.cl",
+    "kernels/kernels.cl",
+    "kernels/radix_sort.cl",
+    "kernels/reduce.cl",
+    "kernels/scan.cl",
+    "kernels/sort.cl",
+  };
+  const int num_paths = sizeof(paths) / sizeof(paths[0]);
+
+  Context* ctx = Context::Create(Platform::default_device());
+  {
+    ScopedTimeMeasure m("LoadPrograms");
+    vector<shared_future<Program*> > programs;
+    for (int i = 0; i < num_paths; ++i) {
+      programs.push_back(ctx->CreateProgramAsync(paths[i]));
+    }
+    for (int i = 0; i < num_paths; ++i) {
+      if (programs[i].get() == NULL) printf("Could not load %s\n", paths[i]);
+    }
+  }
+  delete ctx;
+}
+
+// Allocates a transient buffer per request, like a long running service.
+void BufferChurn(int num_requests) {
+  Context* ctx = Context::Create(Platform::default_device());
+  BufferPool* pool = ctx->buffer_pool();
+  {
+    ScopedTimeMeasure m("BufferChurn");
+    for (int i = 0; i < num_requests; ++i) {
+      size_t size = (rand() % 1024 + 1) * 1024;
+      // Goes back to the pool at the end of the request.
+      Ref<Buffer> buffer(ctx, pool->Allocate(Buffer::READ_WRITE, size));
+    }
+  }
+  printf("%s", pool->stats().ToString().c_str());
+  printf("Live objects:\n%s", ctx->LeakReport().c_str());
   delete ctx;
 }
 
@@ -77,18 +220,47 @@ void Map(int num_values, int work_items, int iters,
     kernel->SetArg(1, output_buffer);
   }
 
+  // Launches below don't specify a work group size so they pick up the tuned
+  // one.
+  static WorkGroupTuner tuner(".work_group_sizes");
+  ctx->SetWorkGroupTuner(&tuner);
+  NDRange best(work_items);
+  if (!tuner.Lookup(ctx->device(), kernel, &best)) {
+    ScopedTimeMeasure m("Map tune");
+    tuner.Tune(ctx, kernel, NDRange(work_items), &best);
+  }
+  cout << "Work group size: " << best.ToString() << endl;
+
+  double start_ms = timestamp_ms();
   {
     ScopedTimeMeasure m("Map queue");
     for (int i = 0; i < iters; ++i) {
       ctx->default_queue()->EnqueueKernel(kernel, work_items, -1);
     }
   }
+  printf("Launches: %.0f/s\n", iters * 1000 / (timestamp_ms() - start_ms));
 
   {
     ScopedTimeMeasure m("Map execute");
     output_buffer->Read(ctx->default_queue());
   }
 
+  // The same launches from a LaunchBatch, which shares one clone of the
+  // kernel and creates no events.
+  LaunchBatch batch(ctx);
+  start_ms = timestamp_ms();
+  {
+    ScopedTimeMeasure m("Map batch queue");
+    for (int i = 0; i < iters; ++i) batch.Add(kernel, NDRange(work_items));
+    batch.Submit(ctx->default_queue());
+  }
+  printf("Batch launches: %.0f/s\n", iters * 1000 / (timestamp_ms() - start_ms));
+
+  {
+    ScopedTimeMeasure m("Map batch execute");
+    output_buffer->Read(ctx->default_queue());
+  }
+
   T total = 0;
   for (int i = 0; i < num_values; ++i) {
     total += output[i];
@@ -96,6 +268,216 @@ void Map(int num_values, int work_items, int iters,
   cout << "Result: " << total << endl;
 }
 
+// Runs a chain of four elementwise stages over num_values floats, stage by
+// stage and then fused into one kernel by FusedMap, which reads and writes
+// the values once instead of once per stage.
+void FusedMapBenchmark(int num_values, int iters) {
+  printf("\nRunning: FusedMap\n");
+  vector<float> input(num_values);
+  vector<float> weights(num_values);
+  for (int i = 0; i < num_values; ++i) {
+    input[i] = rand() / (float)RAND_MAX * 10;
+    weights[i] = rand() / (float)RAND_MAX;
+  }
+
+  Context* ctx = Context::Create(Platform::default_device());
+  CommandQueue* queue = ctx->default_queue();
+  const size_t bytes = sizeof(float) * num_values;
+  Buffer* input_buffer = ctx->CreateBuffer(Buffer::READ_ONLY, bytes);
+  Buffer* weights_buffer = ctx->CreateBuffer(Buffer::READ_ONLY, bytes);
+  Buffer* output_buffer = ctx->CreateBuffer(Buffer::READ_WRITE, bytes);
+  input_buffer->CopyFrom(queue, &input[0], bytes);
+  weights_buffer->CopyFrom(queue, &weights[0], bytes);
+
+  const char* exprs[] = { "fabs(x)", "sin(x)", "x * y", "x * x + 1.0f" };
+  const int num_stages = 4;
+  MapChain chain;
+  vector<MapChain> stages(num_stages);
+  for (int i = 0; i < num_stages; ++i) {
+    Buffer* y = i == 2 ? weights_buffer : NULL;
+    chain.Then(exprs[i], y);
+    stages[i].Then(exprs[i], y);
+  }
+  FusedMap* fused = new FusedMap(ctx);
+  printf("Vector width: %d\n", fused->width());
+
+  vector<float> staged_result(num_values);
+  vector<float> fused_result(num_values);
+  {
+    ScopedTimeMeasure m("Map chain by stage");
+    for (int i = 0; i < iters; ++i) {
+      for (int s = 0; s < num_stages; ++s) {
+        fused->Run(stages[s], s == 0 ? input_buffer : output_buffer,
+            output_buffer, num_values);
+      }
+    }
+    queue->Flush();
+  }
+  output_buffer->CopyTo(queue, &staged_result[0], bytes);
+  {
+    ScopedTimeMeasure m("Map chain fused");
+    for (int i = 0; i < iters; ++i) {
+      fused->Run(chain, input_buffer, output_buffer, num_values);
+    }
+    queue->Flush();
+  }
+  output_buffer->CopyTo(queue, &fused_result[0], bytes);
+
+  const size_t num_buffers = chain.buffers().size();
+  printf("Global memory traffic per run: %s by stage, %s fused\n",
+      PrintBytes((2 * num_stages + num_buffers) * bytes).c_str(),
+      PrintBytes((2 + num_buffers) * bytes).c_str());
+  float max_error = 0;
+  for (int i = 0; i < num_values; ++i) {
+    max_error = max(max_error, fabsf(fused_result[i] - staged_result[i]));
+  }
+  printf("Fused map: %s\n", max_error < 1e-5f ? "ok" : "MISMATCH");
+
+  delete fused;
+  delete ctx;
+}
+
+// Runs SimpleKernel on each NUMA node of the cpu device over the node's part
+// of the data, with the buffers on that node.
+void NumaMap(int num_values, int iters) {
+  vector<const DeviceInfo*> nodes;
+  if (Platform::cpu_device() == NULL ||
+      !Platform::CreateSubDevicesByNuma(Platform::cpu_device(), &nodes)) {
+    return;
+  }
+  printf("\nRunning SimpleKernel on %d NUMA nodes\n", (int)nodes.size());
+  const int values_per_node = num_values / nodes.size();
+  float* input = new float[values_per_node];
+  for (int i = 0; i < values_per_node; ++i) {
+    input[i] = rand() / (float)RAND_MAX * 10;
+  }
+
+  vector<Context*> contexts;
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    Context* ctx = Context::Create(nodes[i]);
+    Kernel* kernel = ctx->CreateKernel("kernels/kernels.cl", "SimpleKernel");
+    Buffer* input_buffer = ctx->CreateLocalBuffer(
+        Buffer::READ_ONLY, sizeof(float) * values_per_node);
+    Buffer* output_buffer = ctx->CreateLocalBuffer(
+        Buffer::WRITE_ONLY, sizeof(float) * values_per_node);
+    input_buffer->CopyFrom(ctx->default_queue(), input, sizeof(float) * values_per_node);
+    kernel->SetArg(0, input_buffer);
+    kernel->SetArg(1, output_buffer);
+    for (int j = 0; j < iters; ++j) {
+      ctx->default_queue()->EnqueueKernel(kernel, values_per_node, -1);
+    }
+    contexts.push_back(ctx);
+  }
+
+  {
+    ScopedTimeMeasure m("NumaMap execute");
+    for (size_t i = 0; i < contexts.size(); ++i) {
+      contexts[i]->default_queue()->Submit();
+    }
+    for (size_t i = 0; i < contexts.size(); ++i) {
+      contexts[i]->default_queue()->Flush();
+      delete contexts[i];
+    }
+  }
+  delete[] input;
+}
+
+// SimpleKernel and SimpleKernel4 as packed shim kernels.
+void SimpleKernelPacked(const float* input, float* output) {
+  size_t id = get_global_id(0);
+  pack_store(output + id, sin(fabs(pack_load(input + id))));
+}
+
+void SimpleKernel4Packed(const float4* input, float4* output) {
+  size_t id = get_global_id(0);
+  // The kernel is component-wise, so the pack's float4s are processed as 4
+  // vectors of floats.
+  const float* in = (const float*)(input + id);
+  float* out = (float*)(output + id);
+  const int num_floats = get_pack_lanes() * 4;
+  for (int i = 0; i < 4; ++i) {
+    int lanes = min(max(num_floats - i * SHIM_LANES, 0), SHIM_LANES);
+    pack_store(out + i * SHIM_LANES,
+        sin(fabs(pack_load(in + i * SHIM_LANES, lanes))), lanes);
+  }
+}
+
+// Runs SimpleKernel or SimpleKernel4 on the opencl cpu device (e.g. pocl), and
+// with the shim one work item at a time and packed.
+void ShimMap(int num_values, int iters, const char* kernel_name) {
+  const bool vec4 = strcmp(kernel_name, "SimpleKernel4") == 0;
+  const int work_items = vec4 ? num_values / 4 : num_values;
+  printf("\nRunning: %s (shim)\n", kernel_name);
+  float* input = new float[num_values];
+  float* output = new float[num_values];
+  float* shim_output = new float[num_values];
+  srand(1234);
+  for (int i = 0; i < num_values; ++i) {
+    input[i] = rand() / (float)RAND_MAX * 10;
+  }
+  memset(output, 0, sizeof(float) * num_values);
+
+  if (Platform::cpu_device() != NULL) {
+    Context* ctx = Context::Create(Platform::cpu_device());
+    Kernel* kernel = ctx->CreateKernel("kernels/kernels.cl", kernel_name);
+    Buffer* input_buffer = ctx->CreateBufferFromMem(
+        Buffer::READ_ONLY, input, sizeof(float) * num_values);
+    Buffer* output_buffer = ctx->CreateBufferFromMem(
+        Buffer::WRITE_ONLY, output, sizeof(float) * num_values);
+    kernel->SetArg(0, input_buffer);
+    kernel->SetArg(1, output_buffer);
+    // The first launch includes the compile.
+    ctx->default_queue()->EnqueueKernel(kernel, work_items, -1);
+    ctx->default_queue()->Flush();
+    {
+      ScopedTimeMeasure m("ShimMap cpu device");
+      for (int i = 0; i < iters; ++i) {
+        ctx->default_queue()->EnqueueKernel(kernel, work_items, -1);
+      }
+      output_buffer->Read(ctx->default_queue());
+    }
+    delete ctx;
+  }
+
+  ShimExecutor executor;
+  printf("Threads: %d, lanes: %d\n", executor.num_threads(), SHIM_LANES);
+  {
+    ScopedTimeMeasure m("ShimMap shim");
+    for (int i = 0; i < iters; ++i) {
+      executor.Run(ShimRange(work_items), [&]() {
+        if (vec4) {
+          SimpleKernel4((const float4*)input, (float4*)shim_output);
+        } else {
+          SimpleKernel(input, shim_output);
+        }
+      });
+    }
+  }
+  {
+    ScopedTimeMeasure m("ShimMap shim packed");
+    for (int i = 0; i < iters; ++i) {
+      executor.RunPacked(ShimRange(work_items), [&]() {
+        if (vec4) {
+          SimpleKernel4Packed((const float4*)input, (float4*)shim_output);
+        } else {
+          SimpleKernelPacked(input, shim_output);
+        }
+      });
+    }
+  }
+
+  if (Platform::cpu_device() != NULL) {
+    float max_diff = 0;
+    for (int i = 0; i < num_values; ++i) {
+      max_diff = max(max_diff, fabsf(output[i] - shim_output[i]));
+    }
+    printf("Max difference to the cpu device: %g\n", max_diff);
+  }
+  delete[] input;
+  delete[] output;
+  delete[] shim_output;
+}
+
 void BitonicSort() {
   const int input_size = pow(8, 4) * 4;
   const cl_uint ascending = true;
@@ -105,6 +487,7 @@ void BitonicSort() {
   for (int i = 0; i < input_size; ++i) {
     input[i] = rand() % 999;
   }
+  vector<int> unsorted(input, input + input_size);
   memcpy(ref, input, sizeof(int) * input_size);
   sort(ref, ref + input_size);
 
@@ -117,6 +500,7 @@ void BitonicSort() {
   {
     ScopedTimeMeasure m("BitonicSort setup");
     ctx = Context::Create(Platform::default_device());
+    ctx->EnableProgramCache(".clcache");
     kernel = ctx->CreateKernel("kernels/bitonic_sort.cl", "BitonicSort");
     buffer = ctx->CreateBufferFromMem(
         Buffer::READ_WRITE, input, sizeof(int) * input_size);
@@ -125,27 +509,147 @@ void BitonicSort() {
     kernel->SetArg(3, ascending);
   }
 
+  // The same launches one by one, then recorded in a LaunchBatch.
+  LaunchBatch* batch = new LaunchBatch(ctx);
+  const char* labels[] = { "BitonicSort queue", "BitonicSort batch queue" };
+  for (int batched = 0; batched < 2; ++batched) {
+    buffer->CopyFrom(ctx->default_queue(), &unsorted[0], sizeof(int) * input_size);
+    int launches = 0;
+    const double start_ms = timestamp_ms();
+    {
+      ScopedTimeMeasure m(labels[batched]);
+      for (int stage = 0; stage < num_stages; ++stage) {
+        kernel->SetArg(1, (cl_uint)stage);
+        for (int pass_of_stage = stage; pass_of_stage >= 0; --pass_of_stage) {
+          kernel->SetArg(2, (cl_uint)pass_of_stage);
+          size_t global_size = input_size / (2 * 4);
+          if (pass_of_stage == 0) global_size = global_size << 1;
+          if (batched) {
+            batch->Add(kernel, NDRange(global_size));
+          } else {
+            ctx->default_queue()->EnqueueKernel(kernel, global_size, -1);
+          }
+          ++launches;
+        }
+      }
+      if (batched) batch->Submit(ctx->default_queue());
+    }
+    printf("%d launches: %.0f launches/s\n", launches,
+        launches * 1000 / (timestamp_ms() - start_ms));
+
+    {
+      ScopedTimeMeasure m("BitonicSort execute");
+      buffer->Read(ctx->default_queue());
+    }
+
+    for (int i = 0; i < input_size; ++i) {
+      assert(input[i] == ref[i]);
+    }
+  }
+
+  // Once recorded, a batch launches again without setting any arguments.
+  buffer->CopyFrom(ctx->default_queue(), &unsorted[0], sizeof(int) * input_size);
+  const double start_ms = timestamp_ms();
+  {
+    ScopedTimeMeasure m("BitonicSort batch resubmit");
+    batch->Submit(ctx->default_queue());
+  }
+  printf("%d launches: %.0f launches/s\n", (int)batch->size(),
+      batch->size() * 1000 / (timestamp_ms() - start_ms));
+  buffer->Read(ctx->default_queue());
+  for (int i = 0; i < input_size; ++i) {
+    assert(input[i] == ref[i]);
+  }
+  delete batch;
+  delete ctx;
+}
+
+// Runs the stages of BitonicSort with the shim.
+void ShimBitonicSort() {
+  const int input_size = pow(8, 4) * 4;
+  const cl_uint ascending = true;
+  vector<int> data(input_size);
+  for (int i = 0; i < input_size; ++i) data[i] = rand() % 999;
+  vector<int> ref(data);
+  sort(ref.begin(), ref.end());
+
+  int num_stages = 0;
+  for (int i = input_size; i > 2; i >>= 1) ++num_stages;
+
+  ShimExecutor executor;
   {
-    ScopedTimeMeasure m("BitonicSort queue");
+    ScopedTimeMeasure m("BitonicSort shim");
     for (int stage = 0; stage < num_stages; ++stage) {
-      kernel->SetArg(1, (cl_uint)stage);
       for (int pass_of_stage = stage; pass_of_stage >= 0; --pass_of_stage) {
-        kernel->SetArg(2, (cl_uint)pass_of_stage);
         size_t global_size = input_size / (2 * 4);
         if (pass_of_stage == 0) global_size = global_size << 1;
-        ctx->default_queue()->EnqueueKernel(kernel, global_size, -1);
+        executor.Run(ShimRange(global_size), [&]() {
+          BitonicSort((int4*)&data[0], stage, pass_of_stage, ascending);
+        });
       }
     }
   }
+  printf("BitonicSort shim: %s\n", data == ref ? "ok" : "MISMATCH");
+}
 
+// Times Sorter on size random uint keys with each algorithm, and with
+// values, against std::sort.
+void SortBenchmark(size_t size) {
+  vector<cl_uint> keys(size);
+  for (size_t i = 0; i < size; ++i) keys[i] = rand();
+  vector<cl_uint> ref(keys);
   {
-    ScopedTimeMeasure m("BitonicSort execute");
-    buffer->Read(ctx->default_queue());
+    ScopedTimeMeasure m("std::sort");
+    sort(ref.begin(), ref.end());
   }
 
-  for (int i = 0; i < input_size; ++i) {
-    assert(input[i] == ref[i]);
+  Context* ctx = Context::Create(Platform::default_device());
+  CommandQueue* queue = ctx->default_queue();
+  const size_t bytes = size * sizeof(cl_uint);
+  Buffer* key_buffer = ctx->CreateBuffer(Buffer::READ_WRITE, bytes);
+  Buffer* value_buffer = ctx->CreateBuffer(Buffer::READ_WRITE, bytes);
+  Sorter<cl_uint>* sorter = Sorter<cl_uint>::Create(ctx);
+  Sorter<cl_uint, cl_uint>* pair_sorter = Sorter<cl_uint, cl_uint>::Create(ctx);
+  if (sorter == NULL || pair_sorter == NULL) {
+    printf("Could not create the sorters.\n");
+    delete sorter;
+    delete pair_sorter;
+    delete ctx;
+    return;
+  }
+
+  const SortAlgorithm algorithms[] = { SORT_BITONIC, SORT_RADIX, SORT_AUTO };
+  const char* names[] = { "Sorter bitonic", "Sorter radix", "Sorter auto" };
+  vector<cl_uint> result(size);
+  for (int i = 0; i < 3; ++i) {
+    sorter->set_algorithm(algorithms[i]);
+    key_buffer->CopyFrom(queue, &keys[0], bytes);
+    {
+      ScopedTimeMeasure m(names[i]);
+      sorter->Run(key_buffer, size);
+      queue->Flush();
+    }
+    key_buffer->CopyTo(queue, &result[0], bytes);
+    printf("%s: %s\n", names[i], result == ref ? "ok" : "MISMATCH");
   }
+
+  // The values are the original positions, so they give back the keys.
+  vector<cl_uint> values(size);
+  for (size_t i = 0; i < size; ++i) values[i] = i;
+  key_buffer->CopyFrom(queue, &keys[0], bytes);
+  value_buffer->CopyFrom(queue, &values[0], bytes);
+  {
+    ScopedTimeMeasure m("Sorter keys and values, descending");
+    pair_sorter->Run(key_buffer, value_buffer, size, true);
+    queue->Flush();
+  }
+  value_buffer->CopyTo(queue, &values[0], bytes);
+  bool ok = true;
+  for (size_t i = 0; i < size; ++i) ok &= keys[values[i]] == ref[size - 1 - i];
+  printf("Keys and values: %s\n", ok ? "ok" : "MISMATCH");
+
+  delete sorter;
+  delete pair_sorter;
   delete ctx;
 }
 
@@ -155,10 +659,20 @@ int main(int argc, char** argv) {
     Platform::Init();
   }
 
-  ArraySum();
+  ArraySum(64 * 1024 * 1024, 10);
+//  LoadPrograms();
+//  ScanBenchmark(64 * 1024 * 1024, 10);
+//  BufferChurn(100000);
 //  BitonicSort();
+//  ShimBitonicSort();
+//  SortBenchmark(1024 * 1024);
+//  SortBenchmark(256 * 1024 * 1024);
+//  NumaMap(64 * 1024 * 1024, 100);
 //  Map<float>(1024 * 1024, 1024 * 1024, 10000, "kernels/kernels.cl", "SimpleKernel");
 //  Map<float>(1024 * 1024, 1024 * 1024 / 4, 10000, "kernels/kernels.cl", "SimpleKernel4");
+//  FusedMapBenchmark(16 * 1024 * 1024, 20);
+//  ShimMap(16 * 1024 * 1024, 20, "SimpleKernel");
+//  ShimMap(16 * 1024 * 1024, 20, "SimpleKernel4");
 
   printf("Done.\n");
   return 0;
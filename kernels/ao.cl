@@ -157,13 +157,12 @@ inline float AmbientOcclusion(float px, float py,
 }
 
 kernel void TracePixel(global float *fimg, 
-    constant Sphere* spheres, constant Plane* planes, int h, int w, 
+    constant Sphere* spheres, Plane plane, int h, int w, 
     int nsubsamples, int nao_samples) {
-  long gid = get_global_id(0);
-  int x = gid % w;
-  int y = gid / w;
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+  long gid = y * w + x;
 
-  Plane plane = planes[0];
   long seed = gid;
 
   for (int v = 0; v <  nsubsamples; ++v) {
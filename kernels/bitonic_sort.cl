@@ -19,6 +19,16 @@
 // problem reports or change requests be submitted to it directly
 
 
+// Vector literals don't compile as c++, see shim/vector_types.h.
+inline int4 to_int4(int x, int y, int z, int w) {
+  int4 result;
+  result.x = x;
+  result.y = y;
+  result.z = z;
+  result.w = w;
+  return result;
+}
+
 __kernel void /*__attribute__((vec_type_hint(int4)))*/ BitonicSort(
     __global int4* theArray,
     const uint stage,
@@ -26,8 +36,8 @@ __kernel void /*__attribute__((vec_type_hint(int4)))*/ BitonicSort(
     const uint ascending) {
   size_t i = get_global_id(0);
   int4 srcLeft, srcRight, mask;
-  int4 imask10 = (int4)(0,  0, -1, -1);
-  int4 imask11 = (int4)(0, -1,  0, -1);
+  int4 imask10 = to_int4(0,  0, -1, -1);
+  int4 imask11 = to_int4(0, -1,  0, -1);
 
   if (stage > 0) {
     if (passOfStage > 0) {    // upper level pass, exchange between two fours
@@ -69,7 +79,7 @@ __kernel void /*__attribute__((vec_type_hint(int4)))*/ BitonicSort(
     }
   }
   else {    // first stage, sort inside one four
-    int4 imask0 = (int4)(0, -1, -1,  0);
+    int4 imask0 = to_int4(0, -1, -1,  0);
     srcLeft = theArray[i];
     srcRight = srcLeft.yxwz;
     mask = (srcLeft < srcRight) ^ imask0;
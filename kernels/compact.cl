@@ -0,0 +1,41 @@
+// Stream compaction of input[0, n) by the predicate PRED(x). The host
+// (core/scan.h) defines:
+//   T        The element type.
+//   PRED(x)  True for the values to keep.
+// compact_flags marks the kept values, an exclusive scan of the flags gives
+// their positions in the output and compact_scatter moves them there.
+
+#ifndef T
+#define T int
+#define PRED(x) ((x) != 0)
+#endif
+
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+__kernel void compact_flags(__global const T* input, ulong n,
+    __global uint* flags) {
+  const size_t i = get_global_id(0);
+  if (i < n) flags[i] = PRED(input[i]) ? 1 : 0;
+}
+
+// Writes the kept values to output[0, count) in order. If partition is set,
+// the other values follow them, also in order. count is written by the last
+// work item.
+__kernel void compact_scatter(__global const T* input, ulong n,
+    __global const uint* positions, uint partition, __global T* output,
+    __global uint* count) {
+  const size_t i = get_global_id(0);
+  if (i >= n) return;
+  const T x = input[i];
+  const uint pos = positions[i];
+  const bool keep = PRED(x);
+  if (i == n - 1) *count = pos + (keep ? 1 : 0);
+  if (keep) {
+    output[pos] = x;
+  } else if (partition) {
+    const uint total = positions[n - 1] + (PRED(input[n - 1]) ? 1 : 0);
+    output[total + i - pos] = x;
+  }
+}
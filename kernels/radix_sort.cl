@@ -0,0 +1,94 @@
+// One pass of an LSD radix sort: radix_count counts the digits at shift of
+// each block of keys, an exclusive scan of the counts (bucket major, so all
+// blocks of digit 0 come first) gives every block the output position of
+// each digit, and radix_scatter moves the keys there. Every work item is one
+// block of chunk consecutive keys and handles it in order, so each pass is
+// stable. The host (core/sort.h) defines:
+//   K            The key type.
+//   KEY_BITS     32 or 64, the size of K.
+//   KEY_SIGNED   If K is a signed integer type.
+//   KEY_FLOAT    If K is a floating point type.
+//   V            The value type, if the sort has values.
+//   RADIX_BITS   Bits per digit.
+// desc selects descending order at run time.
+
+#ifndef K
+#define K uint
+#define KEY_BITS 32
+#define RADIX_BITS 8
+#endif
+
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+#ifdef V
+#define HAS_VALUES
+#else
+// Without values the value arguments are unused.
+#define V uint
+#endif
+
+// The unsigned integer type of the size of K.
+#if KEY_BITS == 64
+#define UK ulong
+#define AS_UK as_ulong
+#else
+#define UK uint
+#define AS_UK as_uint
+#endif
+
+#define RADIX (1 << RADIX_BITS)
+#define SIGN_BIT ((UK)1 << (KEY_BITS - 1))
+
+// Returns the digit at shift of the unsigned key that sorts like key.
+inline uint digit(K key, uint shift, uint desc) {
+#if defined(KEY_FLOAT)
+  // Negative floats sort in the reverse order of their bits.
+  UK bits = AS_UK(key);
+  bits = (bits & SIGN_BIT) ? ~bits : bits | SIGN_BIT;
+#elif defined(KEY_SIGNED)
+  UK bits = (UK)key ^ SIGN_BIT;
+#else
+  UK bits = key;
+#endif
+  const uint d = (uint)(bits >> shift) & (RADIX - 1);
+  return desc ? RADIX - 1 - d : d;
+}
+
+// hist has RADIX uints per work item. counts has RADIX * blocks uints.
+__kernel void radix_count(__global const K* keys, ulong n, ulong chunk,
+    uint shift, uint desc, __local uint* hist, __global uint* counts) {
+  const size_t block = get_global_id(0);
+  const size_t blocks = get_global_size(0);
+  __local uint* h = hist + get_local_id(0) * RADIX;
+  for (uint d = 0; d < RADIX; ++d) h[d] = 0;
+
+  const ulong start = min(block * chunk, n);
+  const ulong end = min(start + chunk, n);
+  for (ulong i = start; i < end; ++i) ++h[digit(keys[i], shift, desc)];
+
+  for (uint d = 0; d < RADIX; ++d) counts[d * blocks + block] = h[d];
+}
+
+// positions are the scanned counts. in_keys and out_keys must differ.
+__kernel void radix_scatter(__global const K* in_keys,
+    __global const V* in_values, __global K* out_keys, __global V* out_values,
+    ulong n, ulong chunk, uint shift, uint desc, __local uint* hist,
+    __global const uint* positions) {
+  const size_t block = get_global_id(0);
+  const size_t blocks = get_global_size(0);
+  __local uint* next = hist + get_local_id(0) * RADIX;
+  for (uint d = 0; d < RADIX; ++d) next[d] = positions[d * blocks + block];
+
+  const ulong start = min(block * chunk, n);
+  const ulong end = min(start + chunk, n);
+  for (ulong i = start; i < end; ++i) {
+    const K key = in_keys[i];
+    const uint pos = next[digit(key, shift, desc)]++;
+    out_keys[pos] = key;
+#ifdef HAS_VALUES
+    out_values[pos] = in_values[i];
+#endif
+  }
+}
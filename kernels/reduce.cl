@@ -0,0 +1,72 @@
+// Reduces input[0, n) to one value per work group with the associative op
+// OP(a, b). The host (core/reduce.h) defines:
+//   T         The element type.
+//   OP(a, b)  Combines two values, must also work on vectors of T.
+//   IDENTITY  The value x with OP(x, a) == a.
+//   VEC       The vector width of the loads, 1, 2, 4, 8 or 16.
+// Defaults are a float sum. The local size must be a power of two.
+
+#ifndef T
+#define T float
+#define OP(a, b) ((a) + (b))
+#define IDENTITY 0
+#define VEC 4
+#endif
+
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+#define CAT_(a, b) a##b
+#define CAT(a, b) CAT_(a, b)
+
+#if VEC == 1
+typedef T TV;
+#define LOAD(i, p) (p)[i]
+#define FOLD(v) (v)
+#else
+typedef CAT(T, VEC) TV;
+#define LOAD(i, p) CAT(vload, VEC)(i, p)
+#endif
+
+#if VEC == 2
+#define FOLD(v) OP((v).s0, (v).s1)
+#elif VEC == 4
+#define FOLD(v) OP(OP((v).s0, (v).s1), OP((v).s2, (v).s3))
+#elif VEC == 8
+#define FOLD(v) OP(OP(OP((v).s0, (v).s1), OP((v).s2, (v).s3)), \
+    OP(OP((v).s4, (v).s5), OP((v).s6, (v).s7)))
+#elif VEC == 16
+#define FOLD(v) OP(OP(OP(OP((v).s0, (v).s1), OP((v).s2, (v).s3)), \
+    OP(OP((v).s4, (v).s5), OP((v).s6, (v).s7))), \
+    OP(OP(OP((v).s8, (v).s9), OP((v).sa, (v).sb)), \
+    OP(OP((v).sc, (v).sd), OP((v).se, (v).sf))))
+#endif
+
+__kernel void reduce(__global const T* input, ulong n, __local T* scratch,
+    __global T* output) {
+  const size_t lid = get_local_id(0);
+  const size_t stride = get_global_size(0);
+
+  // Each work item first combines a strided slice of the input in registers,
+  // so the launch can be much smaller than n. Consecutive work items load
+  // consecutive vectors.
+  TV acc = (TV)(IDENTITY);
+  const ulong num_vecs = n / VEC;
+  for (ulong i = get_global_id(0); i < num_vecs; i += stride) {
+    acc = OP(acc, LOAD(i, input));
+  }
+  T sum = FOLD(acc);
+  for (ulong i = num_vecs * VEC + get_global_id(0); i < n; i += stride) {
+    sum = OP(sum, input[i]);
+  }
+
+  // Tree reduction of the work group in local memory.
+  scratch[lid] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (size_t s = get_local_size(0) / 2; s > 0; s >>= 1) {
+    if (lid < s) scratch[lid] = OP(scratch[lid], scratch[lid + s]);
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (lid == 0) output[get_group_id(0)] = scratch[0];
+}
@@ -0,0 +1,99 @@
+// Prefix sums of T over input[0, n), in tiles of get_local_size(0) * ITEMS
+// values per work group. The host (core/scan.h) defines:
+//   T      The element type.
+//   ITEMS  Consecutive values scanned by each work item.
+// A device wide scan is a scan_reduce of every tile, a scan of the tile sums
+// and a scan_tiles that adds the scanned tile sums. The local size must be a
+// power of two.
+
+#ifndef T
+#define T int
+#define ITEMS 8
+#endif
+
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+// Writes the sum of each tile to tile_sums. scratch has a T per work item.
+__kernel void scan_reduce(__global const T* input, ulong n,
+    __local T* scratch, __global T* tile_sums) {
+  const size_t lid = get_local_id(0);
+  const size_t local_size = get_local_size(0);
+  const ulong start = (ulong)get_group_id(0) * local_size * ITEMS;
+
+  T sum = 0;
+  for (int k = 0; k < ITEMS; ++k) {
+    const ulong i = start + k * local_size + lid;
+    if (i < n) sum += input[i];
+  }
+
+  scratch[lid] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (size_t s = local_size / 2; s > 0; s >>= 1) {
+    if (lid < s) scratch[lid] += scratch[lid + s];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (lid == 0) tile_sums[get_group_id(0)] = scratch[0];
+}
+
+// Scans each tile and adds tile_offsets[tile] to it, if use_offsets is set.
+// output may be input. scratch has ITEMS + 1 T per work item.
+__kernel void scan_tiles(__global const T* input, ulong n,
+    __local T* scratch, __global const T* tile_offsets, uint use_offsets,
+    uint inclusive, __global T* output) {
+  const size_t lid = get_local_id(0);
+  const size_t local_size = get_local_size(0);
+  const ulong start = (ulong)get_group_id(0) * local_size * ITEMS;
+  __local T* sums = scratch + local_size * ITEMS;
+
+  // Coalesced load of the tile.
+  for (int k = 0; k < ITEMS; ++k) {
+    const ulong i = start + k * local_size + lid;
+    scratch[k * local_size + lid] = i < n ? input[i] : 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  // Each work item scans its values serially...
+  __local T* values = scratch + lid * ITEMS;
+  T sum = 0;
+  for (int k = 0; k < ITEMS; ++k) {
+    const T v = values[k];
+    if (inclusive) {
+      sum += v;
+      values[k] = sum;
+    } else {
+      values[k] = sum;
+      sum += v;
+    }
+  }
+  sums[lid] = sum;
+
+  // ... and the work group scans the sums of the work items (Blelloch).
+  for (size_t d = 1; d < local_size; d <<= 1) {
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const size_t i = (lid + 1) * d * 2 - 1;
+    if (i < local_size) sums[i] += sums[i - d];
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if (lid == 0) sums[local_size - 1] = 0;
+  for (size_t d = local_size / 2; d > 0; d >>= 1) {
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const size_t i = (lid + 1) * d * 2 - 1;
+    if (i < local_size) {
+      const T t = sums[i - d];
+      sums[i - d] = sums[i];
+      sums[i] += t;
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const T offset = sums[lid] + (use_offsets ? tile_offsets[get_group_id(0)] : 0);
+  for (int k = 0; k < ITEMS; ++k) values[k] += offset;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int k = 0; k < ITEMS; ++k) {
+    const ulong i = start + k * local_size + lid;
+    if (i < n) output[i] = scratch[k * local_size + lid];
+  }
+}
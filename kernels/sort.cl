@@ -0,0 +1,155 @@
+// Sorts keys, and optionally values with them, in two steps: sort_tiles sorts
+// tiles of 2 * get_local_size(0) keys with a bitonic network in local memory,
+// then merge_runs passes merge pairs of sorted runs until one is left. The
+// host (core/sort.h) defines:
+//   K             The key type.
+//   KEY_MAX       The largest and lowest keys, which pad the last tile.
+//   KEY_LOWEST
+//   V             The value type, if the sort has values.
+//   MERGE_ITEMS   Outputs merged by each work item of merge_runs.
+// desc selects descending order at run time. Sorts with values are stable.
+// The local size of sort_tiles must be a power of two.
+
+#ifndef K
+#define K uint
+#define KEY_MAX UINT_MAX
+#define KEY_LOWEST 0
+#endif
+#ifndef MERGE_ITEMS
+#define MERGE_ITEMS 32
+#endif
+
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+#ifdef V
+#define HAS_VALUES
+#else
+// Without values the value arguments are unused.
+#define V uint
+#endif
+
+// Whether x goes before y.
+inline bool before(K x, K y, uint desc) {
+  return desc ? x > y : x < y;
+}
+
+// Sorts each tile of in_keys into out_keys, which may be in_keys. lkeys has
+// 2 * get_local_size(0) keys. With values, lindex has as many uints and keeps
+// where each key came from, which breaks ties so the sort is stable and the
+// padding stays behind equal keys.
+__kernel void sort_tiles(__global const K* in_keys,
+    __global const V* in_values, __global K* out_keys, __global V* out_values,
+    ulong n, uint desc, __local K* lkeys, __local uint* lindex) {
+  const uint lid = get_local_id(0);
+  const uint local_size = get_local_size(0);
+  const uint tile = local_size * 2;
+  const ulong start = (ulong)get_group_id(0) * tile;
+  const K pad = desc ? KEY_LOWEST : KEY_MAX;
+
+  for (uint r = 0; r < 2; ++r) {
+    const uint i = r * local_size + lid;
+    lkeys[i] = start + i < n ? in_keys[start + i] : pad;
+#ifdef HAS_VALUES
+    lindex[i] = i;
+#endif
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint size = 2; size <= tile; size <<= 1) {
+    // Merges of size keys alternate between the requested and the reverse
+    // order, the last one sorts the whole tile.
+    const bool reverse = (lid & (size / 2)) != 0;
+    for (uint stride = size / 2; stride > 0; stride >>= 1) {
+      const uint a = 2 * lid - (lid & (stride - 1));
+      const uint b = a + stride;
+      const K ka = lkeys[a];
+      const K kb = lkeys[b];
+#ifdef HAS_VALUES
+      const uint ia = lindex[a];
+      const uint ib = lindex[b];
+      if ((ka == kb ? ib < ia : before(kb, ka, desc)) != reverse) {
+        lindex[a] = ib;
+        lindex[b] = ia;
+#else
+      if (ka != kb && before(kb, ka, desc) != reverse) {
+#endif
+        lkeys[a] = kb;
+        lkeys[b] = ka;
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+    }
+  }
+
+#ifdef HAS_VALUES
+  // Gather the values before any are overwritten when sorting in place.
+  V values[2];
+  for (uint r = 0; r < 2; ++r) {
+    const uint i = r * local_size + lid;
+    if (start + i < n) values[r] = in_values[start + lindex[i]];
+  }
+  barrier(CLK_GLOBAL_MEM_FENCE);
+#endif
+  for (uint r = 0; r < 2; ++r) {
+    const uint i = r * local_size + lid;
+    if (start + i < n) {
+      out_keys[start + i] = lkeys[i];
+#ifdef HAS_VALUES
+      out_values[start + i] = values[r];
+#endif
+    }
+  }
+}
+
+// Merges pairs of sorted runs of width keys of in_keys into runs of
+// 2 * width keys of out_keys. Each work item finds where its outputs start in
+// the two runs with a binary search (merge path) and merges MERGE_ITEMS
+// outputs from there, going on into the next pairs of runs if they are
+// shorter than that. Ties take the first run, which keeps the sort stable.
+__kernel void merge_runs(__global const K* in_keys,
+    __global const V* in_values, __global K* out_keys, __global V* out_values,
+    ulong n, ulong width, uint desc) {
+  ulong o = (ulong)get_global_id(0) * MERGE_ITEMS;
+  const ulong last = min(o + MERGE_ITEMS, n);
+  while (o < last) {
+    const ulong a_start = o / (2 * width) * 2 * width;
+    const ulong a_len = min(width, n - a_start);
+    const ulong b_start = a_start + a_len;
+    const ulong b_len = min(width, n - b_start);
+    __global const K* a = in_keys + a_start;
+    __global const K* b = in_keys + b_start;
+
+    // The number of keys of a in the first k outputs of the merge.
+    const ulong k = o - a_start;
+    ulong lo = k > b_len ? k - b_len : 0;
+    ulong hi = min(k, a_len);
+    while (lo < hi) {
+      const ulong mid = (lo + hi) / 2;
+      if (before(b[k - mid - 1], a[mid], desc)) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    ulong i = lo;
+    ulong j = k - lo;
+
+    const ulong end = min(last, b_start + b_len);
+    for (; o < end; ++o) {
+      if (j >= b_len || (i < a_len && !before(b[j], a[i], desc))) {
+        out_keys[o] = a[i];
+#ifdef HAS_VALUES
+        out_values[o] = in_values[a_start + i];
+#endif
+        ++i;
+      } else {
+        out_keys[o] = b[j];
+#ifdef HAS_VALUES
+        out_values[o] = in_values[b_start + j];
+#endif
+        ++j;
+      }
+    }
+  }
+}
@@ -0,0 +1,297 @@
+#include "shim/executor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+
+#include <algorithm>
+
+#include "shim/packed.h"
+
+using namespace std;
+
+thread_local ShimWorkItem shim_work_item;
+
+namespace {
+
+// Local memory of the work group run by this thread, by argument index. The
+// memory is kept for the next work groups.
+thread_local vector<vector<char> >* local_mem = NULL;
+
+// Fibers of the work group run by this thread, if it uses barriers.
+struct Fibers {
+  ucontext_t scheduler;
+  vector<ucontext_t> items;
+  vector<bool> done;
+  vector<char> stacks;
+  size_t current;
+  const ShimExecutor::WorkItemFn* fn;
+};
+thread_local Fibers* fibers = NULL;
+
+void SetLocalId(size_t index) {
+  ShimWorkItem& item = shim_work_item;
+  item.local_id[0] = index % item.local_size[0];
+  item.local_id[1] = index / item.local_size[0] % item.local_size[1];
+  item.local_id[2] = index / (item.local_size[0] * item.local_size[1]);
+  for (int i = 0; i < 3; ++i) {
+    item.global_id[i] =
+        item.offset[i] + item.group_id[i] * item.local_size[i] + item.local_id[i];
+  }
+}
+
+void FiberMain() {
+  Fibers* f = fibers;
+  (*f->fn)();
+  f->done[f->current] = true;
+  // Returns to the scheduler through uc_link.
+}
+
+}
+
+void barrier(int) {
+  if (fibers == NULL) {
+    if (shim_work_item.local_size[0] * shim_work_item.local_size[1] *
+        shim_work_item.local_size[2] == 1) {
+      return;
+    }
+    fprintf(stderr, "barrier() called by a kernel run without barriers\n");
+    abort();
+  }
+  swapcontext(&fibers->items[fibers->current], &fibers->scheduler);
+}
+
+void* ShimLocalMem(int index, size_t bytes) {
+  if (local_mem == NULL) local_mem = new vector<vector<char> >();
+  if ((int)local_mem->size() <= index) local_mem->resize(index + 1);
+  vector<char>& mem = (*local_mem)[index];
+  if (mem.size() < bytes) mem.resize(bytes);
+  return &mem[0];
+}
+
+ShimRange::ShimRange(size_t x) : dims(1), has_local(false) {
+  global[0] = x; global[1] = global[2] = 1;
+  local[0] = local[1] = local[2] = 1;
+  offset[0] = offset[1] = offset[2] = 0;
+}
+
+ShimRange::ShimRange(size_t x, size_t y) : dims(2), has_local(false) {
+  global[0] = x; global[1] = y; global[2] = 1;
+  local[0] = local[1] = local[2] = 1;
+  offset[0] = offset[1] = offset[2] = 0;
+}
+
+ShimRange::ShimRange(size_t x, size_t y, size_t z) : dims(3), has_local(false) {
+  global[0] = x; global[1] = y; global[2] = z;
+  local[0] = local[1] = local[2] = 1;
+  offset[0] = offset[1] = offset[2] = 0;
+}
+
+ShimRange& ShimRange::set_local(size_t x, size_t y, size_t z) {
+  local[0] = x;
+  local[1] = dims > 1 ? y : 1;
+  local[2] = dims > 2 ? z : 1;
+  has_local = true;
+  return *this;
+}
+
+ShimRange& ShimRange::set_offset(size_t x, size_t y, size_t z) {
+  offset[0] = x;
+  offset[1] = dims > 1 ? y : 0;
+  offset[2] = dims > 2 ? z : 0;
+  return *this;
+}
+
+ShimExecutor::ShimExecutor(int num_threads)
+  : launch_(NULL), generation_(0), running_(0), shutdown_(false) {
+  if (num_threads <= 0) num_threads = std::max(1u, thread::hardware_concurrency());
+  // The calling thread is one of the threads.
+  for (int i = 1; i < num_threads; ++i) {
+    threads_.push_back(thread(&ShimExecutor::ThreadMain, this));
+  }
+}
+
+ShimExecutor::~ShimExecutor() {
+  {
+    lock_guard<mutex> l(lock_);
+    shutdown_ = true;
+  }
+  start_cv_.notify_all();
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    threads_[i].join();
+  }
+}
+
+void ShimExecutor::ThreadMain() {
+  int generation = 0;
+  for (;;) {
+    Launch* launch;
+    {
+      unique_lock<mutex> l(lock_);
+      start_cv_.wait(l, [&]() { return shutdown_ || generation_ != generation; });
+      if (shutdown_) return;
+      generation = generation_;
+      launch = launch_;
+    }
+    RunGroups(launch);
+    {
+      lock_guard<mutex> l(lock_);
+      --running_;
+    }
+    done_cv_.notify_all();
+  }
+}
+
+bool ShimExecutor::Run(const ShimRange& range, const WorkItemFn& fn,
+    bool uses_barriers, size_t stack_size) {
+  Launch launch(range);
+  ShimRange& r = launch.range;
+  if (!r.has_local) {
+    // Without barriers the work group size only groups work items per thread,
+    // so rows of up to 64 items keep the overhead low.
+    r.local[0] = 1;
+    while (r.local[0] < 64 && r.global[0] % (r.local[0] * 2) == 0) r.local[0] *= 2;
+    r.local[1] = r.local[2] = 1;
+  }
+  launch.fn = &fn;
+  launch.uses_barriers = uses_barriers;
+  launch.stack_size = stack_size;
+  launch.lanes = 1;
+  launch.partial_groups = false;
+  return Start(&launch);
+}
+
+bool ShimExecutor::RunPacked(const ShimRange& range, const WorkItemFn& fn) {
+  Launch launch(range);
+  ShimRange& r = launch.range;
+  launch.partial_groups = !r.has_local;
+  if (!r.has_local) {
+    // Rows of whole packs. The last work group along x stops at the global
+    // size, so only its last pack can be partial.
+    const size_t max_row = std::max(SHIM_LANES, 256 / SHIM_LANES * SHIM_LANES);
+    const size_t packs = (r.global[0] + SHIM_LANES - 1) / SHIM_LANES;
+    r.local[0] = std::max<size_t>(SHIM_LANES,
+        std::min<size_t>(max_row, packs * SHIM_LANES));
+    r.local[1] = r.local[2] = 1;
+  }
+  launch.fn = &fn;
+  launch.uses_barriers = false;
+  launch.stack_size = 0;
+  launch.lanes = SHIM_LANES;
+  return Start(&launch);
+}
+
+bool ShimExecutor::Start(Launch* launch) {
+  const ShimRange& r = launch->range;
+  for (int i = 0; i < 3; ++i) {
+    if (i == 0 && launch->partial_groups && r.local[0] > 0) {
+      launch->num_groups[0] = (r.global[0] + r.local[0] - 1) / r.local[0];
+      continue;
+    }
+    if (r.local[i] == 0 || r.global[i] % r.local[i] != 0) {
+      fprintf(stderr, "Could not run shim kernel: global size %lu is not a "
+          "multiple of the local size %lu\n", (unsigned long)r.global[i],
+          (unsigned long)r.local[i]);
+      return false;
+    }
+    launch->num_groups[i] = r.global[i] / r.local[i];
+  }
+  launch->total_groups =
+      launch->num_groups[0] * launch->num_groups[1] * launch->num_groups[2];
+  launch->next_group = 0;
+  if (launch->total_groups == 0) return true;
+
+  {
+    lock_guard<mutex> l(lock_);
+    launch_ = launch;
+    running_ = threads_.size();
+    ++generation_;
+  }
+  start_cv_.notify_all();
+  RunGroups(launch);
+
+  unique_lock<mutex> l(lock_);
+  done_cv_.wait(l, [&]() { return running_ == 0; });
+  launch_ = NULL;
+  return true;
+}
+
+void ShimExecutor::RunGroups(Launch* launch) {
+  ShimWorkItem& item = shim_work_item;
+  const ShimRange& r = launch->range;
+  item.dims = r.dims;
+  item.lanes = 1;
+  for (int i = 0; i < 3; ++i) {
+    item.global_size[i] = r.global[i];
+    item.local_size[i] = r.local[i];
+    item.num_groups[i] = launch->num_groups[i];
+    item.offset[i] = r.offset[i];
+  }
+
+  Fibers thread_fibers;
+  if (launch->uses_barriers) {
+    const size_t group_items = r.local[0] * r.local[1] * r.local[2];
+    thread_fibers.items.resize(group_items);
+    thread_fibers.done.resize(group_items);
+    thread_fibers.stacks.resize(group_items * launch->stack_size);
+    thread_fibers.fn = launch->fn;
+    fibers = &thread_fibers;
+  }
+
+  for (;;) {
+    size_t group = launch->next_group++;
+    if (group >= launch->total_groups) break;
+    RunGroup(launch, group);
+  }
+  fibers = NULL;
+}
+
+void ShimExecutor::RunGroup(Launch* launch, size_t group) {
+  ShimWorkItem& item = shim_work_item;
+  item.group_id[0] = group % launch->num_groups[0];
+  item.group_id[1] = group / launch->num_groups[0] % launch->num_groups[1];
+  item.group_id[2] = group / (launch->num_groups[0] * launch->num_groups[1]);
+  const size_t group_items = item.local_size[0] * item.local_size[1] * item.local_size[2];
+
+  if (fibers == NULL) {
+    // Packs end at the end of each row of the work group, or at the global
+    // size for partial groups.
+    const size_t row = std::min(item.local_size[0],
+        item.global_size[0] - item.group_id[0] * item.local_size[0]);
+    for (size_t i = 0; i < group_items;) {
+      SetLocalId(i);
+      if (item.local_id[0] >= row) {
+        i += item.local_size[0] - item.local_id[0];
+        continue;
+      }
+      item.lanes = (int)std::min<size_t>(launch->lanes, row - item.local_id[0]);
+      (*launch->fn)();
+      i += item.lanes;
+    }
+    return;
+  }
+
+  // Start a fiber per work item, then switch between them until all are
+  // done. Work items yield at barriers, so every work item reaches a barrier
+  // before any continues past it.
+  Fibers* f = fibers;
+  for (size_t i = 0; i < group_items; ++i) {
+    ucontext_t* ctx = &f->items[i];
+    getcontext(ctx);
+    ctx->uc_stack.ss_sp = &f->stacks[i * launch->stack_size];
+    ctx->uc_stack.ss_size = launch->stack_size;
+    ctx->uc_link = &f->scheduler;
+    makecontext(ctx, FiberMain, 0);
+    f->done[i] = false;
+  }
+  size_t remaining = group_items;
+  while (remaining > 0) {
+    for (size_t i = 0; i < group_items; ++i) {
+      if (f->done[i]) continue;
+      f->current = i;
+      SetLocalId(i);
+      swapcontext(&f->scheduler, &f->items[i]);
+      if (f->done[i]) --remaining;
+    }
+  }
+}
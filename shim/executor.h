@@ -0,0 +1,108 @@
+#ifndef NONG_SHIM_EXECUTOR_H
+#define NONG_SHIM_EXECUTOR_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shim/work_item.h"
+
+// The work items of a shim kernel launch, like NDRange but without needing an
+// opencl runtime.
+struct ShimRange {
+  explicit ShimRange(size_t x);
+  ShimRange(size_t x, size_t y);
+  ShimRange(size_t x, size_t y, size_t z);
+
+  // Sets the work group size. By default the executor picks one.
+  ShimRange& set_local(size_t x, size_t y = 1, size_t z = 1);
+  ShimRange& set_offset(size_t x, size_t y = 0, size_t z = 0);
+
+  size_t num_items() const { return global[0] * global[1] * global[2]; }
+
+  unsigned int dims;
+  size_t global[3];
+  size_t local[3];
+  size_t offset[3];
+  bool has_local;
+};
+
+// Runs .cl kernels compiled as c++ (see shim_begin.h) on all cores without an
+// opencl runtime. Work groups are handed out to a pool of threads; each
+// thread runs all work items of a work group, so local memory
+// (ShimLocalMem()) is shared by the group. Kernels with barriers run each
+// work item of a group as a fiber that yields to the next work item at every
+// barrier.
+//
+//   ShimExecutor executor;
+//   executor.Run(ShimRange(w, h), [&]() { TracePixel(img, spheres, ...); });
+class ShimExecutor {
+ public:
+  // Called for every work item, e.g. a lambda calling the kernel function.
+  typedef std::function<void()> WorkItemFn;
+
+  // num_threads == 0 uses one thread per core.
+  explicit ShimExecutor(int num_threads = 0);
+  ~ShimExecutor();
+
+  // Runs fn for every work item of range and blocks until all are done. If
+  // the kernel calls barrier(), uses_barriers must be true. Each work item
+  // then gets a stack of stack_size bytes.
+  bool Run(const ShimRange& range, const WorkItemFn& fn,
+      bool uses_barriers = false, size_t stack_size = 64 * 1024);
+
+  // Runs fn for every pack of up to SHIM_LANES consecutive work items along
+  // x of range, see shim/packed.h. Packs don't span work groups, so a local
+  // size (if set) should be a multiple of SHIM_LANES. Without one, rows are
+  // whole packs and the last work group along x is cut off at the global
+  // size (get_local_size() doesn't reflect that), so any global size runs
+  // in full packs but the last. Packed kernels can't use barriers.
+  bool RunPacked(const ShimRange& range, const WorkItemFn& fn);
+
+  int num_threads() const { return threads_.size() + 1; }
+
+ private:
+  ShimExecutor(const ShimExecutor&);
+  ShimExecutor& operator=(const ShimExecutor&);
+
+  // The launch currently run by the pool.
+  struct Launch {
+    ShimRange range;
+    const WorkItemFn* fn;
+    bool uses_barriers;
+    size_t stack_size;
+    // Work items per call of fn.
+    int lanes;
+    // The last work group along x may end early, at the global size.
+    bool partial_groups;
+    size_t num_groups[3];
+    size_t total_groups;
+    std::atomic<size_t> next_group;
+    explicit Launch(const ShimRange& r) : range(r) {}
+  };
+
+  // Checks the work group size of launch and runs it.
+  bool Start(Launch* launch);
+  void ThreadMain();
+  // Runs work groups of launch until there are none left.
+  static void RunGroups(Launch* launch);
+  static void RunGroup(Launch* launch, size_t group);
+
+  std::vector<std::thread> threads_;
+  std::mutex lock_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  Launch* launch_;
+  // Incremented for every launch so threads run each launch once.
+  int generation_;
+  int running_;
+  bool shutdown_;
+};
+
+#endif
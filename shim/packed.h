@@ -0,0 +1,121 @@
+#ifndef NONG_SHIM_PACKED_H
+#define NONG_SHIM_PACKED_H
+
+// Packed kernels run SHIM_LANES consecutive work items (along x) per call,
+// one work item per SIMD lane. Values that differ between work items are
+// varying_* vectors, values that don't (arguments, get_global_id(1), ...)
+// stay scalars. Run them with ShimExecutor::RunPacked().
+//
+// SimpleKernel from kernels.cl as a packed kernel:
+//
+//   void SimpleKernelPacked(const float* input, float* output) {
+//     size_t id = get_global_id(0);  // Of the first work item of the pack.
+//     pack_store(output + id, sin(fabs(pack_load(input + id))));
+//   }
+//
+// Branches that differ between work items compute both sides and merge them
+// with select(); pack_any() skips a side no work item of the pack takes:
+//
+//   varying_int negative = x < 0;
+//   if (pack_any(negative)) x = select(x, -x * 2, negative);
+//
+// The last pack of a row of a work group may have fewer work items
+// (get_pack_lanes()), pack_load() and pack_store() only touch those.
+
+#include "shim/vector_types.h"
+#include "shim/work_item.h"
+
+#ifdef __AVX2__
+#define SHIM_LANES 8
+#else
+#define SHIM_LANES 4
+#endif
+
+typedef ShimVec<float, SHIM_LANES> varying_float;
+typedef ShimVec<int, SHIM_LANES> varying_int;
+typedef ShimVec<uint, SHIM_LANES> varying_uint;
+
+// The number of work items in this pack.
+inline int get_pack_lanes() { return shim_work_item.lanes; }
+
+// A mask (see select()) of the lanes that hold work items of this pack.
+inline varying_int get_pack_mask() {
+  varying_int mask;
+  for (int i = 0; i < SHIM_LANES; ++i) mask.s[i] = i < shim_work_item.lanes ? -1 : 0;
+  return mask;
+}
+
+// The ids of the work items of the pack, like get_global_id() and
+// get_local_id(). Only x differs between lanes.
+inline varying_int get_global_ids(unsigned int dim) {
+  varying_int ids = (int)get_global_id(dim);
+  if (dim == 0) {
+    for (int i = 0; i < SHIM_LANES; ++i) ids.s[i] += i;
+  }
+  return ids;
+}
+inline varying_int get_local_ids(unsigned int dim) {
+  varying_int ids = (int)get_local_id(dim);
+  if (dim == 0) {
+    for (int i = 0; i < SHIM_LANES; ++i) ids.s[i] += i;
+  }
+  return ids;
+}
+
+// Loads p[0] ... p[lanes - 1], where lanes defaults to the work items of the
+// pack. Lanes past them are 0.
+template<typename T>
+inline ShimVec<T, SHIM_LANES> pack_load(const T* p, int lanes = get_pack_lanes()) {
+  if (lanes == SHIM_LANES) return ShimVecOps<T, SHIM_LANES>::loadu(p);
+  ShimVec<T, SHIM_LANES> v = (T)0;
+  for (int i = 0; i < lanes; ++i) v.s[i] = p[i];
+  return v;
+}
+
+// Stores the first lanes components of v to p, by default one per work item.
+template<typename T>
+inline void pack_store(T* p, const ShimVec<T, SHIM_LANES>& v,
+    int lanes = get_pack_lanes()) {
+  if (lanes == SHIM_LANES) {
+    ShimVecOps<T, SHIM_LANES>::storeu(v, p);
+    return;
+  }
+  for (int i = 0; i < lanes; ++i) p[i] = v.s[i];
+}
+
+// Stores only the lanes (of work items) where mask is set.
+template<typename T>
+inline void pack_store_masked(T* p, const ShimVec<T, SHIM_LANES>& v,
+    const varying_int& mask) {
+  const int lanes = get_pack_lanes();
+  for (int i = 0; i < lanes; ++i) {
+    if (mask.s[i] < 0) p[i] = v.s[i];
+  }
+}
+
+// Loads p[index] per lane, lanes without a work item get 0.
+template<typename T>
+inline ShimVec<T, SHIM_LANES> pack_gather(const T* p, const varying_int& index) {
+  ShimVec<T, SHIM_LANES> v = (T)0;
+  const int lanes = get_pack_lanes();
+  for (int i = 0; i < lanes; ++i) v.s[i] = p[index.s[i]];
+  return v;
+}
+
+// Stores p[index] = v per lane of a work item.
+template<typename T>
+inline void pack_scatter(T* p, const varying_int& index,
+    const ShimVec<T, SHIM_LANES>& v) {
+  const int lanes = get_pack_lanes();
+  for (int i = 0; i < lanes; ++i) p[index.s[i]] = v.s[i];
+}
+
+// Whether mask is set in any or all lanes of work items.
+inline int pack_any(const varying_int& mask) {
+  return any(mask & get_pack_mask());
+}
+inline int pack_all(const varying_int& mask) {
+  return all(mask | ~get_pack_mask());
+}
+
+#endif
@@ -4,5 +4,10 @@
 #undef constant
 #undef global
 #undef kernel
+#undef __constant
+#undef __global
+#undef __kernel
+#undef __local
+#undef __private
 
 #endif
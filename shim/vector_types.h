@@ -0,0 +1,802 @@
+#ifndef NONG_SHIM_VECTOR_TYPES_H
+#define NONG_SHIM_VECTOR_TYPES_H
+
+// The opencl vector types (char2 ... double16) for kernels compiled as c++.
+//
+// Vectors have the size and alignment of their opencl counterparts (3
+// component vectors take the space of 4, alignment is capped at 64 bytes), so
+// structs containing them match the device layout. Supported:
+//  - Component-wise arithmetic, bitwise, shift and logical operators. Scalars
+//    are broadcast, e.g. v * 2.0f.
+//  - Comparisons, which return masks of the signed integer type of the same
+//    width: -1 (all bits set) for true, 0 for false. select(), any(), all().
+//  - Components: .x .y .z .w (up to 4 components), .s0 - .sF, .lo .hi .even
+//    .odd and all 2, 3 and 4 component .xyzw swizzles, e.g. .zwxy, including
+//    as lvalues (v.xy = w.yx).
+//  - Math: dot, cross, length, distance, normalize and component-wise
+//    functions (fabs, sqrt, sin, min, max, clamp, mix, ...).
+//  - convert_<type>N(), as_<type>N(), vloadN() and vstoreN().
+//  - Scalar min(), max(), convert_<type>() and as_<type>(), which c++ lacks.
+//
+// Operations on 128 bit vectors use SSE, 256 bit vectors use AVX if the
+// compiler targets it (e.g. -mavx2).
+//
+// Vector literals like (int4)(0, -1, 0, -1) are a comma expression in c++,
+// use a helper (see to_int4() in bitonic_sort.cl) in kernels shared with c++.
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+typedef unsigned char uchar;
+typedef unsigned short ushort;
+typedef unsigned int uint;
+typedef unsigned long ulong;
+
+template<typename T, int N> struct ShimVec;
+
+// The mask type of comparisons, a signed integer of the size of T.
+template<typename T> struct ShimMask { typedef T type; };
+template<> struct ShimMask<uchar> { typedef char type; };
+template<> struct ShimMask<ushort> { typedef short type; };
+template<> struct ShimMask<uint> { typedef int type; };
+template<> struct ShimMask<ulong> { typedef long type; };
+template<> struct ShimMask<float> { typedef int type; };
+template<> struct ShimMask<double> { typedef long type; };
+
+// A swizzle of up to 4 components of a vector with L lanes, which reads and
+// writes as the vector type V.
+template<typename T, int L, typename V, int A, int B, int C = 0, int D = 0>
+struct ShimSwizzle {
+  typedef V vec_type;
+  T s[L];
+
+  operator V() const {
+    const int idx[4] = { A, B, C, D };
+    V result;
+    for (int i = 0; i < V::size; ++i) result.s[i] = s[idx[i]];
+    return result;
+  }
+
+  ShimSwizzle& operator=(const V& v) {
+    const int idx[4] = { A, B, C, D };
+    for (int i = 0; i < V::size; ++i) s[idx[i]] = v.s[i];
+    return *this;
+  }
+  ShimSwizzle& operator=(const ShimSwizzle& o) { return *this = V(o); }
+
+  ShimSwizzle& operator+=(const V& v) { return *this = V(*this) + v; }
+  ShimSwizzle& operator-=(const V& v) { return *this = V(*this) - v; }
+  ShimSwizzle& operator*=(const V& v) { return *this = V(*this) * v; }
+  ShimSwizzle& operator/=(const V& v) { return *this = V(*this) / v; }
+};
+
+// .lo, .hi, .even and .odd of a vector with L lanes, which read and write as
+// the vector type V (half the size).
+enum ShimHalf { SHIM_LO, SHIM_HI, SHIM_EVEN, SHIM_ODD };
+
+template<typename T, int L, typename V, ShimHalf H>
+struct ShimHalfSwizzle {
+  typedef V vec_type;
+  T s[L];
+
+  static int index(int i) {
+    switch (H) {
+      case SHIM_LO: return i;
+      case SHIM_HI: return L / 2 + i;
+      case SHIM_EVEN: return 2 * i;
+      case SHIM_ODD: return 2 * i + 1;
+    }
+    return i;
+  }
+
+  operator V() const {
+    V result;
+    for (int i = 0; i < V::size; ++i) result.s[i] = s[index(i)];
+    return result;
+  }
+
+  ShimHalfSwizzle& operator=(const V& v) {
+    for (int i = 0; i < V::size; ++i) s[index(i)] = v.s[i];
+    return *this;
+  }
+  ShimHalfSwizzle& operator=(const ShimHalfSwizzle& o) { return *this = V(o); }
+};
+
+// Generates the .xyzw swizzle members of a vector with W (2 to 4) components.
+// Each nesting level needs its own list macro since a macro can't expand
+// itself.
+#define SHIM_IDX_x 0
+#define SHIM_IDX_y 1
+#define SHIM_IDX_z 2
+#define SHIM_IDX_w 3
+
+#define SHIM_L1_2(F, ...) F(__VA_ARGS__, x) F(__VA_ARGS__, y)
+#define SHIM_L1_3(F, ...) SHIM_L1_2(F, __VA_ARGS__) F(__VA_ARGS__, z)
+#define SHIM_L1_4(F, ...) SHIM_L1_3(F, __VA_ARGS__) F(__VA_ARGS__, w)
+#define SHIM_L2_2(F, ...) F(__VA_ARGS__, x) F(__VA_ARGS__, y)
+#define SHIM_L2_3(F, ...) SHIM_L2_2(F, __VA_ARGS__) F(__VA_ARGS__, z)
+#define SHIM_L2_4(F, ...) SHIM_L2_3(F, __VA_ARGS__) F(__VA_ARGS__, w)
+#define SHIM_L3_2(F, ...) F(__VA_ARGS__, x) F(__VA_ARGS__, y)
+#define SHIM_L3_3(F, ...) SHIM_L3_2(F, __VA_ARGS__) F(__VA_ARGS__, z)
+#define SHIM_L3_4(F, ...) SHIM_L3_3(F, __VA_ARGS__) F(__VA_ARGS__, w)
+#define SHIM_L4_2(F, ...) F(__VA_ARGS__, x) F(__VA_ARGS__, y)
+#define SHIM_L4_3(F, ...) SHIM_L4_2(F, __VA_ARGS__) F(__VA_ARGS__, z)
+#define SHIM_L4_4(F, ...) SHIM_L4_3(F, __VA_ARGS__) F(__VA_ARGS__, w)
+
+#define SHIM_SW2(T, L, a, b) \
+  ShimSwizzle<T, L, ShimVec<T, 2>, SHIM_IDX_##a, SHIM_IDX_##b> a##b;
+#define SHIM_SW3(T, L, a, b, c) \
+  ShimSwizzle<T, L, ShimVec<T, 3>, SHIM_IDX_##a, SHIM_IDX_##b, \
+      SHIM_IDX_##c> a##b##c;
+#define SHIM_SW4(T, L, a, b, c, d) \
+  ShimSwizzle<T, L, ShimVec<T, 4>, SHIM_IDX_##a, SHIM_IDX_##b, \
+      SHIM_IDX_##c, SHIM_IDX_##d> a##b##c##d;
+
+#define SHIM_SW2_A(T, L, W, a) SHIM_L2_##W(SHIM_SW2, T, L, a)
+#define SHIM_SW3_A(T, L, W, a) SHIM_L2_##W(SHIM_SW3_B, T, L, W, a)
+#define SHIM_SW3_B(T, L, W, a, b) SHIM_L3_##W(SHIM_SW3, T, L, a, b)
+#define SHIM_SW4_A(T, L, W, a) SHIM_L2_##W(SHIM_SW4_B, T, L, W, a)
+#define SHIM_SW4_B(T, L, W, a, b) SHIM_L3_##W(SHIM_SW4_C, T, L, W, a, b)
+#define SHIM_SW4_C(T, L, W, a, b, c) SHIM_L4_##W(SHIM_SW4, T, L, a, b, c)
+
+#define SHIM_SWIZZLES(T, L, W) \
+  SHIM_L1_##W(SHIM_SW2_A, T, L, W) \
+  SHIM_L1_##W(SHIM_SW3_A, T, L, W) \
+  SHIM_L1_##W(SHIM_SW4_A, T, L, W)
+
+#define SHIM_HALVES(T, L, H) \
+  ShimHalfSwizzle<T, L, ShimVec<T, H>, SHIM_LO> lo; \
+  ShimHalfSwizzle<T, L, ShimVec<T, H>, SHIM_HI> hi; \
+  ShimHalfSwizzle<T, L, ShimVec<T, H>, SHIM_EVEN> even; \
+  ShimHalfSwizzle<T, L, ShimVec<T, H>, SHIM_ODD> odd;
+
+#define SHIM_VEC_ALIGN(T, L) alignas(sizeof(T) * L > 64 ? 64 : sizeof(T) * L)
+
+// The SIMD register type of a vector with L lanes of T, if there is one.
+template<typename T, int L> struct ShimSimd { struct type {}; };
+#ifdef __SSE2__
+template<> struct ShimSimd<float, 4> { typedef __m128 type; };
+template<> struct ShimSimd<int, 4> { typedef __m128i type; };
+template<> struct ShimSimd<double, 2> { typedef __m128d type; };
+#endif
+#ifdef __AVX__
+template<> struct ShimSimd<float, 8> { typedef __m256 type; };
+template<> struct ShimSimd<int, 8> { typedef __m256i type; };
+template<> struct ShimSimd<double, 4> { typedef __m256d type; };
+#endif
+
+// The components of a vector, s holds all lanes and v the same as a SIMD
+// register.
+template<typename T, int N> struct ShimVecStorage;
+
+template<typename T> struct SHIM_VEC_ALIGN(T, 2) ShimVecStorage<T, 2> {
+  union {
+    T s[2];
+    typename ShimSimd<T, 2>::type v;
+    struct { T x, y; };
+    struct { T s0, s1; };
+    struct { T lo, hi; };
+    struct { T even, odd; };
+    SHIM_SWIZZLES(T, 2, 2)
+  };
+};
+
+template<typename T> struct SHIM_VEC_ALIGN(T, 4) ShimVecStorage<T, 3> {
+  union {
+    T s[4];
+    typename ShimSimd<T, 4>::type v;
+    struct { T x, y, z; };
+    struct { T s0, s1, s2; };
+    SHIM_HALVES(T, 4, 2)
+    SHIM_SWIZZLES(T, 4, 3)
+  };
+};
+
+template<typename T> struct SHIM_VEC_ALIGN(T, 4) ShimVecStorage<T, 4> {
+  union {
+    T s[4];
+    typename ShimSimd<T, 4>::type v;
+    struct { T x, y, z, w; };
+    struct { T s0, s1, s2, s3; };
+    SHIM_HALVES(T, 4, 2)
+    SHIM_SWIZZLES(T, 4, 4)
+  };
+};
+
+template<typename T> struct SHIM_VEC_ALIGN(T, 8) ShimVecStorage<T, 8> {
+  union {
+    T s[8];
+    typename ShimSimd<T, 8>::type v;
+    struct { T s0, s1, s2, s3, s4, s5, s6, s7; };
+    SHIM_HALVES(T, 8, 4)
+  };
+};
+
+template<typename T> struct SHIM_VEC_ALIGN(T, 16) ShimVecStorage<T, 16> {
+  union {
+    T s[16];
+    typename ShimSimd<T, 16>::type v;
+    struct { T s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, sa, sb, sc, sd, se, sf; };
+    struct { T s0_, s1_, s2_, s3_, s4_, s5_, s6_, s7_, s8_, s9_, sA, sB, sC, sD, sE, sF; };
+    SHIM_HALVES(T, 16, 8)
+  };
+};
+
+// sin() and cos() of vector components. The float versions have no calls or
+// branches, so loops over the components vectorize. They use the cephes
+// polynomials (about 2 ulp) for |x| <= 8192, exact() is false for values that
+// need libm.
+template<typename T>
+struct ShimTrig {
+  static T sin(T x) { return ::sin(x); }
+  static T cos(T x) { return ::cos(x); }
+  static bool exact(T) { return true; }
+};
+
+inline float ShimSinCosf(float x, bool cos) {
+  // Selects and signs use bit masks, ternaries don't always vectorize.
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  uint32_t sign = bits & 0x80000000u;
+  // Out of range values (and nan) become 0, exact() is false for them.
+  uint32_t a_bits = bits & 0x7fffffffu;
+  a_bits &= 0u - (uint32_t)(a_bits <= 0x46000000u);  // 8192
+  float a;
+  memcpy(&a, &a_bits, sizeof(a));
+  // Reduces to [-pi/4, pi/4] with j the octant (rounded up to even).
+  int j = (int)(a * 1.27323954473516f);
+  j = (j + 1) & ~1;
+  float y = (float)j;
+  a = ((a - y * 0.78515625f) - y * 2.4187564849853515625e-4f) -
+      y * 3.77489497744594108e-8f;
+  if (cos) {
+    j -= 2;
+    sign = (uint32_t)(~j & 4) << 29;
+  } else {
+    sign ^= (uint32_t)(j & 4) << 29;
+  }
+  float z = a * a;
+  float c = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z +
+      4.166664568298827e-2f) * z * z - 0.5f * z + 1;
+  float s = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z -
+      1.6666654611e-1f) * z * a + a;
+  uint32_t c_bits, s_bits;
+  memcpy(&c_bits, &c, sizeof(c_bits));
+  memcpy(&s_bits, &s, sizeof(s_bits));
+  uint32_t use_c = 0u - (uint32_t)((j >> 1) & 1);
+  bits = ((c_bits & use_c) | (s_bits & ~use_c)) ^ sign;
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+template<>
+struct ShimTrig<float> {
+  static float sin(float x) { return ShimSinCosf(x, false); }
+  static float cos(float x) { return ShimSinCosf(x, true); }
+  static bool exact(float x) { return fabsf(x) <= 8192.0f; }
+};
+
+// Component-wise operations. Specialized below for SIMD.
+template<typename T, int N>
+struct ShimVecOpsGeneric {
+  typedef ShimVec<T, N> V;
+  typedef ShimVec<typename ShimMask<T>::type, N> M;
+
+  // Unaligned loads and stores of N components.
+  static V loadu(const T* p) { V r; memcpy(r.s, p, sizeof(T) * N); return r; }
+  static void storeu(const V& v, T* p) { memcpy(p, v.s, sizeof(T) * N); }
+
+#define SHIM_GENERIC_BINARY(name, expr) \
+  static V name(const V& a, const V& b) { \
+    V r; \
+    for (int i = 0; i < N; ++i) r.s[i] = (expr); \
+    return r; \
+  }
+#define SHIM_GENERIC_COMPARE(name, op) \
+  static M name(const V& a, const V& b) { \
+    M r; \
+    for (int i = 0; i < N; ++i) r.s[i] = a.s[i] op b.s[i] ? -1 : 0; \
+    return r; \
+  }
+
+  SHIM_GENERIC_BINARY(add, a.s[i] + b.s[i])
+  SHIM_GENERIC_BINARY(sub, a.s[i] - b.s[i])
+  SHIM_GENERIC_BINARY(mul, a.s[i] * b.s[i])
+  SHIM_GENERIC_BINARY(div, a.s[i] / b.s[i])
+  SHIM_GENERIC_BINARY(min, b.s[i] < a.s[i] ? b.s[i] : a.s[i])
+  SHIM_GENERIC_BINARY(max, a.s[i] < b.s[i] ? b.s[i] : a.s[i])
+  SHIM_GENERIC_BINARY(bit_and, a.s[i] & b.s[i])
+  SHIM_GENERIC_BINARY(bit_or, a.s[i] | b.s[i])
+  SHIM_GENERIC_BINARY(bit_xor, a.s[i] ^ b.s[i])
+  SHIM_GENERIC_COMPARE(lt, <)
+  SHIM_GENERIC_COMPARE(le, <=)
+  SHIM_GENERIC_COMPARE(gt, >)
+  SHIM_GENERIC_COMPARE(ge, >=)
+  SHIM_GENERIC_COMPARE(eq, ==)
+  SHIM_GENERIC_COMPARE(ne, !=)
+
+#undef SHIM_GENERIC_BINARY
+#undef SHIM_GENERIC_COMPARE
+
+  // sin() or cos() of all components.
+  static V sincos(const V& a, bool cos) {
+    V r;
+    int exact = 1;
+    for (int i = 0; i < N; ++i) {
+      r.s[i] = cos ? ShimTrig<T>::cos(a.s[i]) : ShimTrig<T>::sin(a.s[i]);
+      exact &= ShimTrig<T>::exact(a.s[i]);
+    }
+    if (!exact) FixSinCos(a, cos, &r);
+    return r;
+  }
+  // Uses libm for the components ShimTrig can't handle. Out of line, else
+  // the compiler may call libm for all components and blend.
+  __attribute__((noinline, cold)) static void FixSinCos(const V& a, bool cos, V* r) {
+    for (int i = 0; i < N; ++i) {
+      if (!ShimTrig<T>::exact(a.s[i])) r->s[i] = cos ? ::cos(a.s[i]) : ::sin(a.s[i]);
+    }
+  }
+};
+
+// ShimSinCosf() for all lanes of a SIMD register. Sets *exact to the
+// movemask of the lanes it handles.
+#define SHIM_SINCOS_SIMD(VEC, IVEC, MM, SI) \
+  inline VEC ShimSinCos(VEC x, bool cos, int* exact) { \
+    const IVEC sign_mask = MM##_set1_epi32((int)0x80000000); \
+    IVEC bits = MM##_castps_##SI(x); \
+    IVEC sign = MM##_and_##SI(bits, sign_mask); \
+    IVEC a_bits = MM##_andnot_##SI(sign_mask, bits); \
+    IVEC in_range = MM##_cmpgt_epi32(MM##_set1_epi32(0x46000001), a_bits); \
+    *exact = MM##_movemask_ps(MM##_cast##SI##_ps(in_range)); \
+    VEC a = MM##_cast##SI##_ps(MM##_and_##SI(a_bits, in_range)); \
+    IVEC j = MM##_cvttps_epi32(MM##_mul_ps(a, MM##_set1_ps(1.27323954473516f))); \
+    j = MM##_and_##SI(MM##_add_epi32(j, MM##_set1_epi32(1)), MM##_set1_epi32(~1)); \
+    VEC y = MM##_cvtepi32_ps(j); \
+    a = MM##_sub_ps(a, MM##_mul_ps(y, MM##_set1_ps(0.78515625f))); \
+    a = MM##_sub_ps(a, MM##_mul_ps(y, MM##_set1_ps(2.4187564849853515625e-4f))); \
+    a = MM##_sub_ps(a, MM##_mul_ps(y, MM##_set1_ps(3.77489497744594108e-8f))); \
+    const IVEC four = MM##_set1_epi32(4); \
+    if (cos) { \
+      j = MM##_sub_epi32(j, MM##_set1_epi32(2)); \
+      sign = MM##_slli_epi32(MM##_andnot_##SI(j, four), 29); \
+    } else { \
+      sign = MM##_xor_##SI(sign, MM##_slli_epi32(MM##_and_##SI(j, four), 29)); \
+    } \
+    VEC z = MM##_mul_ps(a, a); \
+    VEC c = MM##_add_ps(MM##_mul_ps(MM##_set1_ps(2.443315711809948e-5f), z), \
+        MM##_set1_ps(-1.388731625493765e-3f)); \
+    c = MM##_add_ps(MM##_mul_ps(c, z), MM##_set1_ps(4.166664568298827e-2f)); \
+    c = MM##_mul_ps(MM##_mul_ps(c, z), z); \
+    c = MM##_add_ps(MM##_sub_ps(c, MM##_mul_ps(MM##_set1_ps(0.5f), z)), \
+        MM##_set1_ps(1.0f)); \
+    VEC s = MM##_add_ps(MM##_mul_ps(MM##_set1_ps(-1.9515295891e-4f), z), \
+        MM##_set1_ps(8.3321608736e-3f)); \
+    s = MM##_add_ps(MM##_mul_ps(s, z), MM##_set1_ps(-1.6666654611e-1f)); \
+    s = MM##_add_ps(MM##_mul_ps(MM##_mul_ps(s, z), a), a); \
+    const IVEC two = MM##_set1_epi32(2); \
+    IVEC use_c = MM##_cmpeq_epi32(MM##_and_##SI(j, two), two); \
+    IVEC r = MM##_or_##SI(MM##_and_##SI(use_c, MM##_castps_##SI(c)), \
+        MM##_andnot_##SI(use_c, MM##_castps_##SI(s))); \
+    return MM##_cast##SI##_ps(MM##_xor_##SI(r, sign)); \
+  }
+
+#ifdef __SSE2__
+SHIM_SINCOS_SIMD(__m128, __m128i, _mm, si128)
+#endif
+#ifdef __AVX2__
+SHIM_SINCOS_SIMD(__m256, __m256i, _mm256, si256)
+#endif
+#undef SHIM_SINCOS_SIMD
+
+template<typename T, int N>
+struct ShimVecOps : public ShimVecOpsGeneric<T, N> {};
+
+template<typename T, int N>
+struct ShimVec : public ShimVecStorage<T, N> {
+  typedef T scalar_type;
+  typedef ShimVec vec_type;
+  typedef ShimVec<typename ShimMask<T>::type, N> mask_type;
+  typedef ShimVecOps<T, N> Ops;
+  static const int size = N;
+
+  ShimVec() {}
+  // Scalars convert to vectors with all components set.
+  ShimVec(T v) { for (int i = 0; i < N; ++i) this->s[i] = v; }
+  // One value per component.
+  template<typename... Args>
+  ShimVec(T a, T b, Args... rest) {
+    static_assert(sizeof...(rest) + 2 == N, "Wrong number of components");
+    const T values[] = { a, b, (T)rest... };
+    for (int i = 0; i < N; ++i) this->s[i] = values[i];
+  }
+  ShimVec(const ShimVec& o) = default;
+  // Swizzles assign component-wise, so this can't be the default.
+  ShimVec& operator=(const ShimVec& o) {
+    memcpy(this->s, o.s, sizeof(this->s));
+    return *this;
+  }
+
+  // Operators are friends so swizzles and scalars convert to vectors.
+  friend ShimVec operator+(const ShimVec& a, const ShimVec& b) { return Ops::add(a, b); }
+  friend ShimVec operator-(const ShimVec& a, const ShimVec& b) { return Ops::sub(a, b); }
+  friend ShimVec operator*(const ShimVec& a, const ShimVec& b) { return Ops::mul(a, b); }
+  friend ShimVec operator/(const ShimVec& a, const ShimVec& b) { return Ops::div(a, b); }
+  friend ShimVec operator&(const ShimVec& a, const ShimVec& b) { return Ops::bit_and(a, b); }
+  friend ShimVec operator|(const ShimVec& a, const ShimVec& b) { return Ops::bit_or(a, b); }
+  friend ShimVec operator^(const ShimVec& a, const ShimVec& b) { return Ops::bit_xor(a, b); }
+  friend mask_type operator<(const ShimVec& a, const ShimVec& b) { return Ops::lt(a, b); }
+  friend mask_type operator<=(const ShimVec& a, const ShimVec& b) { return Ops::le(a, b); }
+  friend mask_type operator>(const ShimVec& a, const ShimVec& b) { return Ops::gt(a, b); }
+  friend mask_type operator>=(const ShimVec& a, const ShimVec& b) { return Ops::ge(a, b); }
+  friend mask_type operator==(const ShimVec& a, const ShimVec& b) { return Ops::eq(a, b); }
+  friend mask_type operator!=(const ShimVec& a, const ShimVec& b) { return Ops::ne(a, b); }
+
+#define SHIM_VEC_LOOP(result, expr) \
+  result r; \
+  for (int i = 0; i < N; ++i) r.s[i] = (expr); \
+  return r;
+
+  friend ShimVec operator%(const ShimVec& a, const ShimVec& b) { SHIM_VEC_LOOP(ShimVec, a.s[i] % b.s[i]) }
+  friend ShimVec operator<<(const ShimVec& a, const ShimVec& b) {
+    // Shifts are modulo the number of bits, like opencl.
+    SHIM_VEC_LOOP(ShimVec, a.s[i] << (b.s[i] & (sizeof(T) * 8 - 1)))
+  }
+  friend ShimVec operator>>(const ShimVec& a, const ShimVec& b) {
+    SHIM_VEC_LOOP(ShimVec, a.s[i] >> (b.s[i] & (sizeof(T) * 8 - 1)))
+  }
+  friend mask_type operator&&(const ShimVec& a, const ShimVec& b) { SHIM_VEC_LOOP(mask_type, a.s[i] && b.s[i] ? -1 : 0) }
+  friend mask_type operator||(const ShimVec& a, const ShimVec& b) { SHIM_VEC_LOOP(mask_type, a.s[i] || b.s[i] ? -1 : 0) }
+  ShimVec operator-() const { SHIM_VEC_LOOP(ShimVec, -this->s[i]) }
+  ShimVec operator+() const { return *this; }
+  ShimVec operator~() const { SHIM_VEC_LOOP(ShimVec, ~this->s[i]) }
+  mask_type operator!() const { SHIM_VEC_LOOP(mask_type, this->s[i] ? 0 : -1) }
+
+  ShimVec& operator+=(const ShimVec& o) { return *this = *this + o; }
+  ShimVec& operator-=(const ShimVec& o) { return *this = *this - o; }
+  ShimVec& operator*=(const ShimVec& o) { return *this = *this * o; }
+  ShimVec& operator/=(const ShimVec& o) { return *this = *this / o; }
+  ShimVec& operator%=(const ShimVec& o) { return *this = *this % o; }
+  ShimVec& operator&=(const ShimVec& o) { return *this = *this & o; }
+  ShimVec& operator|=(const ShimVec& o) { return *this = *this | o; }
+  ShimVec& operator^=(const ShimVec& o) { return *this = *this ^ o; }
+  ShimVec& operator<<=(const ShimVec& o) { return *this = *this << o; }
+  ShimVec& operator>>=(const ShimVec& o) { return *this = *this >> o; }
+  ShimVec& operator++() { return *this += 1; }
+  ShimVec& operator--() { return *this -= 1; }
+  ShimVec operator++(int) { ShimVec r = *this; *this += 1; return r; }
+  ShimVec operator--(int) { ShimVec r = *this; *this -= 1; return r; }
+
+  // Math functions. Also friends so they apply to swizzles.
+#define SHIM_VEC_MATH1(fn) \
+  friend ShimVec fn(const ShimVec& a) { SHIM_VEC_LOOP(ShimVec, ::fn(a.s[i])) }
+#define SHIM_VEC_MATH2(fn) \
+  friend ShimVec fn(const ShimVec& a, const ShimVec& b) { SHIM_VEC_LOOP(ShimVec, ::fn(a.s[i], b.s[i])) }
+
+  SHIM_VEC_MATH1(fabs)
+  SHIM_VEC_MATH1(sqrt)
+  SHIM_VEC_MATH1(tan)
+  SHIM_VEC_MATH1(asin)
+  SHIM_VEC_MATH1(acos)
+  SHIM_VEC_MATH1(atan)
+  SHIM_VEC_MATH1(exp)
+  SHIM_VEC_MATH1(exp2)
+  SHIM_VEC_MATH1(log)
+  SHIM_VEC_MATH1(log2)
+  SHIM_VEC_MATH1(floor)
+  SHIM_VEC_MATH1(ceil)
+  SHIM_VEC_MATH1(round)
+  SHIM_VEC_MATH1(trunc)
+  SHIM_VEC_MATH2(pow)
+  SHIM_VEC_MATH2(fmin)
+  SHIM_VEC_MATH2(fmax)
+  SHIM_VEC_MATH2(fmod)
+  SHIM_VEC_MATH2(atan2)
+
+#undef SHIM_VEC_MATH1
+#undef SHIM_VEC_MATH2
+
+  friend ShimVec rsqrt(const ShimVec& a) { SHIM_VEC_LOOP(ShimVec, 1 / ::sqrt(a.s[i])) }
+  friend ShimVec sin(const ShimVec& a) { return Ops::sincos(a, false); }
+  friend ShimVec cos(const ShimVec& a) { return Ops::sincos(a, true); }
+  friend ShimVec sincos(const ShimVec& a, ShimVec* cos_result) {
+    *cos_result = cos(a);
+    return sin(a);
+  }
+  friend ShimVec min(const ShimVec& a, const ShimVec& b) { return Ops::min(a, b); }
+  friend ShimVec max(const ShimVec& a, const ShimVec& b) { return Ops::max(a, b); }
+  friend ShimVec clamp(const ShimVec& v, const ShimVec& lo, const ShimVec& hi) {
+    return min(max(v, lo), hi);
+  }
+  friend ShimVec mix(const ShimVec& a, const ShimVec& b, const ShimVec& t) {
+    return a + (b - a) * t;
+  }
+  friend ShimVec step(const ShimVec& edge, const ShimVec& v) {
+    SHIM_VEC_LOOP(ShimVec, v.s[i] < edge.s[i] ? 0 : 1)
+  }
+  friend ShimVec sign(const ShimVec& v) {
+    SHIM_VEC_LOOP(ShimVec, v.s[i] > 0 ? 1 : (v.s[i] < 0 ? -1 : 0))
+  }
+  friend ShimVec abs(const ShimVec& v) { SHIM_VEC_LOOP(ShimVec, v.s[i] < 0 ? -v.s[i] : v.s[i]) }
+
+  // Geometric functions, only for 2 to 4 components. cross() ignores w.
+  friend T dot(const ShimVec& a, const ShimVec& b) {
+    T result = 0;
+    for (int i = 0; i < N; ++i) result += a.s[i] * b.s[i];
+    return result;
+  }
+  friend T length(const ShimVec& v) { return ::sqrt(dot(v, v)); }
+  friend T distance(const ShimVec& a, const ShimVec& b) { return length(a - b); }
+  friend ShimVec normalize(const ShimVec& v) {
+    T len = length(v);
+    return len > 0 ? v / len : v;
+  }
+  friend ShimVec cross(const ShimVec& a, const ShimVec& b) {
+    static_assert(N == 3 || N == 4, "cross() needs 3 or 4 components");
+    ShimVec r = 0;
+    r.s[0] = a.s[1] * b.s[2] - a.s[2] * b.s[1];
+    r.s[1] = a.s[2] * b.s[0] - a.s[0] * b.s[2];
+    r.s[2] = a.s[0] * b.s[1] - a.s[1] * b.s[0];
+    return r;
+  }
+
+  // The most significant bit of each component decides.
+  friend int any(const ShimVec& v) {
+    for (int i = 0; i < N; ++i) if (v.s[i] < 0) return 1;
+    return 0;
+  }
+  friend int all(const ShimVec& v) {
+    for (int i = 0; i < N; ++i) if (!(v.s[i] < 0)) return 0;
+    return 1;
+  }
+
+#undef SHIM_VEC_LOOP
+};
+
+// SIMD versions of the component-wise operations.
+#ifdef __SSE2__
+template<>
+struct ShimVecOps<float, 4> : public ShimVecOpsGeneric<float, 4> {
+  static __m128 load(const V& a) { return a.v; }
+  static V store(__m128 v) { V r; r.v = v; return r; }
+  static M mask(__m128 v) { M r; r.v = _mm_castps_si128(v); return r; }
+  static V loadu(const float* p) { return store(_mm_loadu_ps(p)); }
+  static void storeu(const V& v, float* p) { _mm_storeu_ps(p, v.v); }
+
+  static V add(const V& a, const V& b) { return store(_mm_add_ps(load(a), load(b))); }
+  static V sub(const V& a, const V& b) { return store(_mm_sub_ps(load(a), load(b))); }
+  static V mul(const V& a, const V& b) { return store(_mm_mul_ps(load(a), load(b))); }
+  static V div(const V& a, const V& b) { return store(_mm_div_ps(load(a), load(b))); }
+  static V min(const V& a, const V& b) { return store(_mm_min_ps(load(a), load(b))); }
+  static V max(const V& a, const V& b) { return store(_mm_max_ps(load(a), load(b))); }
+  static M lt(const V& a, const V& b) { return mask(_mm_cmplt_ps(load(a), load(b))); }
+  static M le(const V& a, const V& b) { return mask(_mm_cmple_ps(load(a), load(b))); }
+  static M gt(const V& a, const V& b) { return mask(_mm_cmpgt_ps(load(a), load(b))); }
+  static M ge(const V& a, const V& b) { return mask(_mm_cmpge_ps(load(a), load(b))); }
+  static M eq(const V& a, const V& b) { return mask(_mm_cmpeq_ps(load(a), load(b))); }
+  static M ne(const V& a, const V& b) { return mask(_mm_cmpneq_ps(load(a), load(b))); }
+  static V sincos(const V& a, bool cos) {
+    int exact;
+    V r = store(ShimSinCos(a.v, cos, &exact));
+    if (exact != 0xf) FixSinCos(a, cos, &r);
+    return r;
+  }
+};
+
+template<>
+struct ShimVecOps<int, 4> : public ShimVecOpsGeneric<int, 4> {
+  static __m128i load(const V& a) { return a.v; }
+  static V store(__m128i v) { V r; r.v = v; return r; }
+  static M mask(__m128i v) { return store(v); }
+  static V loadu(const int* p) { return store(_mm_loadu_si128((const __m128i*)p)); }
+  static void storeu(const V& v, int* p) { _mm_storeu_si128((__m128i*)p, v.v); }
+
+  static V add(const V& a, const V& b) { return store(_mm_add_epi32(load(a), load(b))); }
+  static V sub(const V& a, const V& b) { return store(_mm_sub_epi32(load(a), load(b))); }
+#ifdef __SSE4_1__
+  static V mul(const V& a, const V& b) { return store(_mm_mullo_epi32(load(a), load(b))); }
+  static V min(const V& a, const V& b) { return store(_mm_min_epi32(load(a), load(b))); }
+  static V max(const V& a, const V& b) { return store(_mm_max_epi32(load(a), load(b))); }
+#endif
+  static V bit_and(const V& a, const V& b) { return store(_mm_and_si128(load(a), load(b))); }
+  static V bit_or(const V& a, const V& b) { return store(_mm_or_si128(load(a), load(b))); }
+  static V bit_xor(const V& a, const V& b) { return store(_mm_xor_si128(load(a), load(b))); }
+  static M lt(const V& a, const V& b) { return mask(_mm_cmplt_epi32(load(a), load(b))); }
+  static M gt(const V& a, const V& b) { return mask(_mm_cmpgt_epi32(load(a), load(b))); }
+  static M eq(const V& a, const V& b) { return mask(_mm_cmpeq_epi32(load(a), load(b))); }
+};
+
+template<>
+struct ShimVecOps<double, 2> : public ShimVecOpsGeneric<double, 2> {
+  static __m128d load(const V& a) { return a.v; }
+  static V store(__m128d v) { V r; r.v = v; return r; }
+  static M mask(__m128d v) { M r; memcpy(r.s, &v, sizeof(v)); return r; }
+  static V loadu(const double* p) { return store(_mm_loadu_pd(p)); }
+  static void storeu(const V& v, double* p) { _mm_storeu_pd(p, v.v); }
+
+  static V add(const V& a, const V& b) { return store(_mm_add_pd(load(a), load(b))); }
+  static V sub(const V& a, const V& b) { return store(_mm_sub_pd(load(a), load(b))); }
+  static V mul(const V& a, const V& b) { return store(_mm_mul_pd(load(a), load(b))); }
+  static V div(const V& a, const V& b) { return store(_mm_div_pd(load(a), load(b))); }
+  static M lt(const V& a, const V& b) { return mask(_mm_cmplt_pd(load(a), load(b))); }
+  static M gt(const V& a, const V& b) { return mask(_mm_cmpgt_pd(load(a), load(b))); }
+  static M eq(const V& a, const V& b) { return mask(_mm_cmpeq_pd(load(a), load(b))); }
+};
+#endif
+
+#ifdef __AVX__
+template<>
+struct ShimVecOps<float, 8> : public ShimVecOpsGeneric<float, 8> {
+  static __m256 load(const V& a) { return a.v; }
+  static V store(__m256 v) { V r; r.v = v; return r; }
+  static M mask(__m256 v) { M r; r.v = _mm256_castps_si256(v); return r; }
+  static V loadu(const float* p) { return store(_mm256_loadu_ps(p)); }
+  static void storeu(const V& v, float* p) { _mm256_storeu_ps(p, v.v); }
+
+  static V add(const V& a, const V& b) { return store(_mm256_add_ps(load(a), load(b))); }
+  static V sub(const V& a, const V& b) { return store(_mm256_sub_ps(load(a), load(b))); }
+  static V mul(const V& a, const V& b) { return store(_mm256_mul_ps(load(a), load(b))); }
+  static V div(const V& a, const V& b) { return store(_mm256_div_ps(load(a), load(b))); }
+  static V min(const V& a, const V& b) { return store(_mm256_min_ps(load(a), load(b))); }
+  static V max(const V& a, const V& b) { return store(_mm256_max_ps(load(a), load(b))); }
+  static M lt(const V& a, const V& b) { return mask(_mm256_cmp_ps(load(a), load(b), _CMP_LT_OQ)); }
+  static M le(const V& a, const V& b) { return mask(_mm256_cmp_ps(load(a), load(b), _CMP_LE_OQ)); }
+  static M gt(const V& a, const V& b) { return mask(_mm256_cmp_ps(load(a), load(b), _CMP_GT_OQ)); }
+  static M ge(const V& a, const V& b) { return mask(_mm256_cmp_ps(load(a), load(b), _CMP_GE_OQ)); }
+  static M eq(const V& a, const V& b) { return mask(_mm256_cmp_ps(load(a), load(b), _CMP_EQ_OQ)); }
+  static M ne(const V& a, const V& b) { return mask(_mm256_cmp_ps(load(a), load(b), _CMP_NEQ_UQ)); }
+#ifdef __AVX2__
+  static V sincos(const V& a, bool cos) {
+    int exact;
+    V r = store(ShimSinCos(a.v, cos, &exact));
+    if (exact != 0xff) FixSinCos(a, cos, &r);
+    return r;
+  }
+#endif
+};
+
+template<>
+struct ShimVecOps<double, 4> : public ShimVecOpsGeneric<double, 4> {
+  static __m256d load(const V& a) { return a.v; }
+  static V store(__m256d v) { V r; r.v = v; return r; }
+  static V loadu(const double* p) { return store(_mm256_loadu_pd(p)); }
+  static void storeu(const V& v, double* p) { _mm256_storeu_pd(p, v.v); }
+
+  static V add(const V& a, const V& b) { return store(_mm256_add_pd(load(a), load(b))); }
+  static V sub(const V& a, const V& b) { return store(_mm256_sub_pd(load(a), load(b))); }
+  static V mul(const V& a, const V& b) { return store(_mm256_mul_pd(load(a), load(b))); }
+  static V div(const V& a, const V& b) { return store(_mm256_div_pd(load(a), load(b))); }
+};
+#endif
+
+#ifdef __AVX2__
+template<>
+struct ShimVecOps<int, 8> : public ShimVecOpsGeneric<int, 8> {
+  static __m256i load(const V& a) { return a.v; }
+  static V store(__m256i v) { V r; r.v = v; return r; }
+  static V loadu(const int* p) { return store(_mm256_loadu_si256((const __m256i*)p)); }
+  static void storeu(const V& v, int* p) { _mm256_storeu_si256((__m256i*)p, v.v); }
+
+  static V add(const V& a, const V& b) { return store(_mm256_add_epi32(load(a), load(b))); }
+  static V sub(const V& a, const V& b) { return store(_mm256_sub_epi32(load(a), load(b))); }
+  static V mul(const V& a, const V& b) { return store(_mm256_mullo_epi32(load(a), load(b))); }
+  static V min(const V& a, const V& b) { return store(_mm256_min_epi32(load(a), load(b))); }
+  static V max(const V& a, const V& b) { return store(_mm256_max_epi32(load(a), load(b))); }
+  static V bit_and(const V& a, const V& b) { return store(_mm256_and_si256(load(a), load(b))); }
+  static V bit_or(const V& a, const V& b) { return store(_mm256_or_si256(load(a), load(b))); }
+  static V bit_xor(const V& a, const V& b) { return store(_mm256_xor_si256(load(a), load(b))); }
+  static M gt(const V& a, const V& b) { return store(_mm256_cmpgt_epi32(load(a), load(b))); }
+  static M lt(const V& a, const V& b) { return store(_mm256_cmpgt_epi32(load(b), load(a))); }
+  static M eq(const V& a, const V& b) { return store(_mm256_cmpeq_epi32(load(a), load(b))); }
+};
+#endif
+
+// Returns c ? b : a per component, where c is a mask (see any()).
+template<typename T, typename M, int N>
+inline ShimVec<T, N> select(const ShimVec<T, N>& a, const ShimVec<T, N>& b,
+    const ShimVec<M, N>& c) {
+  ShimVec<T, N> r;
+  for (int i = 0; i < N; ++i) r.s[i] = c.s[i] < 0 ? b.s[i] : a.s[i];
+  return r;
+}
+
+// Scalar version, any non-zero c selects b.
+template<typename T, typename M>
+inline T select(T a, T b, M c) { return c ? b : a; }
+
+#define SHIM_VEC_TYPES(T) \
+  SHIM_SCALAR(T) \
+  typedef ShimVec<T, 2> T##2; \
+  typedef ShimVec<T, 3> T##3; \
+  typedef ShimVec<T, 4> T##4; \
+  typedef ShimVec<T, 8> T##8; \
+  typedef ShimVec<T, 16> T##16; \
+  SHIM_VEC_CONVERT(T, 2) \
+  SHIM_VEC_CONVERT(T, 3) \
+  SHIM_VEC_CONVERT(T, 4) \
+  SHIM_VEC_CONVERT(T, 8) \
+  SHIM_VEC_CONVERT(T, 16)
+
+// Overloads for each type rather than templates, so they are picked over
+// std::min and std::max in code that uses namespace std.
+#define SHIM_SCALAR(T) \
+  inline T min(T a, T b) { return b < a ? b : a; } \
+  inline T max(T a, T b) { return a < b ? b : a; } \
+  template<typename S> \
+  inline T convert_##T(S v) { return (T)v; } \
+  template<typename S> \
+  inline T as_##T(S v) { \
+    static_assert(sizeof(S) == sizeof(T), "Sizes differ"); \
+    T r; \
+    memcpy(&r, &v, sizeof(r)); \
+    return r; \
+  }
+
+// convert_<T>N() converts values (rounding to zero), as_<T>N() reinterprets
+// the bits of a vector of the same size.
+#define SHIM_VEC_CONVERT(T, N) \
+  template<typename S> \
+  inline ShimVec<T, N> convert_##T##N(const S& v) { \
+    const typename S::vec_type src = v; \
+    static_assert(S::vec_type::size == N, "Sizes differ"); \
+    ShimVec<T, N> r; \
+    for (int i = 0; i < N; ++i) r.s[i] = (T)src.s[i]; \
+    return r; \
+  } \
+  template<typename S> \
+  inline ShimVec<T, N> as_##T##N(const S& v) { \
+    const typename S::vec_type src = v; \
+    static_assert(sizeof(src) == sizeof(ShimVec<T, N>), "Sizes differ"); \
+    ShimVec<T, N> r; \
+    memcpy(r.s, src.s, sizeof(r)); \
+    return r; \
+  }
+
+SHIM_VEC_TYPES(char)
+SHIM_VEC_TYPES(uchar)
+SHIM_VEC_TYPES(short)
+SHIM_VEC_TYPES(ushort)
+SHIM_VEC_TYPES(int)
+SHIM_VEC_TYPES(uint)
+SHIM_VEC_TYPES(long)
+SHIM_VEC_TYPES(ulong)
+SHIM_VEC_TYPES(float)
+SHIM_VEC_TYPES(double)
+
+#undef SHIM_VEC_TYPES
+#undef SHIM_SCALAR
+#undef SHIM_VEC_CONVERT
+
+// vloadN(offset, p) reads the vector at p + offset * N, vstoreN(v, offset, p)
+// writes it. p only needs to be aligned to the component type.
+#define SHIM_VEC_LOAD_STORE(N) \
+  template<typename T> \
+  inline ShimVec<T, N> vload##N(size_t offset, const T* p) { \
+    return ShimVecOps<T, N>::loadu(p + offset * N); \
+  } \
+  template<typename T> \
+  inline void vstore##N(const ShimVec<T, N>& v, size_t offset, T* p) { \
+    ShimVecOps<T, N>::storeu(v, p + offset * N); \
+  }
+
+SHIM_VEC_LOAD_STORE(2)
+SHIM_VEC_LOAD_STORE(3)
+SHIM_VEC_LOAD_STORE(4)
+SHIM_VEC_LOAD_STORE(8)
+SHIM_VEC_LOAD_STORE(16)
+
+#undef SHIM_VEC_LOAD_STORE
+
+#endif
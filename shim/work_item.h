@@ -0,0 +1,60 @@
+#ifndef NONG_SHIM_WORK_ITEM_H
+#define NONG_SHIM_WORK_ITEM_H
+
+#include <stddef.h>
+
+// The opencl work item functions for kernels run by the ShimExecutor. Each
+// executor thread runs one work item at a time and keeps its ids here.
+struct ShimWorkItem {
+  unsigned int dims;
+  size_t global_id[3];
+  size_t local_id[3];
+  size_t group_id[3];
+  size_t global_size[3];
+  size_t local_size[3];
+  size_t num_groups[3];
+  size_t offset[3];
+  // Work items run by this call, starting at global_id along x: 1, or up to
+  // SHIM_LANES for packed kernels (see shim/packed.h).
+  int lanes;
+};
+
+extern thread_local ShimWorkItem shim_work_item;
+
+inline unsigned int get_work_dim() { return shim_work_item.dims; }
+inline size_t get_global_id(unsigned int dim) {
+  return dim < 3 ? shim_work_item.global_id[dim] : 0;
+}
+inline size_t get_local_id(unsigned int dim) {
+  return dim < 3 ? shim_work_item.local_id[dim] : 0;
+}
+inline size_t get_group_id(unsigned int dim) {
+  return dim < 3 ? shim_work_item.group_id[dim] : 0;
+}
+inline size_t get_global_size(unsigned int dim) {
+  return dim < 3 ? shim_work_item.global_size[dim] : 1;
+}
+inline size_t get_local_size(unsigned int dim) {
+  return dim < 3 ? shim_work_item.local_size[dim] : 1;
+}
+inline size_t get_num_groups(unsigned int dim) {
+  return dim < 3 ? shim_work_item.num_groups[dim] : 1;
+}
+inline size_t get_global_offset(unsigned int dim) {
+  return dim < 3 ? shim_work_item.offset[dim] : 0;
+}
+
+#define CLK_LOCAL_MEM_FENCE 1
+#define CLK_GLOBAL_MEM_FENCE 2
+
+// Waits until all work items of the work group reach the barrier. Only
+// available if the kernel is run with barriers enabled (see
+// ShimExecutor::Run()).
+void barrier(int flags);
+
+// Returns the local memory argument index of the current work group, with at
+// least bytes bytes. All work items of a work group get the same memory, e.g.
+// pass ShimLocalMem(0, 64 * sizeof(float)) for a __local float* argument.
+void* ShimLocalMem(int index, size_t bytes);
+
+#endif